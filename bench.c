@@ -0,0 +1,310 @@
+/*
+ * @Description: logging throughput and call latency benchmark, the results are written as CSV or
+ * JSON so the configurations and releases can be compared
+ */
+
+#define LOG_TAG "bench"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/* benchmark log file */
+#define BENCH_FILE_NAME "/tmp/log_bench.txt"
+/* benchmark log file max size, large enough to measure the writes instead of the rotation */
+#define BENCH_FILE_MAX_SIZE (256 * 1024 * 1024)
+
+/* benchmarked api */
+typedef enum {
+    BENCH_API_SITE = 0, /* log_i / log_d, the call site macros */
+    BENCH_API_OUTPUT,   /* log_output */
+    BENCH_API_RAW,      /* log_raw */
+    BENCH_API_HEXDUMP,  /* log_hexdump_ex */
+    BENCH_API_MAX,
+} BENCH_API;
+
+/* output sink of the logs */
+typedef enum {
+    BENCH_SINK_STDOUT = 0,
+    BENCH_SINK_FILE,
+    BENCH_SINK_NULL, /* stdout redirected to /dev/null */
+    BENCH_SINK_MAX,
+} BENCH_SINK;
+
+static const char* api_name[]  = {"site", "output", "raw", "hexdump"};
+static const char* sink_name[] = {"stdout", "file", "null"};
+static const size_t msg_sizes[] = {16, 128, 512};
+
+/* one benchmark case */
+typedef struct {
+    uint8_t api;
+    uint8_t sink;
+    bool async;
+    bool filtered; /* the level is filtered out */
+    int threads;
+    size_t msg_size;
+} bench_case_t;
+
+/* benchmark worker */
+typedef struct {
+    const bench_case_t* c;
+    size_t calls;
+    const char* msg;
+    uint64_t* lat;   /* call latency (ns) */
+    uint64_t start; /* first call time */
+    pthread_barrier_t* barrier;
+} bench_worker_t;
+
+static uint64_t bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_call(const bench_case_t* c, const char* msg) {
+    switch (c->api) {
+    case BENCH_API_SITE:
+        if (c->filtered) {
+            log_d("%s", msg);
+        } else {
+            log_i("%s", msg);
+        }
+        break;
+    case BENCH_API_OUTPUT:
+        log_output(c->filtered ? LOG_LVL_DEBUG : LOG_LVL_INFO, LOG_TAG, __FILE__, __FUNCTION__,
+                   __LINE__, "%s", msg);
+        break;
+    case BENCH_API_RAW:
+        log_raw("%s\n", msg);
+        break;
+    case BENCH_API_HEXDUMP:
+        log_hexdump_ex(c->filtered ? LOG_LVL_DEBUG : LOG_LVL_INFO, LOG_TAG, 16, msg, c->msg_size,
+                       0);
+        break;
+    }
+}
+
+static void* bench_worker(void* arg) {
+    bench_worker_t* w = arg;
+    uint64_t start;
+    size_t i;
+
+    pthread_barrier_wait(w->barrier);
+    w->start = bench_now();
+    for (i = 0; i < w->calls; i++) {
+        start = bench_now();
+        bench_call(w->c, w->msg);
+        w->lat[i] = bench_now() - start;
+    }
+
+    return NULL;
+}
+
+static int bench_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * set the logger for the case, the stdout is restored from the saved one
+ *
+ * @param c benchmark case
+ * @param stdout_fd saved stdout
+ * @param null_fd /dev/null
+ */
+static void bench_setup(const bench_case_t* c, int stdout_fd, int null_fd) {
+    log_set_async_enabled(false);
+    log_set_file_output_enabled(false);
+    unlink(BENCH_FILE_NAME);
+
+    dup2(c->sink == BENCH_SINK_NULL ? null_fd : stdout_fd, STDOUT_FILENO);
+    /* the file case doesn't output to console */
+    log_set_sink_filter(LOG_SINK_CONSOLE,
+                        c->sink == BENCH_SINK_FILE ? LOG_FILTER_LVL_SILENT : LOG_FILTER_LVL_ALL,
+                        NULL, LOG_SINK_FMT_ALL);
+    if (c->sink == BENCH_SINK_FILE) {
+        log_set_file_output_enabled(true);
+    }
+    log_set_filter_lvl(c->filtered ? LOG_LVL_INFO : LOG_LVL_VERBOSE);
+    log_set_async_enabled(c->async);
+}
+
+/**
+ * run the benchmark case and write the result
+ *
+ * @param c benchmark case
+ * @param calls calls per thread
+ * @param out result output
+ * @param json true: JSON false: CSV
+ * @param first first result
+ */
+static void bench_run(const bench_case_t* c, size_t calls, FILE* out, bool json, bool first) {
+    bench_worker_t workers[c->threads];
+    pthread_t threads[c->threads];
+    pthread_barrier_t barrier;
+    size_t total = calls * c->threads, i;
+    uint64_t *lat, start, elapsed;
+    char* msg;
+    double rate;
+
+    lat = malloc(total * sizeof(uint64_t));
+    msg = malloc(c->msg_size + 1);
+    if (lat == NULL || msg == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < c->msg_size; i++) {
+        msg[i] = 'a' + i % 26;
+    }
+    msg[c->msg_size] = '\0';
+
+    pthread_barrier_init(&barrier, NULL, c->threads + 1);
+    for (i = 0; i < (size_t)c->threads; i++) {
+        workers[i].c       = c;
+        workers[i].calls   = calls;
+        workers[i].msg     = msg;
+        workers[i].lat     = lat + i * calls;
+        workers[i].barrier = &barrier;
+        pthread_create(&threads[i], NULL, bench_worker, &workers[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    for (i = 0, start = UINT64_MAX; i < (size_t)c->threads; i++) {
+        pthread_join(threads[i], NULL);
+        start = workers[i].start < start ? workers[i].start : start;
+    }
+    /* the queued and buffered logs are part of the throughput */
+    log_flush();
+    elapsed = bench_now() - start;
+    pthread_barrier_destroy(&barrier);
+
+    qsort(lat, total, sizeof(uint64_t), bench_cmp);
+    rate = elapsed ? total * 1e9 / elapsed : 0;
+    if (json) {
+        fprintf(out,
+                "%s\n  {\"api\": \"%s\", \"mode\": \"%s\", \"sink\": \"%s\", \"level\": \"%s\", "
+                "\"threads\": %d, \"msg_size\": %zu, \"calls\": %zu, \"msgs_per_sec\": %.0f, "
+                "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                first ? "" : ",", api_name[c->api], c->async ? "async" : "sync",
+                sink_name[c->sink], c->filtered ? "filtered" : "emitted", c->threads, c->msg_size,
+                total, rate, (unsigned long long)lat[total * 50 / 100],
+                (unsigned long long)lat[total * 99 / 100],
+                (unsigned long long)lat[total * 999 / 1000], (unsigned long long)lat[total - 1]);
+    } else {
+        fprintf(out, "%s,%s,%s,%s,%d,%zu,%zu,%.0f,%llu,%llu,%llu,%llu\n", api_name[c->api],
+                c->async ? "async" : "sync", sink_name[c->sink],
+                c->filtered ? "filtered" : "emitted", c->threads, c->msg_size, total, rate,
+                (unsigned long long)lat[total * 50 / 100],
+                (unsigned long long)lat[total * 99 / 100],
+                (unsigned long long)lat[total * 999 / 1000], (unsigned long long)lat[total - 1]);
+    }
+    fflush(out);
+
+    free(msg);
+    free(lat);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-t max threads] [-n calls per thread] [-f csv|json] [-o result file]\n"
+            "  threads run as 1, 2, 4 ... up to max threads (default 4)\n"
+            "  calls per thread default 10000\n"
+            "  the result is written to stderr without -o, the stdout is a benchmarked sink\n",
+            name);
+}
+
+int main(int argc, char* argv[]) {
+    int max_threads = 4, stdout_fd, null_fd, opt, threads;
+    size_t calls = 10000, size_i;
+    bool json = false, first = true;
+    FILE* out = stderr;
+    bench_case_t c;
+    uint8_t mode;
+
+    while ((opt = getopt(argc, argv, "t:n:f:o:h")) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            calls = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            json = strcmp(optarg, "json") == 0;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                fprintf(stderr, "%s: open %s failed\n", argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_threads < 1 || calls == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    stdout_fd = dup(STDOUT_FILENO);
+    null_fd   = open("/dev/null", O_WRONLY);
+    if (stdout_fd < 0 || null_fd < 0) {
+        fprintf(stderr, "%s: open stdout or /dev/null failed\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    log_set_file_name(BENCH_FILE_NAME);
+    log_set_file_rotate(BENCH_FILE_MAX_SIZE, 1);
+
+    fputs(json ? "[" : "api,mode,sink,level,threads,msg_size,calls,msgs_per_sec,p50_ns,p99_ns,"
+                       "p999_ns,max_ns\n",
+          out);
+    memset(&c, 0, sizeof(c));
+    for (c.api = 0; c.api < BENCH_API_MAX; c.api++) {
+        for (mode = 0; mode < 2; mode++) {
+            for (c.sink = 0; c.sink < BENCH_SINK_MAX; c.sink++) {
+                /* the raw log has no level to filter */
+                for (c.filtered = false;; c.filtered = true) {
+                    for (threads = 1; threads <= max_threads;
+                         threads = threads < max_threads && threads * 2 > max_threads
+                                       ? max_threads
+                                       : threads * 2) {
+                        for (size_i = 0; size_i < sizeof(msg_sizes) / sizeof(msg_sizes[0]);
+                             size_i++) {
+                            c.async    = mode;
+                            c.threads  = threads;
+                            c.msg_size = msg_sizes[size_i];
+                            bench_setup(&c, stdout_fd, null_fd);
+                            bench_run(&c, calls, out, json, first);
+                            first = false;
+                        }
+                    }
+                    if (c.filtered || c.api == BENCH_API_RAW) break;
+                }
+            }
+        }
+    }
+    if (json) {
+        fputs("\n]\n", out);
+    }
+
+    log_set_async_enabled(false);
+    log_set_file_output_enabled(false);
+    unlink(BENCH_FILE_NAME);
+    dup2(stdout_fd, STDOUT_FILENO);
+    if (out != stderr) {
+        fclose(out);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -2,14 +2,36 @@
 #define LOG_TAG "log"
 #define LOG_LVL LOG_LVL_VERBOSE
 
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
-#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "log.h"
 
@@ -21,37 +43,85 @@
 #define unlikely(x) (x)
 #endif
 
-/* all formats index */
-typedef enum {
-    LOG_FMT_LVL    = 1 << 0, /**< level */
-    LOG_FMT_TAG    = 1 << 1, /**< tag */
-    LOG_FMT_TIME   = 1 << 2, /**< current time */
-    LOG_FMT_P_INFO = 1 << 3, /**< process info */
-    LOG_FMT_T_INFO = 1 << 4, /**< thread info */
-    LOG_FMT_DIR    = 1 << 5, /**< file directory and name */
-    LOG_FMT_FUNC   = 1 << 6, /**< function name */
-    LOG_FMT_LINE   = 1 << 7, /**< line number */
-} LOG_FMT;
-
-/* macro definition for all formats */
-#define LOG_FMT_ALL                                                                             \
-    (LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_P_INFO | LOG_FMT_T_INFO | LOG_FMT_DIR | \
-     LOG_FMT_FUNC | LOG_FMT_LINE)
-
-/* buffer size for every line's log */
+/* buffer size for every line's log, the longer line is formatted again in a pooled chunk */
 #define LOG_LINE_BUF_SIZE 1024
+/* default max line size, the longer line is truncated */
+#define LOG_LINE_MAX_SIZE (16 * 1024)
+/* max free chunks kept by the line chunk pool */
+#define LOG_LINE_POOL_MAX_NUM 16
+/* default format set of every level, they are constants when LOG_FMT_FIXED is defined */
+#ifndef LOG_FMT_SET_ASSERT
+#define LOG_FMT_SET_ASSERT (LOG_FMT_ALL & ~LOG_FMT_P_INFO & ~LOG_FMT_T_INFO)
+#endif
+#ifndef LOG_FMT_SET_ERROR
+#define LOG_FMT_SET_ERROR (LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_DIR)
+#endif
+#ifndef LOG_FMT_SET_WARN
+#define LOG_FMT_SET_WARN (LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_DIR)
+#endif
+#ifndef LOG_FMT_SET_INFO
+#define LOG_FMT_SET_INFO (LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME)
+#endif
+#ifndef LOG_FMT_SET_DEBUG
+#define LOG_FMT_SET_DEBUG (LOG_FMT_ALL & ~LOG_FMT_P_INFO & ~LOG_FMT_T_INFO)
+#endif
+#ifndef LOG_FMT_SET_VERBOSE
+#define LOG_FMT_SET_VERBOSE LOG_FMT_ALL
+#endif
+/* output time info max length */
+#define LOG_TIME_MAX_LEN 48
 /* output line number max length */
 #define LOG_LINE_NUM_MAX_LEN 5
+/* integer max length, 22 octal digits of the 64-bit value */
+#define LOG_NUM_MAX_LEN 24
+/* formats which are known to need vsnprintf */
+#define LOG_VFMT_SLOW_NUM 256
+/* width and precision max value of the fast formatter */
+#define LOG_VFMT_WIDTH_MAX 4096
 /* output filter's tag max length */
 #define LOG_FILTER_TAG_MAX_LEN 16
 /* output filter's keyword max length */
-#define LOG_FILTER_KW_MAX_LEN 16
-/* output filter's tag level max num */
-#define LOG_FILTER_TAG_LVL_MAX_NUM 5
+#define LOG_FILTER_KW_MAX_LEN 64
+/* output filter's include and exclude keyword max num */
+#define LOG_FILTER_KW_MAX_NUM 8
+/* output filter's tag level table initial size, it grows when half full */
+#define LOG_FILTER_TAG_LVL_INIT_NUM 64
 /* EasyLogger file log plugin's using max rotate file count */
 #define LOG_FILE_MAX_ROTATE 3
 /* EasyLogger file log plugin's using file max size */
 #define LOG_FILE_MAX_SIZE (10 * 1024)
+/* file log buffer size, 0: flush every line */
+#define LOG_FILE_BUF_SIZE (64 * 1024)
+/* file log buffer max flush interval (ms) */
+#define LOG_FILE_FLUSH_MS 1000
+/* file log which level is equal or higher than it will be flushed immediately */
+#define LOG_FILE_FLUSH_LVL LOG_LVL_ERROR
+/* async output ring slot kind */
+#define LOG_ASYNC_TEXT 0
+#define LOG_ASYNC_BIN 1
+/* async output ring default capacity (lines), rounded up to a power of two */
+#define LOG_ASYNC_CAPACITY 1024
+/* async output thread max lines written by one writev */
+#define LOG_ASYNC_BATCH 64
+/* async output thread idle wait time (ms) */
+#define LOG_ASYNC_IDLE_MS 10
+/* times a producer yields on the full ring before it sleeps until a slot is freed */
+#define LOG_ASYNC_SPIN 16
+/* statistics tag table size, the tags after it is full are not counted */
+#define LOG_STATS_TAG_NUM 256
+/* call sites which have a rate limit slot */
+#define LOG_LIMIT_SITE_NUM 1024
+/* slots probed for a call site, the site which finds no slot is not limited */
+#define LOG_LIMIT_PROBE_NUM 32
+/* tag max length of the rate limit report */
+#define LOG_LIMIT_TAG_MAX_LEN 32
+/* the count of a call site dropped for this time is reported (ms) */
+#define LOG_LIMIT_REPORT_MS 1000
+/* FNV-1a offset basis of the message hash */
+#define LOG_LIMIT_HASH_INIT 14695981039346656037ULL
+
+/* level of raw log, it has no level */
+#define LOG_LVL_RAW LOG_LVL_MAX
 
 /* output newline sign */
 #define LOG_NEWLINE_SIGN "\n"
@@ -95,60 +165,251 @@ typedef enum {
 /* output log's tag filter */
 typedef struct {
     uint8_t level;
+    uint32_t sample; /**< 1 in sample lines is output, 0: the level's sampling */
     char tag[LOG_FILTER_TAG_MAX_LEN + 1];
-    bool tag_use_flag; /**< false : tag is no used   true: tag is used */
+    bool tag_use_flag; /**< false : tag is no used   true: tag is used, it is never cleared */
 } log_tag_lvl_filter_t;
 
+/*
+ * output log's tag filter hash table, open addressing with linear probing.
+ * Readers don't lock: the tags are only inserted and the level is updated in place. When it
+ * grows, the old table is kept alive for the readers which still use it.
+ */
+typedef struct log_tag_lvl_table {
+    struct log_tag_lvl_table* old; /* replaced table */
+    size_t mask;
+    size_t used; /* used entries */
+    log_tag_lvl_filter_t entry[];
+} log_tag_lvl_table_t;
+
+/* output log's keyword filter */
+typedef struct {
+    uint8_t len;
+    bool exclude; /**< false : the log must have one of the include keywords   true: drop the log */
+    bool literal; /**< no '%' in keyword, it can be searched in the format string */
+    char str[LOG_FILTER_KW_MAX_LEN + 1];
+} log_kw_filter_t;
+
+/* output log's keyword filter list, it is replaced as a whole and the old one is retired */
+typedef struct log_kw_list {
+    uint8_t num;
+    uint8_t include_num;
+    log_kw_filter_t kw[LOG_FILTER_KW_MAX_NUM];
+} log_kw_list_t;
+
+/* keyword filter search result */
+#define LOG_KW_INCLUDE (1 << 0) /* found an include keyword */
+#define LOG_KW_EXCLUDE (1 << 1) /* found an exclude keyword */
+
+/* log site cached filter state flags, the state is (filter generation << 2) | flags */
+#define LOG_SITE_ENABLED (1 << 0)
+#define LOG_SITE_KW_INCLUDE (1 << 1) /* an include keyword is in the pre-rendered header */
+
 /* output log's filter */
 typedef struct {
     uint8_t level;
     char tag[LOG_FILTER_TAG_MAX_LEN + 1];
-    char keyword[LOG_FILTER_KW_MAX_LEN + 1];
-    log_tag_lvl_filter_t tag_lvl[LOG_FILTER_TAG_LVL_MAX_NUM];
+    log_kw_list_t* kw; /* NULL: no keyword filter */
+    log_tag_lvl_table_t* tag_lvl;
+    size_t tag_lvl_num;           /* tags which have level filter */
+    size_t tag_sample_num;        /* tags which have sampling */
+    uint32_t sample[LOG_LVL_MAX]; /* 1 in sample lines of the level is output, 0 or 1: all */
 } log_filter_t;
 
+/*
+ * memory mapped file segment, it is preallocated with max_size. The writers reserve space by the
+ * cursor without the file lock, and the segment is unmapped after all writers have left.
+ */
+typedef struct log_mmap_seg {
+    char* base;
+    size_t size;                                  /* mapped size */
+    size_t end;                                   /* data end when a line doesn't fit */
+    size_t cursor __attribute__((aligned(64)));   /* reserved length */
+    size_t users __attribute__((aligned(64)));    /* writers in the segment */
+} log_mmap_seg_t;
+
+/* log line parts, their end offsets are recorded while packaging so a sink can remove parts */
+typedef enum {
+    LOG_PART_COLOR = 0, /* CSI start sign and color info */
+    LOG_PART_LVL,
+    LOG_PART_TAG,
+    LOG_PART_INFO, /* time, process and thread info */
+    LOG_PART_LOC,  /* file, line and function info */
+    LOG_PART_MSG,
+    LOG_PART_CSI_END,
+    LOG_PART_NEWLINE,
+    LOG_PART_MAX,
+} LOG_PART;
+
+/* log line dispatched to the sinks */
+typedef struct {
+    uint8_t level;
+    uint32_t sinks;              /* sinks which accept the line */
+    uint16_t part[LOG_PART_MAX]; /* end offset of every part */
+} log_line_t;
+
+/* header segment op of the format plan */
+typedef enum {
+    LOG_SEG_END = 0,
+    LOG_SEG_LIT, /* literal */
+    LOG_SEG_TIME,
+    LOG_SEG_P_INFO,
+    LOG_SEG_T_INFO,
+    LOG_SEG_DIR,
+    LOG_SEG_LINE,
+    LOG_SEG_FUNC,
+} LOG_SEG;
+
+/* max ops of the info or location segments, the end op included */
+#define LOG_SEG_MAX_NUM 8
+
+/* header segment */
+typedef struct {
+    uint8_t op;
+    uint8_t len;     /* literal length */
+    const char* lit; /* literal */
+} log_seg_t;
+
+/* header layout of a level, built from the format set */
+typedef struct {
+    size_t set;
+    log_seg_t info[LOG_SEG_MAX_NUM]; /* time, process and thread info */
+    log_seg_t loc[LOG_SEG_MAX_NUM];  /* file, line and function info */
+} log_lvl_plan_t;
+
+/* header layouts of all levels, they are rebuilt when a format set is changed */
+typedef struct log_fmt_plan {
+    uint32_t gen;             /* the pre-rendered site headers of other generations are stale */
+    log_lvl_plan_t lvl[LOG_LVL_MAX];
+} log_fmt_plan_t;
+
+/* registered sink */
+typedef struct {
+    log_sink_t cfg;
+    char* tag;               /* tag filter, NULL: all tags. It is replaced as a whole and retired */
+    struct log_async* queue; /* own async queue, NULL: output by the dispatcher */
+} log_sink_entry_t;
+
 /* easy logger */
 typedef struct {
     log_filter_t filter;
     size_t enabled_fmt_set[LOG_LVL_MAX];
+    log_fmt_plan_t* fmt_plan; /* NULL: not built */
     bool init_ok;
     bool output_enabled;
     bool text_color_enabled;
+    uint8_t encoding; /* LOG_ENC of the log lines */
+    uint8_t time_clock;     /* clock of the time info */
+    uint8_t time_precision; /* fraction precision of the time info */
     /* file */
     char* name;      /* file name */
     FILE* fp;        /* file descriptor */
     size_t max_size; /* file max size */
     int max_rotate;  /* max rotate file count */
+    uint8_t rotate_policy; /* file rotation by time */
+    time_t rotate_time;    /* next rotation by time, 0: none */
+    uint8_t compress;      /* rotated file compression */
+    size_t retention;      /* rotated files max total size, 0: no limit */
+    size_t file_size;         /* current file size */
+    char* file_buf;           /* file user-space buffer */
+    size_t file_buf_size;     /* file buffer size */
+    uint32_t file_flush_ms;   /* file flush interval */
+    uint8_t file_flush_lvl;   /* file flush immediately level */
+    uint64_t file_flush_time; /* last file flush time */
+    bool file_mmap;           /* file is written by memory mapped segments */
+    struct log_mmap_seg* mmap_seg; /* current mapped segment, NULL: not mapped */
+    /* async */
+    bool async_enabled;     /* async output enabled */
+    uint8_t async_overflow; /* async ring overflow policy */
+    size_t async_capacity;  /* async ring capacity */
+    /* line buffer */
+    size_t line_max; /* max line size */
+    /* console */
+    uint8_t console_stderr_lvl; /* levels up to it go to stderr, LOG_CONSOLE_STDERR_NONE: none */
+    size_t console_backlog;     /* non-blocking backlog per fd, 0: blocking writes */
+    /* statistics */
+    bool stats_enabled;
+    uint32_t stats_report_ms; /* self-report interval, 0: no report */
+    /* rate limit */
+    uint64_t limit_interval; /* time per line of a call site (ns), 0: no limit */
+    uint64_t limit_burst;    /* lines output at once */
+    uint64_t dedup_window;   /* repeated line suppression window (ns), 0: no suppression */
+    /* binary file */
+    char* bin_name;   /* binary file name */
+    FILE* bin_fp;     /* binary file descriptor */
+    uint32_t bin_gen; /* binary file generation, increased on every open */
 } log_t;
 
 /* log */
 static log_t g_log = {
+    .line_max           = LOG_LINE_MAX_SIZE,
+    .console_stderr_lvl = LOG_CONSOLE_STDERR_NONE,
     .filter =
         {
             .level = LOG_LVL_VERBOSE,
         },
     .enabled_fmt_set =
         {
-            LOG_FMT_ALL & ~LOG_FMT_P_INFO & ~LOG_FMT_T_INFO,        /* LOG_LVL_ASSERT */
-            LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_DIR, /* LOG_LVL_ERROR */
-            LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_DIR, /* LOG_LVL_WARN */
-            LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME,               /* LOG_LVL_INFO */
-            LOG_FMT_ALL & ~LOG_FMT_P_INFO & ~LOG_FMT_T_INFO,        /* LOG_LVL_DEBUG */
-            LOG_FMT_ALL,                                            /* LOG_LVL_VERBOSE */
+            LOG_FMT_SET_ASSERT,  /* LOG_LVL_ASSERT */
+            LOG_FMT_SET_ERROR,   /* LOG_LVL_ERROR */
+            LOG_FMT_SET_WARN,    /* LOG_LVL_WARN */
+            LOG_FMT_SET_INFO,    /* LOG_LVL_INFO */
+            LOG_FMT_SET_DEBUG,   /* LOG_LVL_DEBUG */
+            LOG_FMT_SET_VERBOSE, /* LOG_LVL_VERBOSE */
         },
     .output_enabled     = true,
     .text_color_enabled = true,
     .max_size           = LOG_FILE_MAX_SIZE,
     .max_rotate         = LOG_FILE_MAX_ROTATE,
+    .file_buf_size      = LOG_FILE_BUF_SIZE,
+    .file_flush_ms      = LOG_FILE_FLUSH_MS,
+    .file_flush_lvl     = LOG_FILE_FLUSH_LVL,
+    .async_overflow     = LOG_ASYNC_OVERFLOW_BLOCK,
+    .async_capacity     = LOG_ASYNC_CAPACITY,
 };
-/* every line log's buffer */
-static char log_buf[LOG_LINE_BUF_SIZE] = {0};
+
+/* filter generation, the log sites compare it with their cached filter state */
+uint32_t log_filter_gen = 1;
+
+/* pre-rendered header of the log site */
+typedef struct log_site_head {
+    uint32_t gen;                    /* format plan generation */
+    uint16_t part[LOG_PART_TAG + 1]; /* color, level and tag info end */
+    uint16_t loc_len;                /* file, line and function info */
+    char buf[];
+} log_site_head_t;
+/* rate limit and repeat state of the call site */
+typedef struct {
+    uint32_t state; /* 0: free 1: being set 2: set */
+    uint8_t level;
+    char tag[LOG_LIMIT_TAG_MAX_LEN + 1];
+    const char* file;
+    const char* func;
+    long line;
+    uint64_t tat;           /* theoretical arrival time of the next line (ns) */
+    uint64_t suppressed;    /* lines dropped by the rate limit since the last report */
+    uint64_t suppress_time; /* last drop time (ns) */
+    uint64_t hash;          /* hash of the last output message */
+    uint64_t emit_time;     /* output time of the last message (ns) */
+    uint64_t repeated;      /* repeats of the last message since the last report */
+    uint64_t repeat_time;   /* last repeat time (ns) */
+} log_limit_t;
+
+/* every line log's buffer, one per thread so formatting runs without the output lock */
+static __thread char log_buf[LOG_LINE_BUF_SIZE];
+/* trace id of this thread, 0: the sampling uses the random number */
+static __thread uint64_t sample_trace;
+/* xorshift random number state of this thread, 0: not seeded */
+static __thread uint64_t sample_seed;
 /* level output info */
 static const char* level_output_info[] = {
     [LOG_LVL_ASSERT] = "A/", [LOG_LVL_ERROR] = "E/", [LOG_LVL_WARN] = "W/",
     [LOG_LVL_INFO] = "I/",   [LOG_LVL_DEBUG] = "D/", [LOG_LVL_VERBOSE] = "V/",
 };
 
+/* level output info length */
+#define LEVEL_OUTPUT_LEN (sizeof("A/") - 1)
+
 /* color output info */
 static const char* color_output_info[] = {
     [LOG_LVL_ASSERT] = LOG_COLOR_ASSERT, [LOG_LVL_ERROR] = LOG_COLOR_ERROR,
@@ -156,18 +417,46 @@ static const char* color_output_info[] = {
     [LOG_LVL_DEBUG] = LOG_COLOR_DEBUG,   [LOG_LVL_VERBOSE] = LOG_COLOR_VERBOSE,
 };
 
+/* color output info length */
+static const size_t color_output_len[] = {
+    [LOG_LVL_ASSERT]  = sizeof(LOG_COLOR_ASSERT) - 1,
+    [LOG_LVL_ERROR]   = sizeof(LOG_COLOR_ERROR) - 1,
+    [LOG_LVL_WARN]    = sizeof(LOG_COLOR_WARN) - 1,
+    [LOG_LVL_INFO]    = sizeof(LOG_COLOR_INFO) - 1,
+    [LOG_LVL_DEBUG]   = sizeof(LOG_COLOR_DEBUG) - 1,
+    [LOG_LVL_VERBOSE] = sizeof(LOG_COLOR_VERBOSE) - 1,
+};
+
 void (*log_assert_hook)(const char* expr, const char* func, size_t line);
 
 /* log */
-static bool get_fmt_enabled(uint8_t level, size_t set);
+static void log_bin_init(void);
+static void log_kv_voutput(uint8_t level, const char* tag, const char* file, const char* func,
+                           long line, const log_kv_t* kv, size_t kv_num, uint8_t kw_flags,
+                           log_limit_t* limit, const char* format, va_list args);
+static size_t log_kv_line(char** buf, size_t buf_size, log_line_t* out, uint8_t level,
+                          const char* tag, const char* file, const char* func, long line,
+                          const char* msg, size_t msg_len, const log_kv_t* kv, size_t kv_num,
+                          uint8_t kw_flags);
+static void log_limit_check(bool all);
+static size_t log_bin_async_format(char* rec, size_t len, uint16_t* part);
+static bool log_file_rotate(void);
+static void log_file_rotate_recover(void);
+static void log_file_flusher_start(void);
+static void log_file_flusher_stop(void);
 
 /* port */
 static int log_init(void);
 static int log_port_init(void);
-static void log_port_output(const char* log, size_t size);
+static void log_port_output_v(int fd, struct iovec* iov, int cnt, const int* line_end, int lines);
+static void log_port_output_retry(void);
+static void log_port_output_reset(void);
 static void log_port_output_lock(void);
 static void log_port_output_unlock(void);
-static const char* log_port_get_time(void);
+static void log_port_get_clock(uint8_t clock, struct timespec* ts);
+static size_t log_port_format_time(const struct timespec* ts, uint8_t clock, uint8_t precision,
+                                   char* buf);
+static const char* log_port_get_time(size_t* len);
 static const char* log_port_get_p_info(void);
 static const char* log_port_get_t_info(void);
 
@@ -176,729 +465,6961 @@ static void inline log_file_port_lock(void);
 static void inline log_file_port_unlock(void);
 static void log_file_port_deinit(void);
 
-/**
- * another copy string function
- *
- * @param cur_len current copied log length, max size is LOG_LINE_BUF_SIZE
- * @param dst destination
- * @param src source
- *
- * @return copied length
- */
-static size_t log_strcpy(size_t cur_len, char* dst, const char* src) {
-    const char* src_old = src;
+/* statistics counters of a thread, only written by the owner thread */
+typedef struct log_stats_block {
+    struct log_stats_block* next;
+    uint64_t emitted[LOG_LVL_MAX + 1];
+    uint64_t filtered[LOG_LVL_MAX];
+    uint64_t truncated;
+    uint64_t sink_bytes[LOG_SINK_MAX_NUM];
+} log_stats_block_t;
 
-    if (!dst || !src) return 0;
+/* statistics of a tag, the tag is set once before the state is ready */
+typedef struct {
+    uint32_t state; /* 0: empty 1: being set 2: ready */
+    char tag[LOG_FILTER_TAG_MAX_LEN + 1];
+    uint64_t emitted;
+    uint64_t filtered;
+} log_stats_tag_t;
+
+/* add to the counter which is only written by one thread, no atomic read-modify-write needed */
+#define LOG_STATS_ADD(counter, n)                                                      \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), \
+                     __ATOMIC_RELAXED)
+
+/* counters of this thread */
+static __thread log_stats_block_t* stats_block;
+/* the counters of this thread have been folded, the logs from the later destructors aren't
+ * counted */
+static __thread bool stats_block_exited;
+/* counters of all threads and the folded counters of the exited threads, under stats_lock */
+static log_stats_block_t* stats_blocks;
+static log_stats_block_t stats_exited;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+/* shared counters, they are only changed on contention and rotation */
+static uint64_t stats_output_lock_wait[2]; /* count and ns */
+static uint64_t stats_file_lock_wait[2];
+static uint64_t stats_rotate[2];
+/* lines dropped by the full non-blocking console backlog */
+static size_t console_drops;
+static log_stats_tag_t stats_tags[LOG_STATS_TAG_NUM];
+/* next self-report time (ms) */
+static uint64_t stats_report_next;
+
+static uint64_t log_stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    while (*src != 0) {
-        /* make sure destination has enough space */
-        if (cur_len++ < LOG_LINE_BUF_SIZE) {
-            *dst++ = *src++;
-        } else {
+/* fold the counters of the exited thread */
+static void log_stats_block_exit(void* arg) {
+    log_stats_block_t *block = arg, **cur;
+    size_t i;
+
+    pthread_mutex_lock(&stats_lock);
+    for (cur = &stats_blocks; *cur; cur = &(*cur)->next) {
+        if (*cur == block) {
+            *cur = block->next;
             break;
         }
     }
-    return src - src_old;
+    for (i = 0; i < LOG_LVL_MAX + 1; i++) {
+        stats_exited.emitted[i] += block->emitted[i];
+    }
+    for (i = 0; i < LOG_LVL_MAX; i++) {
+        stats_exited.filtered[i] += block->filtered[i];
+    }
+    for (i = 0; i < LOG_SINK_MAX_NUM; i++) {
+        stats_exited.sink_bytes[i] += block->sink_bytes[i];
+    }
+    stats_exited.truncated += block->truncated;
+    pthread_mutex_unlock(&stats_lock);
+
+    stats_block        = NULL;
+    stats_block_exited = true;
+    free(block);
 }
 
-static int log_file_init(void) {
-    log_file_port_init();
+static void log_stats_key_create(void) { pthread_key_create(&stats_key, log_stats_block_exit); }
 
-    log_file_port_lock();
+/* get the counters of this thread, NULL: statistics disabled or out of memory */
+static log_stats_block_t* log_stats_get(void) {
+    log_stats_block_t* block = stats_block;
 
-    g_log.fp = fopen(g_log.name, "a+");
+    if (likely(!__atomic_load_n(&g_log.stats_enabled, __ATOMIC_RELAXED))) {
+        return NULL;
+    } else if (likely(block != NULL)) {
+        return block;
+    } else if (stats_block_exited) {
+        return NULL;
+    }
 
-    log_file_port_unlock();
-    return 0;
+    if ((block = calloc(1, sizeof(log_stats_block_t))) == NULL) {
+        return NULL;
+    }
+    pthread_once(&stats_key_once, log_stats_key_create);
+    pthread_setspecific(stats_key, block);
+    pthread_mutex_lock(&stats_lock);
+    block->next  = stats_blocks;
+    stats_blocks = block;
+    pthread_mutex_unlock(&stats_lock);
+    stats_block = block;
+
+    return block;
 }
 
-/*
- * rotate the log file xxx.log.n-1 => xxx.log.n, and xxx.log => xxx.log.0
- */
-static bool log_file_rotate(void) {
-#define SUFFIX_LEN 10
-    /* mv xxx.log.n-1 => xxx.log.n, and xxx.log => xxx.log.0 */
-    int n, err = 0;
-    char oldpath[256], newpath[256];
-    size_t base = strlen(g_log.name);
-    bool result = true;
-    FILE* tmp_fp;
-
-    memcpy(oldpath, g_log.name, base);
-    memcpy(newpath, g_log.name, base);
-
-    fclose(g_log.fp);
+/* find or add the tag statistics, NULL: the table is full */
+static log_stats_tag_t* log_stats_tag(const char* tag) {
+    uint32_t hash = 2166136261u, state;
+    log_stats_tag_t* entry;
+    size_t i, n;
 
-    for (n = g_log.max_rotate - 1; n >= 0; --n) {
-        snprintf(oldpath + base, SUFFIX_LEN, n ? ".%d" : "", n - 1);
-        snprintf(newpath + base, SUFFIX_LEN, ".%d", n);
-        /* remove the old file */
-        if ((tmp_fp = fopen(newpath, "r")) != NULL) {
-            fclose(tmp_fp);
-            remove(newpath);
+    for (i = 0; i < LOG_FILTER_TAG_MAX_LEN && tag[i]; i++) {
+        hash = (hash ^ (uint8_t)tag[i]) * 16777619u;
+    }
+    for (n = 0; n < LOG_STATS_TAG_NUM; n++, hash++) {
+        entry = &stats_tags[hash % LOG_STATS_TAG_NUM];
+        state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+        if (state == 0 && __atomic_compare_exchange_n(&entry->state, &state, 1, false,
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            strncpy(entry->tag, tag, LOG_FILTER_TAG_MAX_LEN);
+            __atomic_store_n(&entry->state, 2, __ATOMIC_RELEASE);
+            return entry;
         }
-        /* change the new log file to old file name */
-        if ((tmp_fp = fopen(oldpath, "r")) != NULL) {
-            fclose(tmp_fp);
-            err = rename(oldpath, newpath);
+        /* another thread is setting it */
+        while (state == 1) {
+            sched_yield();
+            state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
         }
-
-        if (err < 0) {
-            result = false;
-            goto __exit;
+        if (!strncmp(entry->tag, tag, LOG_FILTER_TAG_MAX_LEN)) {
+            return entry;
         }
     }
 
-__exit:
-    /* reopen the file */
-    g_log.fp = fopen(g_log.name, "a+");
-
-    return result;
+    return NULL;
 }
 
-static void log_file_write(const char* log, size_t size) {
-    size_t file_size = 0;
-
-    LOG_CHECK(log == NULL, return;);
-
-    log_file_port_lock();
-
-    if (g_log.fp == NULL) goto __exit;
-
-    fseek(g_log.fp, 0L, SEEK_END);
-    file_size = ftell(g_log.fp);
+/**
+ * count the line
+ *
+ * @param level level, LOG_LVL_RAW: raw log
+ * @param tag tag, NULL: no tag statistics
+ * @param emitted true: output false: dropped by the filters
+ */
+static void log_stats_line(uint8_t level, const char* tag, bool emitted) {
+    log_stats_block_t* block = log_stats_get();
+    log_stats_tag_t* entry;
 
-    if (unlikely(file_size > g_log.max_size)) {
-#if LOG_FILE_MAX_ROTATE > 0
-        if (!log_file_rotate()) {
-            goto __exit;
-        }
-#else
-        goto __exit;
-#endif
+    if (likely(block == NULL)) {
+        return;
     }
 
-    fwrite(log, size, 1, g_log.fp);
-
-    fflush(g_log.fp);
-
-__exit:
-    log_file_port_unlock();
+    if (emitted) {
+        LOG_STATS_ADD(block->emitted[level], 1);
+    } else if (level < LOG_LVL_MAX) {
+        LOG_STATS_ADD(block->filtered[level], 1);
+    }
+    if (tag && (entry = log_stats_tag(tag)) != NULL) {
+        __atomic_add_fetch(emitted ? &entry->emitted : &entry->filtered, 1, __ATOMIC_RELAXED);
+    }
 }
 
-static void log_file_deinit(void) {
-    log_file_port_lock();
+/* count the truncated line */
+static void log_stats_truncated(void) {
+    log_stats_block_t* block = log_stats_get();
 
-    if (g_log.fp) {
-        fclose(g_log.fp);
-        g_log.fp = NULL;
+    if (unlikely(block != NULL)) {
+        LOG_STATS_ADD(block->truncated, 1);
     }
+}
 
-    log_file_port_unlock();
+/* count the bytes written to the sink */
+static void log_stats_bytes(int sink, size_t size) {
+    log_stats_block_t* block = log_stats_get();
 
-    log_file_port_deinit();
+    if (unlikely(block != NULL)) {
+        LOG_STATS_ADD(block->sink_bytes[sink], size);
+    }
 }
 
 /**
- * EasyLogger initialize.
+ * lock and count the wait time when it is contended
  *
- * @return result
+ * @param lock lock
+ * @param wait count and ns of the waits
  */
-int log_init(void) {
-    int ret = 0;
+static void log_stats_lock(pthread_mutex_t* lock, uint64_t* wait) {
+    uint64_t start;
 
-    /* port initialize */
-    if ((ret = log_port_init()) != 0) return ret;
-
-    /* close printf buffer */
-    setbuf(stdout, NULL);
+    if (likely(pthread_mutex_trylock(lock) == 0)) {
+        return;
+    } else if (!__atomic_load_n(&g_log.stats_enabled, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(lock);
+        return;
+    }
 
-    g_log.init_ok = true;
+    start = log_stats_now();
+    pthread_mutex_lock(lock);
+    __atomic_add_fetch(&wait[0], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&wait[1], log_stats_now() - start, __ATOMIC_RELAXED);
+}
 
-    return ret;
+/* count the rotation which started at the time */
+static void log_stats_rotate(uint64_t start) {
+    if (__atomic_load_n(&g_log.stats_enabled, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&stats_rotate[0], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats_rotate[1], log_stats_now() - start, __ATOMIC_RELAXED);
+    }
 }
 
-/**
- * set output enable or disable
- *
- * @param enabled TRUE: enable FALSE: disable
- */
-void log_set_output_enabled(bool enabled) { g_log.output_enabled = enabled; }
+/* chunk of the line which doesn't fit in the line buffer */
+typedef struct log_chunk {
+    struct log_chunk* next;
+    size_t size;
+    char buf[];
+} log_chunk_t;
+
+/* chunks of this thread, they are kept until the thread exits */
+typedef struct {
+    log_chunk_t* line; /* formatted line */
+    log_chunk_t* view; /* line output by the sink */
+    log_chunk_t* enc;  /* message of the structured line */
+} log_chunk_tls_t;
+
+static __thread log_chunk_tls_t chunk_tls;
+/* free chunks */
+static log_chunk_t* chunk_pool;
+static size_t chunk_pool_num;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t chunk_key;
+static pthread_once_t chunk_key_once = PTHREAD_ONCE_INIT;
 
 /**
- * set log file output enable or disable
+ * get a chunk from the pool, a new one is allocated when no free chunk is large enough
  *
- * @param enabled TRUE: enable FALSE: disable
+ * @param size min size
+ *
+ * @return chunk, NULL: out of memory
  */
-void log_set_file_output_enabled(bool enabled)
-{
-    LOG_CHECK(g_log.name == NULL, return );
+static log_chunk_t* log_chunk_get(size_t size) {
+    log_chunk_t *chunk, **cur;
+    size_t alloc = LOG_LINE_BUF_SIZE * 2;
+
+    pthread_mutex_lock(&chunk_lock);
+    for (cur = &chunk_pool; *cur; cur = &(*cur)->next) {
+        if ((*cur)->size >= size) {
+            chunk = *cur;
+            *cur  = chunk->next;
+            chunk_pool_num--;
+            pthread_mutex_unlock(&chunk_lock);
+            return chunk;
+        }
+    }
+    pthread_mutex_unlock(&chunk_lock);
 
-    if (enabled && g_log.fp == NULL)
-        log_file_init();
-    else if (g_log.fp != NULL)
-        log_file_deinit();
+    while (alloc < size) {
+        alloc <<= 1;
+    }
+    if ((chunk = malloc(sizeof(log_chunk_t) + alloc)) != NULL) {
+        chunk->size = alloc;
+    }
+
+    return chunk;
 }
 
-/**
- * set log file name
- *
- * @param name log file name
- */
-void log_set_file_name(const char* name) {
-    LOG_CHECK(name == NULL || strlen(name) == 0, return );
-    LOG_CHECK(g_log.fp != NULL, return );
+/* give the chunk back to the pool, it is freed when the pool is full */
+static void log_chunk_put(log_chunk_t* chunk) {
+    if (chunk == NULL) return;
 
-    g_log.name = (char*)name;
+    pthread_mutex_lock(&chunk_lock);
+    if (chunk_pool_num < LOG_LINE_POOL_MAX_NUM) {
+        chunk->next = chunk_pool;
+        chunk_pool  = chunk;
+        chunk_pool_num++;
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&chunk_lock);
+
+    free(chunk);
 }
 
-/**
- * set log filter all parameter
- *
- * @param level level
- * @param tag tag
- * @param keyword keyword
- */
-void log_set_filter(uint8_t level, const char* tag, const char* keyword) {
-    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+/* give the chunks of the exited thread back */
+static void log_chunk_tls_exit(void* arg) {
+    log_chunk_tls_t* tls = arg;
 
-    log_set_filter_lvl(level);
-    log_set_filter_tag(tag);
-    log_set_filter_kw(keyword);
+    log_chunk_put(tls->line);
+    log_chunk_put(tls->view);
+    log_chunk_put(tls->enc);
+    tls->line = NULL;
+    tls->view = NULL;
+    tls->enc  = NULL;
 }
 
+static void log_chunk_key_create(void) { pthread_key_create(&chunk_key, log_chunk_tls_exit); }
+
 /**
- * set log filter's level
+ * get the buffer of this thread for the line which doesn't fit in the line buffer
  *
- * @param level level
+ * @param chunk chunk of this thread, chunk_tls.line, chunk_tls.view or chunk_tls.enc
+ * @param size needed size
+ * @param max max size, the size is cut to it
+ * @param buf_size buffer size
+ *
+ * @return buffer, NULL: the max size is not larger than the line buffer or out of memory
  */
-void log_set_filter_lvl(uint8_t level) {
-    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+static char* log_chunk_buf(log_chunk_t** chunk, size_t size, size_t max, size_t* buf_size) {
+    if (size > max) {
+        size = max;
+    }
+    if (size <= LOG_LINE_BUF_SIZE) {
+        return NULL;
+    }
+    if (*chunk == NULL || (*chunk)->size < size) {
+        log_chunk_put(*chunk);
+        if ((*chunk = log_chunk_get(size)) == NULL) {
+            return NULL;
+        }
+        pthread_once(&chunk_key_once, log_chunk_key_create);
+        pthread_setspecific(chunk_key, &chunk_tls);
+    }
+    *buf_size = size;
 
-    g_log.filter.level = level;
+    return (*chunk)->buf;
 }
 
-/**
- * set log filter's tag
- *
- * @param tag tag
+/*
+ * reclamation of the replaced snapshots which are read without lock: the keyword filter lists,
+ * format plans, site headers and sink tags. A thread publishes the epoch it entered while it may
+ * hold a snapshot. The replaced snapshot is retired with the current epoch and freed after every
+ * reader which may have seen it has left.
  */
-void log_set_filter_tag(const char* tag) { strncpy(g_log.filter.tag, tag, LOG_FILTER_TAG_MAX_LEN); }
+typedef struct log_reader {
+    struct log_reader* next;
+    uint64_t epoch; /* epoch when the thread entered, 0: not reading */
+} log_reader_t;
+
+/* replaced snapshot waiting for its readers */
+typedef struct log_retired {
+    struct log_retired* next;
+    void* ptr;
+    uint64_t epoch;
+} log_retired_t;
+
+/* reader of this thread, nested reads only enter once */
+static __thread log_reader_t* reader_self;
+static __thread uint32_t reader_depth;
+static __thread bool reader_exited;
+/* readers and retired snapshots, under retire_lock */
+static log_reader_t* readers;
+static log_retired_t* retired;
+static uint64_t retire_epoch = 1;
+/* readers without the reader record (after their thread exit or out of memory), nothing is
+ * freed while they are reading */
+static size_t readers_anon;
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+
+/* remove the reader of the exited thread */
+static void log_reader_exit(void* arg) {
+    log_reader_t *reader = arg, **cur;
+
+    pthread_mutex_lock(&retire_lock);
+    for (cur = &readers; *cur; cur = &(*cur)->next) {
+        if (*cur == reader) {
+            *cur = reader->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&retire_lock);
 
-/**
- * set log filter's keyword
- *
- * @param keyword keyword
- */
-void log_set_filter_kw(const char* keyword) {
-    strncpy(g_log.filter.keyword, keyword, LOG_FILTER_KW_MAX_LEN);
+    reader_self   = NULL;
+    reader_exited = true;
+    free(reader);
 }
 
-/**
- * Set the filter's level by different tag.
- * The log on this tag which level is less than it will stop output.
- *
- * example:
- *     // the example tag log enter silent mode
- *     log_set_filter_tag_lvl("example", LOG_FILTER_LVL_SILENT);
- *     // the example tag log which level is less than INFO level will stop output
- *     log_set_filter_tag_lvl("example", LOG_LVL_INFO);
- *     // remove example tag's level filter, all level log will resume output
- *     log_set_filter_tag_lvl("example", LOG_FILTER_LVL_ALL);
- *
- * @param tag log tag
- * @param level The filter level. When the level is LOG_FILTER_LVL_SILENT, the log enter silent
- * mode. When the level is LOG_FILTER_LVL_ALL, it will remove this tag's level filer. Then all level
- * log will resume output.
- *
- */
-void log_set_filter_tag_lvl(const char* tag, uint8_t level) {
-    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
-    LOG_CHECK(tag == NULL, return;);
-    uint8_t i = 0;
+static void log_reader_key_create(void) { pthread_key_create(&reader_key, log_reader_exit); }
 
-    if (!g_log.init_ok) {
-        log_init();
+/* register the reader of this thread, NULL: the thread has exited or out of memory */
+static log_reader_t* log_reader_get(void) {
+    log_reader_t* reader;
+
+    if (reader_exited || (reader = calloc(1, sizeof(log_reader_t))) == NULL) {
+        return NULL;
     }
+    pthread_once(&reader_key_once, log_reader_key_create);
+    pthread_setspecific(reader_key, reader);
+    pthread_mutex_lock(&retire_lock);
+    reader->next = readers;
+    readers      = reader;
+    pthread_mutex_unlock(&retire_lock);
+    reader_self = reader;
+
+    return reader;
+}
 
-    log_port_output_lock();
-    /* find the tag in arr */
-    for (i = 0; i < LOG_FILTER_TAG_LVL_MAX_NUM; i++) {
-        if (g_log.filter.tag_lvl[i].tag_use_flag == true &&
-            !strncmp(tag, g_log.filter.tag_lvl[i].tag, LOG_FILTER_TAG_MAX_LEN)) {
-            break;
-        }
+/* start reading the snapshots, the return value is only for LOG_READ_SCOPE */
+static inline uint8_t log_read_enter(void) {
+    log_reader_t* reader = reader_self;
+
+    if (reader_depth++ > 0) return 0;
+
+    if (unlikely(reader == NULL) && (reader = log_reader_get()) == NULL) {
+        __atomic_add_fetch(&readers_anon, 1, __ATOMIC_SEQ_CST);
+        return 0;
     }
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&retire_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    /* the snapshots are loaded after the retiring thread can see this reader */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    if (i < LOG_FILTER_TAG_LVL_MAX_NUM) {
-        /* find OK */
-        if (level == LOG_FILTER_LVL_ALL) {
-            /* remove current tag's level filter when input level is the lowest level */
-            g_log.filter.tag_lvl[i].tag_use_flag = false;
-            memset(g_log.filter.tag_lvl[i].tag, '\0', LOG_FILTER_TAG_MAX_LEN + 1);
-            g_log.filter.tag_lvl[i].level = LOG_FILTER_LVL_SILENT;
-        } else {
-            g_log.filter.tag_lvl[i].level = level;
-        }
+    return 0;
+}
+
+/* stop reading the snapshots */
+static inline void log_read_leave(uint8_t* scope) {
+    (void)scope;
+
+    if (--reader_depth > 0) return;
+
+    if (likely(reader_self != NULL)) {
+        __atomic_store_n(&reader_self->epoch, 0, __ATOMIC_RELEASE);
     } else {
-        /* only add the new tag's level filer when level is not LOG_FILTER_LVL_ALL */
-        if (level != LOG_FILTER_LVL_ALL) {
-            for (i = 0; i < LOG_FILTER_TAG_LVL_MAX_NUM; i++) {
-                if (g_log.filter.tag_lvl[i].tag_use_flag == false) {
-                    strncpy(g_log.filter.tag_lvl[i].tag, tag, LOG_FILTER_TAG_MAX_LEN);
-                    g_log.filter.tag_lvl[i].level        = level;
-                    g_log.filter.tag_lvl[i].tag_use_flag = true;
-                    break;
-                }
-            }
-        }
+        __atomic_sub_fetch(&readers_anon, 1, __ATOMIC_SEQ_CST);
     }
-    log_port_output_unlock();
 }
 
+/* read the snapshots until the end of the scope */
+#define LOG_READ_SCOPE() \
+    uint8_t log_read_scope __attribute__((cleanup(log_read_leave), unused)) = log_read_enter()
+
 /**
- * get the level on tag's level filer
- *
- * @param tag tag
+ * free the replaced snapshot after the readers which may hold it have left, the retired
+ * snapshots of the earlier calls are freed here too
  *
- * @return It will return the lowest level when tag was not found.
- *         Other level will return when tag was found.
+ * @param ptr snapshot allocated by malloc, it must be unpublished. NULL: only free the earlier
  */
-int log_get_filter_tag_lvl(const char* tag) {
-    LOG_CHECK(tag == NULL, return -1;);
-    uint8_t i     = 0;
-    uint8_t level = LOG_FILTER_LVL_ALL;
-
-    if (!g_log.init_ok) {
-        log_init();
+static void log_retire(void* ptr) {
+    log_retired_t *node, **cur;
+    log_reader_t* reader;
+    uint64_t min = UINT64_MAX, epoch;
+
+    pthread_mutex_lock(&retire_lock);
+    if (ptr) {
+        /* it is leaked rather than freed under a reader when out of memory */
+        if ((node = malloc(sizeof(log_retired_t))) != NULL) {
+            node->ptr   = ptr;
+            node->epoch = retire_epoch;
+            node->next  = retired;
+            retired     = node;
+        }
+        __atomic_store_n(&retire_epoch, retire_epoch + 1, __ATOMIC_SEQ_CST);
     }
-
-    log_port_output_lock();
-    /* find the tag in arr */
-    for (i = 0; i < LOG_FILTER_TAG_LVL_MAX_NUM; i++) {
-        if (g_log.filter.tag_lvl[i].tag_use_flag == true &&
-            !strncmp(tag, g_log.filter.tag_lvl[i].tag, LOG_FILTER_TAG_MAX_LEN)) {
-            level = g_log.filter.tag_lvl[i].level;
-            break;
+    /* the oldest epoch which is still being read */
+    if (__atomic_load_n(&readers_anon, __ATOMIC_SEQ_CST) != 0) {
+        min = 0;
+    }
+    for (reader = readers; reader; reader = reader->next) {
+        epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < min) {
+            min = epoch;
         }
     }
-    log_port_output_unlock();
+    for (cur = &retired; *cur;) {
+        node = *cur;
+        if (node->epoch < min) {
+            *cur = node->next;
+            free(node->ptr);
+            free(node);
+        } else {
+            cur = &node->next;
+        }
+    }
+    pthread_mutex_unlock(&retire_lock);
+}
+
+#ifdef LOG_FMT_FIXED
+/* the format set is a constant, the header packaging branches of other formats are removed */
+static inline __attribute__((always_inline)) size_t log_fmt_set(uint8_t level) {
+    switch (level) {
+    case LOG_LVL_ASSERT:
+        return LOG_FMT_SET_ASSERT;
+    case LOG_LVL_ERROR:
+        return LOG_FMT_SET_ERROR;
+    case LOG_LVL_WARN:
+        return LOG_FMT_SET_WARN;
+    case LOG_LVL_INFO:
+        return LOG_FMT_SET_INFO;
+    case LOG_LVL_DEBUG:
+        return LOG_FMT_SET_DEBUG;
+    default:
+        return LOG_FMT_SET_VERBOSE;
+    }
+}
 
-    return level;
+/* the pre-rendered site headers are never stale */
+static inline uint32_t log_fmt_gen(void) { return 0; }
+#else
+/* format plan writer lock */
+static pthread_mutex_t fmt_lock = PTHREAD_MUTEX_INITIALIZER;
+/* first format plan, it is never freed */
+static log_fmt_plan_t fmt_plan_first;
+
+/* append the op to the segments */
+static log_seg_t* log_seg_add(log_seg_t* seg, uint8_t op, const char* lit) {
+    seg->op  = op;
+    seg->lit = lit;
+    seg->len = lit ? strlen(lit) : 0;
+
+    return seg + 1;
 }
 
 /**
- * output RAW format log
+ * build the header layout of the format set
  *
- * @param format output format
- * @param ... args
+ * @param plan level plan
+ * @param set format set
+ */
+static void log_lvl_plan_build(log_lvl_plan_t* plan, size_t set) {
+    log_seg_t* seg = plan->info;
+
+    plan->set = set;
+    /* [time process thread] */
+    if (set & (LOG_FMT_TIME | LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
+        seg = log_seg_add(seg, LOG_SEG_LIT, "[");
+        if (set & LOG_FMT_TIME) {
+            seg = log_seg_add(seg, LOG_SEG_TIME, NULL);
+            if (set & (LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
+                seg = log_seg_add(seg, LOG_SEG_LIT, " ");
+            }
+        }
+        if (set & LOG_FMT_P_INFO) {
+            seg = log_seg_add(seg, LOG_SEG_P_INFO, NULL);
+            if (set & LOG_FMT_T_INFO) {
+                seg = log_seg_add(seg, LOG_SEG_LIT, " ");
+            }
+        }
+        if (set & LOG_FMT_T_INFO) {
+            seg = log_seg_add(seg, LOG_SEG_T_INFO, NULL);
+        }
+        seg = log_seg_add(seg, LOG_SEG_LIT, "] ");
+    }
+    log_seg_add(seg, LOG_SEG_END, NULL);
+
+    /* (file:line function) */
+    seg = plan->loc;
+    if (set & (LOG_FMT_DIR | LOG_FMT_FUNC | LOG_FMT_LINE)) {
+        seg = log_seg_add(seg, LOG_SEG_LIT, "(");
+        if (set & LOG_FMT_DIR) {
+            seg = log_seg_add(seg, LOG_SEG_DIR, NULL);
+            if (set & LOG_FMT_FUNC) {
+                seg = log_seg_add(seg, LOG_SEG_LIT, ":");
+            } else if (set & LOG_FMT_LINE) {
+                seg = log_seg_add(seg, LOG_SEG_LIT, " ");
+            }
+        }
+        if (set & LOG_FMT_LINE) {
+            seg = log_seg_add(seg, LOG_SEG_LINE, NULL);
+            if (set & LOG_FMT_FUNC) {
+                seg = log_seg_add(seg, LOG_SEG_LIT, " ");
+            }
+        }
+        if (set & LOG_FMT_FUNC) {
+            seg = log_seg_add(seg, LOG_SEG_FUNC, NULL);
+        }
+        seg = log_seg_add(seg, LOG_SEG_LIT, ")");
+    }
+    log_seg_add(seg, LOG_SEG_END, NULL);
+}
+
+/**
+ * build the format plan from the format sets and publish it, the replaced plan is retired
+ *
+ * @param force true: rebuild false: only build when there is no plan
+ *
+ * @return current plan, it is the replaced one when out of memory
+ */
+static log_fmt_plan_t* log_fmt_plan_update(bool force) {
+    log_fmt_plan_t *cur, *plan;
+    uint8_t level;
+
+    pthread_mutex_lock(&fmt_lock);
+    cur  = g_log.fmt_plan;
+    plan = cur == NULL ? &fmt_plan_first : force ? malloc(sizeof(log_fmt_plan_t)) : NULL;
+    if (plan != NULL) {
+        plan->gen = cur ? cur->gen + 1 : 1;
+        for (level = 0; level < LOG_LVL_MAX; level++) {
+            log_lvl_plan_build(&plan->lvl[level], g_log.enabled_fmt_set[level]);
+        }
+        __atomic_store_n(&g_log.fmt_plan, plan, __ATOMIC_RELEASE);
+        if (cur && cur != &fmt_plan_first) {
+            log_retire(cur);
+        }
+        cur = plan;
+    }
+    pthread_mutex_unlock(&fmt_lock);
+
+    return cur;
+}
+
+/* get the format plan, it is built on the first use */
+static inline log_fmt_plan_t* log_fmt_plan(void) {
+    log_fmt_plan_t* plan = __atomic_load_n(&g_log.fmt_plan, __ATOMIC_ACQUIRE);
+
+    return likely(plan != NULL) ? plan : log_fmt_plan_update(false);
+}
+
+static inline size_t log_fmt_set(uint8_t level) { return log_fmt_plan()->lvl[level].set; }
+
+static inline uint32_t log_fmt_gen(void) { return log_fmt_plan()->gen; }
+#endif
+
+/**
+ * another copy string function
+ *
+ * @param cur_len current copied log length, max size is LOG_LINE_BUF_SIZE
+ * @param dst destination
+ * @param src source
+ *
+ * @return copied length
+ */
+static size_t log_strcpy(size_t cur_len, char* dst, const char* src) {
+    size_t len;
+
+    if (!dst || !src || cur_len >= LOG_LINE_BUF_SIZE) return 0;
+
+    /* make sure destination has enough space */
+    len = strnlen(src, LOG_LINE_BUF_SIZE - cur_len);
+    memcpy(dst, src, len);
+
+    return len;
+}
+
+/**
+ * copy string function for the string which length is known, such as static and cached strings
+ *
+ * @param cur_len current copied log length, max size is LOG_LINE_BUF_SIZE
+ * @param dst destination
+ * @param src source
+ * @param len source length
+ *
+ * @return copied length
+ */
+static size_t log_strncpy(size_t cur_len, char* dst, const char* src, size_t len) {
+    if (cur_len >= LOG_LINE_BUF_SIZE) return 0;
+
+    /* make sure destination has enough space */
+    if (len > LOG_LINE_BUF_SIZE - cur_len) {
+        len = LOG_LINE_BUF_SIZE - cur_len;
+    }
+    memcpy(dst, src, len);
+
+    return len;
+}
+
+/* monotonic milliseconds for file flush interval */
+static uint64_t log_file_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the mapped segments, they are used in turn and never freed for the writers which still
+ * hold the old one */
+static log_mmap_seg_t mmap_segs[2];
+static uint8_t mmap_seg_idx;
+
+/* next local hour or midnight for the rotation by time, 0: none */
+static time_t log_file_next_rotate_time(void) {
+    time_t now = time(NULL);
+    struct tm tm;
+
+    if (g_log.rotate_policy == LOG_FILE_ROTATE_SIZE) return 0;
+
+    localtime_r(&now, &tm);
+    tm.tm_min = tm.tm_sec = 0;
+    if (g_log.rotate_policy == LOG_FILE_ROTATE_HOURLY) {
+        tm.tm_hour++;
+    } else {
+        tm.tm_hour = 0;
+        tm.tm_mday++;
+    }
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+/* the rotation by time is due, it is checked without file lock */
+static bool log_file_rotate_time_due(void) {
+    time_t rotate_time = __atomic_load_n(&g_log.rotate_time, __ATOMIC_RELAXED);
+
+    return rotate_time != 0 && time(NULL) >= rotate_time;
+}
+
+/* report the file error on stderr, the logs which can't be written to the file are not lost
+ * silently */
+static void log_file_error(const char* what, int err) {
+    fprintf(stderr, "log: %s %s failed: %s\n", what, g_log.name, strerror(err));
+}
+
+/**
+ * preallocate max_size of the file and map it, file lock must be held. The file is written by
+ * stdio when it can't be mapped.
+ *
+ * @param size current file size, the new logs are appended after its data
+ *
+ * @return true: mapped false: full or failed
+ */
+static bool log_file_mmap(size_t size) {
+    log_mmap_seg_t* seg = &mmap_segs[mmap_seg_idx ^ 1];
+    int fd              = fileno(g_log.fp);
+    char* base;
+    int err;
+
+    /* full, it will be rotated by the stdio writer. The file of a crashed process is preallocated
+     * with max_size, it is mapped to find its data end */
+    if (size > g_log.max_size) return false;
+
+    if ((err = posix_fallocate(fd, 0, g_log.max_size)) != 0) {
+        log_file_error("fallocate", err);
+        goto __truncate;
+    }
+    base = mmap(NULL, g_log.max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        log_file_error("mmap", errno);
+        goto __truncate;
+    }
+    /* the file left by a crashed process ends with the preallocated zeros */
+    while (size > 0 && base[size - 1] == '\0') {
+        size--;
+    }
+    if (size == g_log.max_size) {
+        munmap(base, g_log.max_size);
+        return false;
+    }
+    seg->base    = base;
+    seg->size    = g_log.max_size;
+    seg->end     = g_log.max_size;
+    seg->cursor  = size;
+    mmap_seg_idx ^= 1;
+    __atomic_store_n(&g_log.mmap_seg, seg, __ATOMIC_SEQ_CST);
+
+    return true;
+
+__truncate:
+    /* the failed fallocate may have extended the file */
+    if (ftruncate(fd, size) < 0) {
+        log_file_error("truncate", errno);
+    }
+    return false;
+}
+
+/**
+ * stop writing the current segment and wait for all writers have left, file lock must be held
+ *
+ * @return the segment, NULL: not mapped
+ */
+static log_mmap_seg_t* log_file_mmap_detach(void) {
+    log_mmap_seg_t* seg = g_log.mmap_seg;
+
+    if (seg == NULL) return NULL;
+
+    __atomic_store_n(&g_log.mmap_seg, NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&seg->users, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+
+    return seg;
+}
+
+/* unmap the detached segment and cut the preallocated tail of its file */
+static void log_file_mmap_release(log_mmap_seg_t* seg, FILE* fp) {
+    size_t used;
+
+    if (seg == NULL) return;
+
+    used = seg->cursor < seg->end ? seg->cursor : seg->end;
+    munmap(seg->base, seg->size);
+    /* the data is followed by the preallocated zeros when it fails */
+    if (ftruncate(fileno(fp), used) < 0) {
+        log_file_error("truncate", errno);
+    }
+    if (fp == g_log.fp) {
+        g_log.file_size = used;
+    }
+}
+
+/* open the log file with the user-space buffer and load its current size */
+static void log_file_open(void) {
+    g_log.fp = fopen(g_log.name, "a+");
+    if (g_log.fp == NULL) {
+        log_file_error("open", errno);
+        return;
+    }
+
+    if (g_log.file_buf) {
+        setvbuf(g_log.fp, g_log.file_buf, _IOFBF, g_log.file_buf_size);
+    }
+
+    fseek(g_log.fp, 0L, SEEK_END);
+    g_log.file_size       = ftell(g_log.fp);
+    g_log.file_flush_time = log_file_now_ms();
+    __atomic_store_n(&g_log.rotate_time, log_file_next_rotate_time(), __ATOMIC_RELAXED);
+
+    if (g_log.file_mmap) {
+        log_file_mmap(g_log.file_size);
+    }
+}
+
+/* close the log file */
+static void log_file_close(void) {
+    log_file_mmap_release(log_file_mmap_detach(), g_log.fp);
+    fclose(g_log.fp);
+    g_log.fp = NULL;
+}
+
+/**
+ * flush the file buffer to disk when the flush policy is met, file lock must be held
+ *
+ * @param level level of the written log
+ * @param force flush regardless of the flush policy
+ */
+static void log_file_flush_policy(uint8_t level, bool force) {
+    uint64_t now = log_file_now_ms();
+
+    if (force || g_log.file_buf_size == 0 || level <= g_log.file_flush_lvl ||
+        now - g_log.file_flush_time >= g_log.file_flush_ms) {
+        fflush(g_log.fp);
+        g_log.file_flush_time = now;
+    }
+}
+
+static int log_file_init(void) {
+    log_file_port_init();
+
+    log_file_port_lock();
+
+    if (g_log.file_buf_size > 0 && g_log.file_buf == NULL && !g_log.file_mmap) {
+        g_log.file_buf = malloc(g_log.file_buf_size);
+    }
+    log_file_rotate_recover();
+    log_file_open();
+    /* the mapped file can't be appended when it is already full */
+    if (g_log.file_mmap && g_log.fp && g_log.mmap_seg == NULL &&
+        g_log.file_size >= g_log.max_size && g_log.max_rotate > 0) {
+        log_file_rotate();
+    }
+
+    log_file_port_unlock();
+
+    log_file_flusher_start();
+    return 0;
+}
+
+/* rotated file which is handed off to the rotate thread */
+typedef struct log_rotate_job {
+    struct log_rotate_job* next;
+    FILE* fp; /* rotated mapped file, NULL: already closed */
+    /* the detached segment of the mapped file, it is copied as the segments are reused when the
+     * next files are mapped before this one is released */
+    log_mmap_seg_t seg;
+    uint64_t id;      /* the file is xxx.log.rotating.id until it is renamed to xxx.log.0 */
+    uint64_t renamed; /* renamed count when the file became xxx.log.0 */
+    int max_rotate;
+    uint8_t compress;
+    size_t retention;
+} log_rotate_job_t;
+
+/*
+ * rotations waiting for the renames, they are renamed in the rotation order. The renamed files are
+ * queued again to the compress thread for the compression and retention, so the renames never wait
+ * for the compression tool.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          /* the rename queue changed */
+    pthread_cond_t compress_cond; /* the compress queue changed */
+    pthread_mutex_t files_lock;   /* the rotate files are renamed or replaced */
+    bool started;
+    bool compress_started;
+    log_rotate_job_t* head; /* renaming or next to rename */
+    log_rotate_job_t* tail;
+    log_rotate_job_t* compress_head; /* compressing or next to compress */
+    log_rotate_job_t* compress_tail;
+    uint64_t next_id; /* id of the next rotating file */
+    uint64_t renamed; /* rotations renamed to xxx.log.0, files lock must be held */
+} g_rotate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+              PTHREAD_MUTEX_INITIALIZER};
+
+/* compressed file suffix and the tool command, the tool compresses stdin to stdout */
+static const char* compress_suffix[] = {
+    [LOG_FILE_COMPRESS_NONE] = "",
+    [LOG_FILE_COMPRESS_GZIP] = ".gz",
+    [LOG_FILE_COMPRESS_ZSTD] = ".zst",
+};
+static const char* const compress_argv[][4] = {
+    [LOG_FILE_COMPRESS_NONE] = {NULL},
+    [LOG_FILE_COMPRESS_GZIP] = {"gzip", "-c", "-q", NULL},
+    [LOG_FILE_COMPRESS_ZSTD] = {"zstd", "-c", "-q", NULL},
+};
+
+extern char** environ;
+
+/**
+ * get the rotate file path
+ *
+ * @param path path buffer
+ * @param size path buffer size
+ * @param n rotate file number, xxx.log.n
+ */
+static void log_file_path(char* path, size_t size, int n) {
+    snprintf(path, size, "%s.%d", g_log.name, n);
+}
+
+/* get the path of the file being rotated, xxx.log.rotating.id */
+static void log_file_rotating_path(char* path, size_t size, uint64_t id) {
+    snprintf(path, size, "%s.rotating.%" PRIu64, g_log.name, id);
+}
+
+/* get the path of the file being compressed, xxx.log.compressing.gz */
+static void log_file_compressing_path(char* path, size_t size, uint8_t compress) {
+    snprintf(path, size, "%s.compressing%s", g_log.name, compress_suffix[compress]);
+}
+
+/* rename the rotate file and its compressed files */
+static void log_file_rename(int old_n, int new_n) {
+    char oldpath[256], newpath[256];
+    size_t old_len, new_len;
+    uint8_t i;
+
+    log_file_path(oldpath, sizeof(oldpath) - 8, old_n);
+    log_file_path(newpath, sizeof(newpath) - 8, new_n);
+    old_len = strlen(oldpath);
+    new_len = strlen(newpath);
+    for (i = 0; i < LOG_FILE_COMPRESS_MAX; i++) {
+        strcpy(oldpath + old_len, compress_suffix[i]);
+        strcpy(newpath + new_len, compress_suffix[i]);
+        rename(oldpath, newpath);
+    }
+}
+
+/* remove the rotate file and its compressed files, return their size */
+static size_t log_file_remove(int n, bool remove_it) {
+    char path[256];
+    struct stat st;
+    size_t len, size = 0;
+    uint8_t i;
+
+    log_file_path(path, sizeof(path) - 8, n);
+    len = strlen(path);
+    for (i = 0; i < LOG_FILE_COMPRESS_MAX; i++) {
+        strcpy(path + len, compress_suffix[i]);
+        if (stat(path, &st) == 0) {
+            size += st.st_size;
+            if (remove_it) remove(path);
+        }
+    }
+
+    return size;
+}
+
+/* get the number of the job's rotated file which the later renames moved, files lock must be
+ * held. -1: removed as the oldest file */
+static int log_file_job_n(const log_rotate_job_t* job) {
+    uint64_t n = g_rotate.renamed - job->renamed;
+
+    return n < (uint64_t)job->max_rotate ? (int)n : -1;
+}
+
+/*
+ * compress the rotated file of the job by the external tool. The tool reads the opened file, so
+ * the renames of the next rotations go on meanwhile, and the compressed file replaces the rotated
+ * one wherever it has been renamed to.
+ */
+static void log_file_compress(const log_rotate_job_t* job) {
+    posix_spawn_file_actions_t actions;
+    char path[256], tmp[256];
+    int n, in = -1, out, status = -1;
+    size_t len;
+    pid_t pid;
+
+    if (job->compress == LOG_FILE_COMPRESS_NONE) return;
+
+    pthread_mutex_lock(&g_rotate.files_lock);
+    if ((n = log_file_job_n(job)) >= 0) {
+        log_file_path(path, sizeof(path), n);
+        in = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    pthread_mutex_unlock(&g_rotate.files_lock);
+    if (in < 0) return;
+
+    log_file_compressing_path(tmp, sizeof(tmp), job->compress);
+    if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        close(in);
+        return;
+    }
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    if (posix_spawnp(&pid, compress_argv[job->compress][0], &actions, NULL,
+                     (char* const*)compress_argv[job->compress], environ) == 0) {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(in);
+    close(out);
+
+    pthread_mutex_lock(&g_rotate.files_lock);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && (n = log_file_job_n(job)) >= 0) {
+        log_file_path(path, sizeof(path) - 8, n);
+        len = strlen(path);
+        strcpy(path + len, compress_suffix[job->compress]);
+        if (rename(tmp, path) == 0) {
+            path[len] = '\0';
+            unlink(path);
+        }
+    }
+    unlink(tmp);
+    pthread_mutex_unlock(&g_rotate.files_lock);
+}
+
+/* keep the newest rotated files which total size is in the retention, remove the others */
+static void log_file_retain(int max_rotate, size_t retention) {
+    size_t total = 0;
+    int n;
+
+    if (retention == 0) return;
+
+    for (n = 0; n < max_rotate; n++) {
+        total += log_file_remove(n, false);
+        if (total > retention) {
+            log_file_remove(n, true);
+        }
+    }
+}
+
+/*
+ * close the rotated mapped file and rename xxx.log.n-1 => xxx.log.n, and xxx.log.rotating.id =>
+ * xxx.log.0, the compressed files are renamed with their suffix. rename replaces the existing
+ * file, and the missing files are skipped by its error.
+ */
+static void log_file_rotate_files(log_rotate_job_t* job) {
+    char path[256], rotated[256];
+    int n;
+
+    if (job->fp) {
+        log_file_mmap_release(&job->seg, job->fp);
+        fclose(job->fp);
+    }
+
+    pthread_mutex_lock(&g_rotate.files_lock);
+    /* the oldest file in another format is not replaced by rename */
+    log_file_remove(job->max_rotate - 1, true);
+    for (n = job->max_rotate - 1; n > 0; --n) {
+        log_file_rename(n - 1, n);
+    }
+    log_file_rotating_path(path, sizeof(path), job->id);
+    log_file_path(rotated, sizeof(rotated), 0);
+    rename(path, rotated);
+    job->renamed = ++g_rotate.renamed;
+    pthread_mutex_unlock(&g_rotate.files_lock);
+}
+
+/* compress the rotated file of the job and remove the files over the retention */
+static void log_file_compress_retain(const log_rotate_job_t* job) {
+    log_file_compress(job);
+
+    if (job->retention) {
+        pthread_mutex_lock(&g_rotate.files_lock);
+        log_file_retain(job->max_rotate, job->retention);
+        pthread_mutex_unlock(&g_rotate.files_lock);
+    }
+}
+
+/* append the job to the queue, rotate lock must be held */
+static void log_rotate_push(log_rotate_job_t** head, log_rotate_job_t** tail,
+                            log_rotate_job_t* job) {
+    job->next = NULL;
+    if (*tail) {
+        (*tail)->next = job;
+    } else {
+        *head = job;
+    }
+    *tail = job;
+}
+
+/* remove the first job of the queue, rotate lock must be held */
+static void log_rotate_pop(log_rotate_job_t** head, log_rotate_job_t** tail) {
+    if ((*head = (*head)->next) == NULL) {
+        *tail = NULL;
+    }
+}
+
+/* the compress thread runs in the lowest priority, it compresses the renamed files in order */
+static void* log_compress_thread(void* arg) {
+    log_rotate_job_t* job;
+    (void)arg;
+
+#ifdef linux
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    pthread_mutex_lock(&g_rotate.lock);
+    for (;;) {
+        while (g_rotate.compress_head == NULL) {
+            pthread_cond_wait(&g_rotate.compress_cond, &g_rotate.lock);
+        }
+        job = g_rotate.compress_head;
+        pthread_mutex_unlock(&g_rotate.lock);
+
+        log_file_compress_retain(job);
+
+        pthread_mutex_lock(&g_rotate.lock);
+        log_rotate_pop(&g_rotate.compress_head, &g_rotate.compress_tail);
+        pthread_cond_broadcast(&g_rotate.compress_cond);
+        free(job);
+    }
+
+    return NULL;
+}
+
+/**
+ * hand the renamed file off to the compress thread, rotate lock must be held
+ *
+ * @param job renamed rotation
+ *
+ * @return the job which must be compressed in place without the thread, NULL: none
+ */
+static log_rotate_job_t* log_compress_submit(log_rotate_job_t* job) {
+    pthread_t thread;
+
+    if (job->compress == LOG_FILE_COMPRESS_NONE && job->retention == 0) {
+        free(job);
+        return NULL;
+    }
+
+    if (!g_rotate.compress_started &&
+        pthread_create(&thread, NULL, log_compress_thread, NULL) == 0) {
+        pthread_detach(thread);
+        g_rotate.compress_started = true;
+    }
+    if (!g_rotate.compress_started) {
+        return job;
+    }
+    log_rotate_push(&g_rotate.compress_head, &g_rotate.compress_tail, job);
+    pthread_cond_signal(&g_rotate.compress_cond);
+
+    return NULL;
+}
+
+/*
+ * the rotate thread runs in the lowest priority. The queued rotations are renamed one by one, the
+ * compression and retention are handed off to the compress thread, so the next renames don't wait
+ * for the compression tool.
+ */
+static void* log_rotate_thread(void* arg) {
+    log_rotate_job_t* job;
+    (void)arg;
+
+#ifdef linux
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    pthread_mutex_lock(&g_rotate.lock);
+    for (;;) {
+        while (g_rotate.head == NULL) {
+            pthread_cond_wait(&g_rotate.cond, &g_rotate.lock);
+        }
+        job = g_rotate.head;
+        pthread_mutex_unlock(&g_rotate.lock);
+
+        log_file_rotate_files(job);
+
+        /* the renamed job is queued at once, so it is waited by log_compress_wait */
+        pthread_mutex_lock(&g_rotate.lock);
+        log_rotate_pop(&g_rotate.head, &g_rotate.tail);
+        job = log_compress_submit(job);
+        pthread_cond_broadcast(&g_rotate.cond);
+        pthread_mutex_unlock(&g_rotate.lock);
+
+        if (job) {
+            log_file_compress_retain(job);
+            free(job);
+        }
+
+        pthread_mutex_lock(&g_rotate.lock);
+    }
+
+    return NULL;
+}
+
+/* wait for the rotate thread renamed the queued rotations, the compression is not waited */
+static void log_rotate_wait(void) {
+    pthread_mutex_lock(&g_rotate.lock);
+    while (g_rotate.head) {
+        pthread_cond_wait(&g_rotate.cond, &g_rotate.lock);
+    }
+    pthread_mutex_unlock(&g_rotate.lock);
+}
+
+/* wait for the compress thread finished the renamed rotations */
+static void log_compress_wait(void) {
+    pthread_mutex_lock(&g_rotate.lock);
+    while (g_rotate.compress_head) {
+        pthread_cond_wait(&g_rotate.compress_cond, &g_rotate.lock);
+    }
+    pthread_mutex_unlock(&g_rotate.lock);
+}
+
+/* queue the rotated file to the rotate thread, or rename it in place without the thread.
+ * Rotate lock must be held. */
+static void log_rotate_submit(log_rotate_job_t* job) {
+    pthread_t thread;
+
+    job->max_rotate = g_log.max_rotate;
+    job->compress   = g_log.compress;
+    job->retention  = g_log.retention;
+    if (!g_rotate.started && pthread_create(&thread, NULL, log_rotate_thread, NULL) == 0) {
+        pthread_detach(thread);
+        g_rotate.started = true;
+    }
+    if (g_rotate.started) {
+        log_rotate_push(&g_rotate.head, &g_rotate.tail, job);
+        pthread_cond_signal(&g_rotate.cond);
+    } else {
+        /* no rotate thread, rename and compress in place */
+        log_file_rotate_files(job);
+        log_file_compress_retain(job);
+        free(job);
+    }
+}
+
+/* check whether the rotating file is queued, rotate lock must be held */
+static bool log_rotate_queued(uint64_t id) {
+    log_rotate_job_t* job;
+
+    for (job = g_rotate.head; job; job = job->next) {
+        if (job->id == id) return true;
+    }
+
+    return false;
+}
+
+static int log_rotate_id_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * resume the rotations which a crash interrupted, file lock must be held. The xxx.log.rotating.id
+ * files left behind are queued in the id order as the rotated files, and the ids of the new
+ * rotations follow them. The half compressed file is removed, its rotated file is kept.
+ */
+static void log_file_rotate_recover(void) {
+    const char *slash, *base;
+    char dir[256], *end;
+    size_t base_len, num = 0, cap = 0, i;
+    uint64_t *ids = NULL, *tmp, id;
+    log_rotate_job_t* job;
+    struct dirent* entry;
+    DIR* dp;
+
+    if (g_log.max_rotate <= 0) return;
+
+    if ((slash = strrchr(g_log.name, '/')) != NULL) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - g_log.name + 1), g_log.name);
+        base = slash + 1;
+    } else {
+        strcpy(dir, ".");
+        base = g_log.name;
+    }
+    if ((dp = opendir(dir)) == NULL) return;
+    base_len = strlen(base);
+    while ((entry = readdir(dp)) != NULL) {
+        if (strncmp(entry->d_name, base, base_len) ||
+            strncmp(entry->d_name + base_len, ".rotating.", 10) ||
+            !isdigit((unsigned char)entry->d_name[base_len + 10])) {
+            continue;
+        }
+        id = strtoull(entry->d_name + base_len + 10, &end, 10);
+        if (*end != '\0') continue;
+        if (num == cap) {
+            cap = cap ? cap * 2 : 8;
+            if ((tmp = realloc(ids, cap * sizeof(*ids))) == NULL) break;
+            ids = tmp;
+        }
+        ids[num++] = id;
+    }
+    closedir(dp);
+    qsort(ids, num, sizeof(*ids), log_rotate_id_cmp);
+
+    pthread_mutex_lock(&g_rotate.lock);
+    for (i = 1; i < LOG_FILE_COMPRESS_MAX && g_rotate.compress_head == NULL; i++) {
+        log_file_compressing_path(dir, sizeof(dir), i);
+        unlink(dir);
+    }
+    for (i = 0; i < num; i++) {
+        if (ids[i] >= g_rotate.next_id) {
+            g_rotate.next_id = ids[i] + 1;
+        }
+        /* the file of a rotation in progress is renamed by the rotate thread */
+        if (log_rotate_queued(ids[i]) || (job = calloc(1, sizeof(*job))) == NULL) continue;
+        job->id = ids[i];
+        log_rotate_submit(job);
+    }
+    pthread_mutex_unlock(&g_rotate.lock);
+    free(ids);
+}
+
+/*
+ * rotate the log file, file lock must be held. The file is renamed to xxx.log.rotating.id and a
+ * new xxx.log is opened at once. The rotated file is queued to the rotate thread which renames it
+ * to xxx.log.0, also unmaps and closes it in mmap mode, so the writers never wait for the renames
+ * of the rotate files, even when the last rotation is still being renamed.
+ */
+static bool log_file_rotate(void) {
+    uint64_t start = log_stats_now();
+    log_rotate_job_t* job;
+    log_mmap_seg_t* seg;
+    char path[256];
+
+    /* don't retry on every log when failed */
+    __atomic_store_n(&g_log.rotate_time, log_file_next_rotate_time(), __ATOMIC_RELAXED);
+
+    if ((job = calloc(1, sizeof(*job))) == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&g_rotate.lock);
+    job->id = g_rotate.next_id++;
+    pthread_mutex_unlock(&g_rotate.lock);
+
+    log_file_rotating_path(path, sizeof(path), job->id);
+    if (rename(g_log.name, path) < 0) {
+        free(job);
+        return false;
+    }
+
+    if ((seg = log_file_mmap_detach()) != NULL) {
+        job->seg = *seg;
+        job->fp  = g_log.fp;
+    } else {
+        /* the user-space buffer will be used by the new file, flush and close it here */
+        fclose(g_log.fp);
+    }
+    pthread_mutex_lock(&g_rotate.lock);
+    log_rotate_submit(job);
+    pthread_mutex_unlock(&g_rotate.lock);
+
+    /* open the new file */
+    log_file_open();
+    log_stats_rotate(start);
+
+    return g_log.fp != NULL;
+}
+
+/* rotate the file when the rotation by time is due, file lock must be held. The empty file is
+ * not rotated. */
+static void log_file_rotate_by_time(void) {
+    size_t size;
+
+    if (g_log.fp == NULL || !log_file_rotate_time_due()) return;
+
+    if (g_log.mmap_seg) {
+        size = __atomic_load_n(&g_log.mmap_seg->cursor, __ATOMIC_RELAXED);
+    } else {
+        size = g_log.file_size;
+    }
+    if (size == 0 || g_log.max_rotate <= 0) {
+        __atomic_store_n(&g_log.rotate_time, log_file_next_rotate_time(), __ATOMIC_RELAXED);
+    } else {
+        log_file_rotate();
+    }
+}
+
+/**
+ * copy the log to the mapped segment, the space is reserved by the cursor without file lock.
+ * The file is rotated when the segment is full.
+ *
+ * @param log log buffer
+ * @param size log size
+ *
+ * @return true: written or dropped false: the file isn't mapped, it is written by stdio
+ */
+static bool log_file_mmap_write(const char* log, size_t size) {
+    log_mmap_seg_t* seg;
+    size_t pos;
+
+    if (unlikely(log_file_rotate_time_due())) {
+        log_file_port_lock();
+        log_file_rotate_by_time();
+        log_file_port_unlock();
+    }
+
+    for (;;) {
+        if ((seg = __atomic_load_n(&g_log.mmap_seg, __ATOMIC_SEQ_CST)) == NULL) return false;
+        /* enter the segment, recheck it after the unmapping thread can see this writer */
+        __atomic_add_fetch(&seg->users, 1, __ATOMIC_SEQ_CST);
+        if (seg != __atomic_load_n(&g_log.mmap_seg, __ATOMIC_SEQ_CST)) {
+            __atomic_sub_fetch(&seg->users, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (unlikely(size > seg->size)) {
+            __atomic_sub_fetch(&seg->users, 1, __ATOMIC_SEQ_CST);
+            return true;
+        }
+        pos = __atomic_fetch_add(&seg->cursor, size, __ATOMIC_RELAXED);
+        if (likely(pos + size <= seg->size)) {
+            memcpy(seg->base + pos, log, size);
+            __atomic_sub_fetch(&seg->users, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        /* only the first line which doesn't fit starts before the segment end */
+        if (pos < seg->size) {
+            seg->end = pos;
+        }
+        __atomic_sub_fetch(&seg->users, 1, __ATOMIC_RELEASE);
+
+        /* segment full, rotate to the next file if no other writer has done it */
+        log_file_port_lock();
+        if (seg == g_log.mmap_seg && (g_log.max_rotate <= 0 || !log_file_rotate())) {
+            /* can't rotate, unmap it and the stdio writer retries the rotation or stops by the
+             * max size as the stdio file */
+            log_file_mmap_release(log_file_mmap_detach(), g_log.fp);
+        }
+        log_file_port_unlock();
+    }
+}
+
+/**
+ * write the log to the file buffer, the buffer is flushed by the flush policy
+ *
+ * @param level level of the log
+ * @param log log buffer
+ * @param size log size
+ */
+static void log_file_write(uint8_t level, const char* log, size_t size) {
+    LOG_CHECK(log == NULL, return;);
+
+__retry:
+    if (g_log.file_mmap && log_file_mmap_write(log, size)) return;
+
+    log_file_port_lock();
+
+    if (unlikely(log_file_rotate_time_due())) {
+        log_file_rotate_by_time();
+    }
+
+    if (g_log.fp == NULL) goto __exit;
+
+    if (unlikely(g_log.file_size > g_log.max_size)) {
+        if (g_log.max_rotate <= 0 || !log_file_rotate()) {
+            goto __exit;
+        }
+    }
+    /* the rotated file has been mapped, the stdio write would append after the preallocation */
+    if (unlikely(g_log.mmap_seg != NULL)) {
+        log_file_port_unlock();
+        goto __retry;
+    }
+
+    fwrite(log, size, 1, g_log.fp);
+    g_log.file_size += size;
+
+    log_file_flush_policy(level, false);
+
+__exit:
+    log_file_port_unlock();
+}
+
+/**
+ * flush the file buffer
+ *
+ * @param force true: flush now false: only flush when the flush interval is reached
+ */
+static void log_file_flush(bool force) {
+    log_file_port_lock();
+
+    if (g_log.fp) {
+        log_file_flush_policy(LOG_LVL_RAW, force);
+    }
+    if (g_log.bin_fp && force) {
+        fflush(g_log.bin_fp);
+    }
+
+    log_file_port_unlock();
+}
+
+/* file flush thread, it flushes the buffered logs when no more log is written */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+} g_flusher = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/* flush the file buffer every flush interval until it is stopped */
+static void* log_file_flush_thread(void* arg) {
+    struct timespec ts;
+    (void)arg;
+
+    pthread_mutex_lock(&g_flusher.lock);
+    while (g_flusher.running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += g_log.file_flush_ms / 1000;
+        ts.tv_nsec += (long)(g_log.file_flush_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&g_flusher.cond, &g_flusher.lock, &ts);
+        if (!g_flusher.running) break;
+
+        pthread_mutex_unlock(&g_flusher.lock);
+        log_file_flush(false);
+        pthread_mutex_lock(&g_flusher.lock);
+    }
+    pthread_mutex_unlock(&g_flusher.lock);
+
+    return NULL;
+}
+
+/* start the flush thread for the buffered file, so the logs stay in the buffer no longer than
+ * about twice the flush interval even when the writes stop */
+static void log_file_flusher_start(void) {
+    if (g_log.file_buf_size == 0 || g_log.file_flush_ms == 0) return;
+
+    pthread_mutex_lock(&g_flusher.lock);
+    if (!g_flusher.running) {
+        g_flusher.running =
+            pthread_create(&g_flusher.thread, NULL, log_file_flush_thread, NULL) == 0;
+    }
+    pthread_mutex_unlock(&g_flusher.lock);
+}
+
+/* stop the flush thread, the file is flushed when it is closed */
+static void log_file_flusher_stop(void) {
+    bool running;
+
+    pthread_mutex_lock(&g_flusher.lock);
+    running           = g_flusher.running;
+    g_flusher.running = false;
+    pthread_cond_signal(&g_flusher.cond);
+    pthread_mutex_unlock(&g_flusher.lock);
+
+    if (running) {
+        pthread_join(g_flusher.thread, NULL);
+    }
+}
+
+static void log_file_deinit(void) {
+    log_file_flusher_stop();
+
+    log_file_port_lock();
+
+    if (g_log.fp) {
+        log_file_close();
+    }
+
+    log_file_port_unlock();
+
+    log_rotate_wait();
+    log_compress_wait();
+
+    log_file_port_deinit();
+}
+
+/* async output ring slot */
+typedef struct {
+    size_t seq;   /* slot sequence: pos when free, pos + 1 when filled */
+    uint8_t kind; /* LOG_ASYNC_TEXT or LOG_ASYNC_BIN */
+    log_line_t line;
+    size_t len;
+    log_chunk_t* ext; /* chunk of the line longer than buf */
+    char buf[LOG_LINE_BUF_SIZE];
+} log_async_slot_t;
+
+/*
+ * async output ring, a bounded multi-producer queue drained by its output thread. The global one
+ * writes all sinks, a sink with own queue has one more.
+ */
+typedef struct log_async {
+    log_async_slot_t* slots;
+    size_t mask;
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    size_t users __attribute__((aligned(64))); /* producers which have seen async enabled */
+    size_t drop_newest;                         /* dropped by LOG_ASYNC_OVERFLOW_DROP_NEWEST */
+    size_t drop_oldest;                         /* dropped by LOG_ASYNC_OVERFLOW_DROP_OLDEST */
+    size_t blocked; /* producers sleeping on the full ring by LOG_ASYNC_OVERFLOW_BLOCK */
+    size_t lock_waiters; /* threads waiting for the lock, the output thread gives it up for them */
+    bool running;
+    bool waiting; /* output thread is sleeping */
+    pthread_t thread;
+    /* held by output thread while writing, released while sleeping or between the drains when
+     * lock_waiters is counted, take it by log_async_lock */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_mutex_t space_lock; /* the blocked producers sleep with it, not held while writing */
+    pthread_cond_t space;       /* a slot is freed */
+    void (*drain)(struct log_async* q); /* write the queued lines, called with the lock held */
+    void* owner;                        /* sink of the own queue */
+} log_async_t;
+
+static void log_async_drain(log_async_t* q);
+
+static log_async_t g_async = {
+    .lock       = PTHREAD_MUTEX_INITIALIZER,
+    .wake       = PTHREAD_COND_INITIALIZER,
+    .done       = PTHREAD_COND_INITIALIZER,
+    .space_lock = PTHREAD_MUTEX_INITIALIZER,
+    .space      = PTHREAD_COND_INITIALIZER,
+    .drain      = log_async_drain,
+};
+
+/* sinks, the console and file are always registered */
+static log_sink_entry_t g_sinks[LOG_SINK_MAX_NUM] = {
+    [LOG_SINK_CONSOLE] = {.cfg = {.level = LOG_LVL_VERBOSE, .fmt = LOG_SINK_FMT_ALL}},
+    [LOG_SINK_FILE]    = {.cfg = {.level = LOG_LVL_VERBOSE,
+                                  .fmt   = LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR}},
+};
+/* registered sinks mask, the dispatchers read it without lock */
+static uint32_t sink_active = (1u << LOG_SINK_CONSOLE) | (1u << LOG_SINK_FILE);
+/* sinks written by the producer before the async queue, so the last lines survive a crash */
+static uint32_t sink_direct;
+/* producers which are writing the direct sinks */
+static size_t sink_direct_users;
+/* sink registry writer lock */
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+/* buffer of the line without the parts removed by the sink format */
+static __thread char sink_buf[LOG_LINE_BUF_SIZE];
+
+/* sink format which outputs the line part, 0: always output */
+static const uint8_t part_sink_fmt[LOG_PART_MAX] = {
+    [LOG_PART_COLOR] = LOG_SINK_FMT_COLOR, [LOG_PART_LVL] = LOG_SINK_FMT_LVL,
+    [LOG_PART_TAG] = LOG_SINK_FMT_TAG,     [LOG_PART_INFO] = LOG_SINK_FMT_INFO,
+    [LOG_PART_LOC] = LOG_SINK_FMT_LOC,     [LOG_PART_CSI_END] = LOG_SINK_FMT_COLOR,
+};
+
+/**
+ * find the sinks whose level and tag filter accept the log
+ *
+ * @param level level, LOG_LVL_RAW passes every level filter
+ * @param tag tag, NULL: only passes the sinks without tag filter
+ *
+ * @return sinks mask
+ */
+static uint32_t log_sink_match(uint8_t level, const char* tag) {
+    uint32_t active = __atomic_load_n(&sink_active, __ATOMIC_ACQUIRE), sinks = 0;
+    log_sink_entry_t* sink;
+    const char* sink_tag;
+    uint8_t sink_level;
+
+    while (active) {
+        sink       = &g_sinks[__builtin_ctz(active)];
+        sink_level = __atomic_load_n(&sink->cfg.level, __ATOMIC_RELAXED);
+        sink_tag   = __atomic_load_n(&sink->tag, __ATOMIC_ACQUIRE);
+        if ((level == LOG_LVL_RAW || level <= sink_level) &&
+            (sink_tag == NULL || (tag && strstr(tag, sink_tag)))) {
+            sinks |= active & -active;
+        }
+        active &= active - 1;
+    }
+
+    return sinks;
+}
+
+/**
+ * select the line parts which the sink format outputs
+ *
+ * @param line line info
+ * @param log log buffer
+ * @param size log size
+ * @param fmt sink format
+ * @param iov output segments, LOG_PART_MAX at most
+ *
+ * @return segment count
+ */
+static int log_line_iov(const log_line_t* line, const char* log, size_t size, uint8_t fmt,
+                        struct iovec* iov) {
+    size_t start = 0, end;
+    int i, cnt = 0;
+
+    if ((fmt & LOG_SINK_FMT_ALL) == LOG_SINK_FMT_ALL) {
+        iov[0].iov_base = (void*)log;
+        iov[0].iov_len  = size;
+        return 1;
+    }
+    for (i = 0; i < LOG_PART_MAX; i++) {
+        end = line->part[i];
+        if (end <= start) continue;
+        if (part_sink_fmt[i] == 0 || (fmt & part_sink_fmt[i])) {
+            /* merge the adjacent parts */
+            if (cnt > 0 && (char*)iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == log + start) {
+                iov[cnt - 1].iov_len += end - start;
+            } else {
+                iov[cnt].iov_base = (void*)(log + start);
+                iov[cnt].iov_len  = end - start;
+                cnt++;
+            }
+        }
+        start = end;
+    }
+
+    return cnt;
+}
+
+/**
+ * get the line which the sink outputs, the selected parts are copied to the sink buffer when some
+ * parts are removed
+ *
+ * @param line line info
+ * @param log log buffer
+ * @param size log size
+ * @param fmt sink format
+ * @param len output line length
+ *
+ * @return output line
+ */
+static const char* log_line_view(const log_line_t* line, const char* log, size_t size,
+                                 uint8_t fmt, size_t* len) {
+    struct iovec iov[LOG_PART_MAX];
+    int i, cnt = log_line_iov(line, log, size, fmt, iov);
+    size_t buf_size = LOG_LINE_BUF_SIZE, n;
+    char* buf       = sink_buf;
+
+    if (cnt == 1) {
+        *len = iov[0].iov_len;
+        return iov[0].iov_base;
+    }
+    if (size > LOG_LINE_BUF_SIZE &&
+        (buf = log_chunk_buf(&chunk_tls.view, size, size, &buf_size)) == NULL) {
+        buf = sink_buf;
+    }
+    for (i = 0, *len = 0; i < cnt; i++) {
+        n = iov[i].iov_len < buf_size - *len ? iov[i].iov_len : buf_size - *len;
+        memcpy(buf + *len, iov[i].iov_base, n);
+        *len += n;
+    }
+
+    return buf;
+}
+
+/* the whole raw log is the message */
+static void log_line_raw(log_line_t* line, uint8_t level, uint32_t sinks, size_t size) {
+    int i;
+
+    line->level = level;
+    line->sinks = sinks;
+    for (i = 0; i < LOG_PART_MAX; i++) {
+        line->part[i] = i < LOG_PART_MSG ? 0 : size;
+    }
+}
+
+static void log_async_push(log_async_t* q, uint8_t kind, const log_line_t* line, const char* log,
+                           size_t size, uint8_t overflow);
+
+/**
+ * write the log line to the file and user sinks
+ *
+ * @param line line info
+ * @param log log buffer
+ * @param size log size
+ * @param sinks sinks to write, the console is written by the caller
+ */
+static void log_write_sinks(const log_line_t* line, const char* log, size_t size, uint32_t sinks) {
+    log_sink_entry_t* sink;
+    const char* view;
+    size_t len;
+    int id;
+
+    while (sinks) {
+        id   = __builtin_ctz(sinks);
+        sink = &g_sinks[id];
+        sinks &= sinks - 1;
+
+        view = log_line_view(line, log, size, __atomic_load_n(&sink->cfg.fmt, __ATOMIC_RELAXED),
+                             &len);
+        if (len == 0) {
+            continue;
+        }
+        log_stats_bytes(id, len);
+        if (id == LOG_SINK_FILE) {
+            log_file_write(line->level, view, len);
+        } else if (sink->queue) {
+            log_async_push(sink->queue, LOG_ASYNC_TEXT, line, view, len,
+                           sink->cfg.async_overflow);
+        } else {
+            sink->cfg.output(sink->cfg.arg, line->level, view, len);
+        }
+    }
+}
+
+/**
+ * write the direct sinks in the producer's thread, they are removed from the line sinks
+ *
+ * @param line line info
+ * @param log log buffer
+ * @param size log size
+ */
+static void log_write_direct(log_line_t* line, const char* log, size_t size) {
+    uint32_t direct;
+
+    if (likely(!(line->sinks & __atomic_load_n(&sink_direct, __ATOMIC_RELAXED)))) {
+        return;
+    }
+
+    __atomic_add_fetch(&sink_direct_users, 1, __ATOMIC_SEQ_CST);
+    direct = line->sinks & __atomic_load_n(&sink_direct, __ATOMIC_SEQ_CST);
+    log_write_sinks(line, log, size, direct);
+    __atomic_sub_fetch(&sink_direct_users, 1, __ATOMIC_RELEASE);
+
+    line->sinks &= ~direct;
+}
+
+/* console fd of the level */
+static int log_console_fd(uint8_t level) {
+    uint8_t lvl = __atomic_load_n(&g_log.console_stderr_lvl, __ATOMIC_RELAXED);
+
+    return lvl != LOG_CONSOLE_STDERR_NONE && level <= lvl ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+/* write the log to the sinks which accept it */
+static void log_write(const log_line_t* line, const char* log, size_t size) {
+    uint32_t sinks = line->sinks & __atomic_load_n(&sink_active, __ATOMIC_ACQUIRE);
+    uint8_t fmt    = __atomic_load_n(&g_sinks[LOG_SINK_CONSOLE].cfg.fmt, __ATOMIC_RELAXED);
+    struct iovec iov[LOG_PART_MAX];
+    int i, cnt;
+
+    /* output log */
+    if (sinks & (1u << LOG_SINK_CONSOLE)) {
+        cnt = log_line_iov(line, log, size, fmt, iov);
+        for (i = 0; i < cnt; i++) {
+            log_stats_bytes(LOG_SINK_CONSOLE, iov[i].iov_len);
+        }
+        log_port_output_v(log_console_fd(line->level), iov, cnt, &cnt, 1);
+    }
+
+    /* write the file and user sinks */
+    log_write_sinks(line, log, size, sinks & ~(1u << LOG_SINK_CONSOLE));
+}
+
+static void log_async_timedwait(pthread_mutex_t* lock, pthread_cond_t* cond, long ms) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += ms * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+static void log_async_wakeup(log_async_t* q) {
+    if (__atomic_load_n(&q->waiting, __ATOMIC_SEQ_CST)) {
+        pthread_cond_signal(&q->wake);
+    }
+}
+
+/**
+ * take the oldest filled slot from the ring
+ *
+ * @param q async ring
+ * @param pos slot position, must be passed to log_async_release
+ *
+ * @return slot, NULL when the ring is empty
+ */
+static log_async_slot_t* log_async_pop(log_async_t* q, size_t* pos) {
+    log_async_slot_t* slot;
+    intptr_t diff;
+    size_t cur = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &q->slots[cur & q->mask];
+        diff = (intptr_t)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (intptr_t)(cur + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &cur, cur + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            cur = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    *pos = cur;
+
+    return slot;
+}
+
+/* get the log buffer of the slot */
+static inline char* log_async_slot_buf(log_async_slot_t* slot) {
+    return slot->ext ? slot->ext->buf : slot->buf;
+}
+
+/* give the slot back to producers, and wake the producers which sleep on the full ring */
+static void log_async_release(log_async_t* q, log_async_slot_t* slot, size_t pos) {
+    if (unlikely(slot->ext != NULL)) {
+        log_chunk_put(slot->ext);
+        slot->ext = NULL;
+    }
+    __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_SEQ_CST);
+    if (unlikely(__atomic_load_n(&q->blocked, __ATOMIC_SEQ_CST) != 0)) {
+        pthread_mutex_lock(&q->space_lock);
+        pthread_cond_broadcast(&q->space);
+        pthread_mutex_unlock(&q->space_lock);
+    }
+}
+
+/**
+ * sleep until the slot at pos is freed, the releaser checks blocked after freeing a slot and the
+ * slot is checked again after blocked is counted, so the wakeup isn't lost
+ *
+ * @param q async ring
+ * @param pos position of the slot the producer waits for
+ */
+static void log_async_block(log_async_t* q, size_t pos) {
+    log_async_slot_t* slot = &q->slots[pos & q->mask];
+
+    __atomic_add_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
+    log_async_wakeup(q);
+    pthread_mutex_lock(&q->space_lock);
+    if ((intptr_t)(__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) - pos) < 0) {
+        log_async_timedwait(&q->space_lock, &q->space, LOG_ASYNC_IDLE_MS);
+    }
+    pthread_mutex_unlock(&q->space_lock);
+    __atomic_sub_fetch(&q->blocked, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * cut the long line to the slot buffer. The message is cut and the CSI end and newline signs are
+ * kept, the part offsets are clamped as log_format_tail does.
+ *
+ * @param buf slot buffer
+ * @param line line info, its parts are cut
+ * @param log log buffer
+ * @param size log size
+ *
+ * @return cut log size
+ */
+static size_t log_async_cut(char* buf, log_line_t* line, const char* log, size_t size) {
+    size_t cut = size - LOG_LINE_BUF_SIZE, tail = 0, msg_end;
+    int i;
+
+    if (line->part[LOG_PART_NEWLINE] == size && line->part[LOG_PART_MSG] <= size &&
+        size - line->part[LOG_PART_MSG] < LOG_LINE_BUF_SIZE) {
+        tail = size - line->part[LOG_PART_MSG];
+    }
+    msg_end = LOG_LINE_BUF_SIZE - tail;
+    memcpy(buf, log, msg_end);
+    memcpy(buf + msg_end, log + size - tail, tail);
+    for (i = 0; i < LOG_PART_MAX; i++) {
+        if (tail && i > LOG_PART_MSG) {
+            line->part[i] -= cut;
+        } else if (line->part[i] > msg_end) {
+            line->part[i] = msg_end;
+        }
+    }
+    log_stats_truncated();
+
+    return LOG_LINE_BUF_SIZE;
+}
+
+/**
+ * copy the log into a free slot of the ring, the overflow policy decides what happens when full
+ *
+ * @param q async ring
+ * @param kind LOG_ASYNC_TEXT: formatted log LOG_ASYNC_BIN: binary log record
+ * @param line line info
+ * @param log log buffer
+ * @param size log size
+ * @param overflow LOG_ASYNC_OVERFLOW policy
+ */
+static void log_async_push(log_async_t* q, uint8_t kind, const log_line_t* line, const char* log,
+                           size_t size, uint8_t overflow) {
+    log_async_slot_t *slot, *old;
+    log_chunk_t* ext = NULL;
+    intptr_t diff;
+    size_t old_pos, pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    bool cut  = false;
+    int spins = 0;
+
+    /* the long line is copied to a chunk, it is cut to the slot buffer without memory */
+    if (unlikely(size > LOG_LINE_BUF_SIZE) && (ext = log_chunk_get(size)) == NULL) {
+        cut = true;
+    }
+
+    for (;;) {
+        slot = &q->slots[pos & q->mask];
+        diff = (intptr_t)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        } else if (diff < 0) {
+            /* ring is full */
+            if (overflow == LOG_ASYNC_OVERFLOW_DROP_NEWEST) {
+                __atomic_add_fetch(&q->drop_newest, 1, __ATOMIC_RELAXED);
+                log_chunk_put(ext);
+                return;
+            }
+            /* only drop when full of queued lines, not while the output thread holds a slot */
+            if (overflow == LOG_ASYNC_OVERFLOW_DROP_OLDEST &&
+                pos - __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED) > q->mask &&
+                (old = log_async_pop(q, &old_pos)) != NULL) {
+                log_async_release(q, old, old_pos);
+                __atomic_add_fetch(&q->drop_oldest, 1, __ATOMIC_RELAXED);
+            } else if (overflow == LOG_ASYNC_OVERFLOW_BLOCK && ++spins > LOG_ASYNC_SPIN) {
+                /* the output thread is slower than the producers, sleep instead of spinning */
+                log_async_block(q, pos);
+            } else {
+                log_async_wakeup(q);
+                sched_yield();
+            }
+        }
+        pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    slot->ext  = ext;
+    slot->kind = kind;
+    slot->line = *line;
+    if (unlikely(cut)) {
+        size = log_async_cut(slot->buf, &slot->line, log, size);
+    } else {
+        memcpy(ext ? ext->buf : slot->buf, log, size);
+    }
+    slot->len = size;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    log_async_wakeup(q);
+}
+
+/*
+ * drain the global ring to the sinks, the console gets one writev per batch, or per run of the
+ * lines which go to the same fd
+ */
+static void log_async_drain(log_async_t* q) {
+    log_async_slot_t *slot, *batch[LOG_ASYNC_BATCH];
+    size_t pos, batch_pos[LOG_ASYNC_BATCH];
+    struct iovec iov[LOG_ASYNC_BATCH * LOG_PART_MAX];
+    int line_end[LOG_ASYNC_BATCH];
+    uint8_t console_fmt;
+    uint32_t sinks;
+    int i, cnt, iov_cnt, iov_end, lines, fd = STDOUT_FILENO, line_fd;
+    size_t total = 0;
+
+    /* one ring of lines at most, so the lock waiters get in under sustained load */
+    do {
+        /* the removed sinks are not used after the lock is released */
+        sinks       = __atomic_load_n(&sink_active, __ATOMIC_ACQUIRE);
+        console_fmt = __atomic_load_n(&g_sinks[LOG_SINK_CONSOLE].cfg.fmt, __ATOMIC_RELAXED);
+        for (cnt = 0, iov_cnt = 0, lines = 0; cnt < LOG_ASYNC_BATCH;) {
+            if ((slot = log_async_pop(q, &pos)) == NULL) break;
+            /* the binary log is formatted here, off the caller's thread */
+            if (slot->kind == LOG_ASYNC_BIN &&
+                (slot->len = log_bin_async_format(slot->buf, slot->len, slot->line.part)) == 0) {
+                log_async_release(q, slot, pos);
+                continue;
+            }
+            batch[cnt]     = slot;
+            batch_pos[cnt] = pos;
+            if (slot->line.sinks & sinks & (1u << LOG_SINK_CONSOLE)) {
+                /* keep the order of the lines across stdout and stderr */
+                if ((line_fd = log_console_fd(slot->line.level)) != fd && lines > 0) {
+                    log_port_output_v(fd, iov, iov_cnt, line_end, lines);
+                    iov_cnt = 0;
+                    lines   = 0;
+                }
+                fd      = line_fd;
+                iov_end = iov_cnt + log_line_iov(&slot->line, log_async_slot_buf(slot), slot->len,
+                                                 console_fmt, iov + iov_cnt);
+                for (; iov_cnt < iov_end; iov_cnt++) {
+                    log_stats_bytes(LOG_SINK_CONSOLE, iov[iov_cnt].iov_len);
+                }
+                line_end[lines++] = iov_cnt;
+            }
+            cnt++;
+        }
+        if (cnt == 0) break;
+
+        if (lines > 0) {
+            log_port_output_v(fd, iov, iov_cnt, line_end, lines);
+        }
+        for (i = 0; i < cnt; i++) {
+            log_write_sinks(&batch[i]->line, log_async_slot_buf(batch[i]), batch[i]->len,
+                            batch[i]->line.sinks & sinks & ~(1u << LOG_SINK_CONSOLE));
+            log_async_release(q, batch[i], batch_pos[i]);
+        }
+        total += cnt;
+    } while (cnt == LOG_ASYNC_BATCH && total <= q->mask);
+    log_file_flush(false);
+    log_port_output_retry();
+}
+
+/* async output thread, drain the ring until it is stopped */
+static void* log_async_thread(void* arg) {
+    log_async_t* q = arg;
+    log_async_slot_t* slot;
+    size_t pos;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        q->drain(q);
+        pthread_cond_broadcast(&q->done);
+
+        if (!__atomic_load_n(&q->running, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        /* the ring may never be empty under sustained load, give the lock to the waiters */
+        if (__atomic_load_n(&q->lock_waiters, __ATOMIC_SEQ_CST) != 0) {
+            log_async_timedwait(&q->lock, &q->wake, LOG_ASYNC_IDLE_MS);
+            continue;
+        }
+
+        __atomic_store_n(&q->waiting, true, __ATOMIC_SEQ_CST);
+        /* recheck the head slot, a producer may have filled it before seeing waiting */
+        pos  = __atomic_load_n(&q->dequeue_pos, __ATOMIC_SEQ_CST);
+        slot = &q->slots[pos & q->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != pos + 1) {
+            log_async_timedwait(&q->lock, &q->wake, LOG_ASYNC_IDLE_MS);
+        }
+        __atomic_store_n(&q->waiting, false, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+/* take the lock held by the output thread, it is given up between the drains */
+static void log_async_lock(log_async_t* q) {
+    __atomic_add_fetch(&q->lock_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&q->lock);
+    __atomic_sub_fetch(&q->lock_waiters, 1, __ATOMIC_RELAXED);
+}
+
+/* release the lock and wake the output thread which gave it up */
+static void log_async_unlock(log_async_t* q) {
+    pthread_mutex_unlock(&q->lock);
+    pthread_cond_signal(&q->wake);
+}
+
+/* wait until every line queued before this call has been written */
+static void log_async_flush(log_async_t* q) {
+    size_t target = __atomic_load_n(&q->enqueue_pos, __ATOMIC_ACQUIRE);
+
+    /* counted as a waiter until done, the lock is taken again after every drain */
+    __atomic_add_fetch(&q->lock_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&q->lock);
+    while ((intptr_t)(__atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE) - target) < 0) {
+        pthread_cond_signal(&q->wake);
+        log_async_timedwait(&q->lock, &q->done, LOG_ASYNC_IDLE_MS);
+    }
+    __atomic_sub_fetch(&q->lock_waiters, 1, __ATOMIC_RELAXED);
+    log_async_unlock(q);
+}
+
+static int log_async_init(log_async_t* q, size_t capacity_min) {
+    size_t i, capacity = 1;
+
+    while (capacity < capacity_min) {
+        capacity <<= 1;
+    }
+
+    q->slots = malloc(capacity * sizeof(log_async_slot_t));
+    LOG_CHECK(q->slots == NULL, return -1;);
+
+    for (i = 0; i < capacity; i++) {
+        q->slots[i].seq = i;
+        q->slots[i].ext = NULL;
+    }
+    q->mask        = capacity - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    q->running     = true;
+
+    if (pthread_create(&q->thread, NULL, log_async_thread, q) != 0) {
+        free(q->slots);
+        q->slots = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void log_async_deinit(log_async_t* q) {
+    /* wait for producers which still push into the ring */
+    while (__atomic_load_n(&q->users, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+
+    log_async_flush(q);
+
+    log_async_lock(q);
+    __atomic_store_n(&q->running, false, __ATOMIC_RELEASE);
+    log_async_unlock(q);
+
+    pthread_join(q->thread, NULL);
+
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/**
+ * queue the log to output thread when async mode is enabled
+ *
+ * @param kind LOG_ASYNC_TEXT: formatted log LOG_ASYNC_BIN: binary log record
+ * @param line line info, the parts of the binary log are set when it is formatted
+ * @param log log buffer
+ * @param size log size
+ *
+ * @return true: queued (or dropped by overflow policy) false: async mode is disabled
+ */
+static bool log_async_output(uint8_t kind, const log_line_t* line, const char* log, size_t size) {
+    if (__atomic_load_n(&g_log.async_enabled, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&g_async.users, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&g_log.async_enabled, __ATOMIC_SEQ_CST)) {
+            log_async_push(&g_async, kind, line, log, size, g_log.async_overflow);
+            __atomic_sub_fetch(&g_async.users, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        __atomic_sub_fetch(&g_async.users, 1, __ATOMIC_RELEASE);
+    }
+
+    return false;
+}
+
+/* output the statistics as a log when the self-report interval is reached */
+static void log_stats_report_check(void) {
+    uint32_t interval = __atomic_load_n(&g_log.stats_report_ms, __ATOMIC_RELAXED);
+    uint64_t now, next, other = 0;
+    log_stats_t st;
+    size_t i;
+
+    if (likely(interval == 0) || !__atomic_load_n(&g_log.stats_enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    now  = log_stats_now() / 1000000;
+    next = __atomic_load_n(&stats_report_next, __ATOMIC_RELAXED);
+    /* only one thread reports in an interval, the report line itself doesn't pass here again */
+    if (now < next || !__atomic_compare_exchange_n(&stats_report_next, &next, now + interval,
+                                                   false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    /* the first check only starts the interval */
+    if (next == 0) {
+        return;
+    }
+
+    log_get_stats(&st);
+    for (i = LOG_SINK_FILE + 1; i < LOG_SINK_MAX_NUM; i++) {
+        other += st.sink_bytes[i];
+    }
+    log_output(LOG_LVL_INFO, LOG_TAG, __FILE__, __FUNCTION__, __LINE__,
+               "stats: emitted A %" PRIu64 " E %" PRIu64 " W %" PRIu64 " I %" PRIu64
+               " D %" PRIu64 " V %" PRIu64 " raw %" PRIu64 ", filtered %" PRIu64
+               ", truncated %" PRIu64 ", bytes console %" PRIu64 " file %" PRIu64
+               " other %" PRIu64 ", lock waits output %" PRIu64 " (%" PRIu64 " us) file %" PRIu64
+               " (%" PRIu64 " us), rotations %" PRIu64 " (%" PRIu64 " us), async depth %zu"
+               " drops %zu/%zu, console drops %zu",
+               st.emitted[LOG_LVL_ASSERT], st.emitted[LOG_LVL_ERROR], st.emitted[LOG_LVL_WARN],
+               st.emitted[LOG_LVL_INFO], st.emitted[LOG_LVL_DEBUG], st.emitted[LOG_LVL_VERBOSE],
+               st.emitted[LOG_LVL_RAW],
+               st.filtered[LOG_LVL_ASSERT] + st.filtered[LOG_LVL_ERROR] +
+                   st.filtered[LOG_LVL_WARN] + st.filtered[LOG_LVL_INFO] +
+                   st.filtered[LOG_LVL_DEBUG] + st.filtered[LOG_LVL_VERBOSE],
+               st.truncated, st.sink_bytes[LOG_SINK_CONSOLE], st.sink_bytes[LOG_SINK_FILE],
+               other, st.output_lock_waits,
+               st.output_lock_wait_ns / 1000, st.file_lock_waits, st.file_lock_wait_ns / 1000,
+               st.rotations, st.rotate_ns / 1000, st.async_depth, st.async_drop_newest,
+               st.async_drop_oldest, st.console_drops);
+}
+
+/**
+ * output the log to the sinks which accept it, it will be queued to output thread in async mode.
+ * Only the sync write holds the output lock.
+ *
+ * @param line line info, the sinks are set here
+ * @param tag tag, NULL: raw log
+ * @param log log buffer
+ * @param size log size
+ */
+static void log_do_write(log_line_t* line, const char* tag, const char* log, size_t size) {
+    if ((line->sinks = log_sink_match(line->level, tag)) == 0) {
+        log_stats_line(line->level, tag, false);
+        return;
+    }
+    log_stats_line(line->level, tag, true);
+    log_write_direct(line, log, size);
+    if (line->sinks == 0) {
+        return;
+    }
+    if (log_async_output(LOG_ASYNC_TEXT, line, log, size)) {
+        return;
+    }
+
+    log_port_output_lock();
+    log_write(line, log, size);
+    log_port_output_unlock();
+}
+
+/* output the log, then make the reports which are due */
+static void log_do_output(log_line_t* line, const char* tag, const char* log, size_t size) {
+    log_do_write(line, tag, log, size);
+    /* the report reuses the line buffer, so it is only made after the line is output */
+    log_stats_report_check();
+    log_limit_check(false);
+}
+
+/* drain the own queue of the sink */
+static void log_sink_drain(log_async_t* q) {
+    log_sink_entry_t* sink = q->owner;
+    log_async_slot_t* slot;
+    size_t pos, n;
+
+    /* one ring of lines at most as log_async_drain */
+    for (n = 0; n <= q->mask && (slot = log_async_pop(q, &pos)) != NULL; n++) {
+        sink->cfg.output(sink->cfg.arg, slot->line.level, log_async_slot_buf(slot), slot->len);
+        log_async_release(q, slot, pos);
+    }
+}
+
+/* create the own async queue of the sink */
+static log_async_t* log_sink_queue_create(log_sink_entry_t* sink) {
+    log_async_t* q = aligned_alloc(64, sizeof(log_async_t));
+
+    LOG_CHECK(q == NULL, return NULL;);
+
+    memset(q, 0, sizeof(log_async_t));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+    pthread_cond_init(&q->done, NULL);
+    pthread_mutex_init(&q->space_lock, NULL);
+    pthread_cond_init(&q->space, NULL);
+    q->drain = log_sink_drain;
+    q->owner = sink;
+    if (log_async_init(q, sink->cfg.async_capacity) != 0) {
+        free(q);
+        return NULL;
+    }
+
+    return q;
+}
+
+/* write the queued lines and destroy the own async queue of the sink */
+static void log_sink_queue_destroy(log_async_t* q) {
+    log_async_deinit(q);
+    pthread_cond_destroy(&q->space);
+    pthread_mutex_destroy(&q->space_lock);
+    pthread_cond_destroy(&q->done);
+    pthread_cond_destroy(&q->wake);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+/* flush the queues and call the flush of the user sinks */
+static void log_sink_flush(void) {
+    uint32_t active;
+    log_sink_entry_t* sink;
+
+    pthread_mutex_lock(&sink_lock);
+    active = __atomic_load_n(&sink_active, __ATOMIC_ACQUIRE) &
+             ~((1u << LOG_SINK_CONSOLE) | (1u << LOG_SINK_FILE));
+    while (active) {
+        sink = &g_sinks[__builtin_ctz(active)];
+        active &= active - 1;
+
+        if (sink->queue) {
+            log_async_flush(sink->queue);
+        }
+        if (sink->cfg.flush == NULL) {
+            continue;
+        }
+        /* the flush doesn't run with the output of the sink */
+        if (sink->queue) {
+            log_async_lock(sink->queue);
+            sink->cfg.flush(sink->cfg.arg);
+            log_async_unlock(sink->queue);
+        } else {
+            log_port_output_lock();
+            log_async_lock(&g_async);
+            sink->cfg.flush(sink->cfg.arg);
+            log_async_unlock(&g_async);
+            log_port_output_unlock();
+        }
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+/* invalidate the cached filter state of all log sites */
+static void log_filter_changed(void) { __atomic_add_fetch(&log_filter_gen, 1, __ATOMIC_RELEASE); }
+
+/**
+ * EasyLogger initialize.
+ *
+ * @return result
+ */
+int log_init(void) {
+    int ret = 0;
+
+    /* port initialize */
+    if ((ret = log_port_init()) != 0) return ret;
+
+    /* flush the queued and buffered logs on normal exit */
+    atexit(log_flush);
+
+    log_bin_init();
+
+    g_log.init_ok = true;
+
+    return ret;
+}
+
+/**
+ * set output enable or disable
+ *
+ * @param enabled TRUE: enable FALSE: disable
+ */
+void log_set_output_enabled(bool enabled) {
+    g_log.output_enabled = enabled;
+    log_filter_changed();
+}
+
+/**
+ * set log file output enable or disable
+ *
+ * @param enabled TRUE: enable FALSE: disable
+ */
+void log_set_file_output_enabled(bool enabled)
+{
+    LOG_CHECK(g_log.name == NULL, return );
+
+    if (enabled && g_log.fp == NULL)
+        log_file_init();
+    else if (g_log.fp != NULL)
+        log_file_deinit();
+}
+
+/**
+ * set log file name
+ *
+ * @param name log file name
+ */
+void log_set_file_name(const char* name) {
+    LOG_CHECK(name == NULL || strlen(name) == 0, return );
+    LOG_CHECK(g_log.fp != NULL, return );
+
+    g_log.name = (char*)name;
+}
+
+/**
+ * set log file rotation, it takes effect on the next written log or the next mapped file
+ *
+ * @param max_size file max size, the file is rotated when its size exceeds it
+ * @param max_rotate max rotate file count, 0: stop writing the file when it is full
+ */
+void log_set_file_rotate(size_t max_size, int max_rotate) {
+    LOG_CHECK(max_size == 0 || max_rotate < 0, return;);
+
+    log_file_port_lock();
+    g_log.max_size   = max_size;
+    g_log.max_rotate = max_rotate;
+    log_file_port_unlock();
+}
+
+/**
+ * set log file rotation by time, it works with the rotation by size
+ *
+ * @param policy LOG_FILE_ROTATE_SIZE, LOG_FILE_ROTATE_HOURLY or LOG_FILE_ROTATE_DAILY
+ */
+void log_set_file_rotate_time(uint8_t policy) {
+    LOG_CHECK(policy >= LOG_FILE_ROTATE_MAX, return;);
+
+    log_file_port_lock();
+    g_log.rotate_policy = policy;
+    if (g_log.fp) {
+        __atomic_store_n(&g_log.rotate_time, log_file_next_rotate_time(), __ATOMIC_RELAXED);
+    }
+    log_file_port_unlock();
+}
+
+/**
+ * set the rotated file compression, xxx.log.0 is compressed by the external tool in the compress
+ * thread after every rotation, the files which are already rotated are not compressed
+ *
+ * @param compress LOG_FILE_COMPRESS_NONE, LOG_FILE_COMPRESS_GZIP or LOG_FILE_COMPRESS_ZSTD
+ */
+void log_set_file_compress(uint8_t compress) {
+    LOG_CHECK(compress >= LOG_FILE_COMPRESS_MAX, return;);
+
+    log_file_port_lock();
+    g_log.compress = compress;
+    log_file_port_unlock();
+}
+
+/**
+ * set the rotated files retention by total size, the oldest files over it are removed after
+ * every rotation. The count is still limited by max_rotate.
+ *
+ * @param max_bytes rotated files max total size, 0: no limit
+ */
+void log_set_file_retention(size_t max_bytes) {
+    log_file_port_lock();
+    g_log.retention = max_bytes;
+    log_file_port_unlock();
+}
+
+/**
+ * set log file written by memory mapped segments or by stdio buffer. The mapped file is
+ * preallocated to the max size and rotated when it is full, the logs are kept in page cache when
+ * the process crashes.
+ *
+ * @param enabled TRUE: memory mapped FALSE: stdio buffer
+ */
+void log_set_file_mmap_enabled(bool enabled) {
+    LOG_CHECK(g_log.fp != NULL, return;);
+
+    g_log.file_mmap = enabled;
+}
+
+/**
+ * set async output enable or disable.
+ * Disable will wait for all queued logs written and stop the output thread.
+ *
+ * @param enabled TRUE: enable FALSE: disable
+ */
+void log_set_async_enabled(bool enabled) {
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    if (enabled && !g_log.async_enabled) {
+        if (log_async_init(&g_async, g_log.async_capacity) == 0) {
+            __atomic_store_n(&g_log.async_enabled, true, __ATOMIC_SEQ_CST);
+        }
+    } else if (!enabled && g_log.async_enabled) {
+        __atomic_store_n(&g_log.async_enabled, false, __ATOMIC_SEQ_CST);
+        log_async_deinit(&g_async);
+    }
+}
+
+/**
+ * set async output ring capacity
+ *
+ * @param capacity max queued lines, it will be rounded up to a power of two
+ */
+void log_set_async_capacity(size_t capacity) {
+    LOG_CHECK(capacity == 0, return;);
+    LOG_CHECK(g_log.async_enabled, return;);
+
+    g_log.async_capacity = capacity;
+}
+
+/**
+ * set async output ring overflow policy
+ *
+ * @param policy LOG_ASYNC_OVERFLOW_BLOCK, LOG_ASYNC_OVERFLOW_DROP_NEWEST or
+ * LOG_ASYNC_OVERFLOW_DROP_OLDEST
+ */
+void log_set_async_overflow(uint8_t policy) {
+    LOG_CHECK(policy >= LOG_ASYNC_OVERFLOW_MAX, return;);
+
+    g_log.async_overflow = policy;
+}
+
+/**
+ * get the lines dropped by async output ring overflow
+ *
+ * @param newest dropped newest lines count, can be NULL
+ * @param oldest dropped oldest lines count, can be NULL
+ */
+void log_get_async_drops(size_t* newest, size_t* oldest) {
+    if (newest) *newest = __atomic_load_n(&g_async.drop_newest, __ATOMIC_RELAXED);
+    if (oldest) *oldest = __atomic_load_n(&g_async.drop_oldest, __ATOMIC_RELAXED);
+}
+
+/**
+ * set log file buffer and flush policy.
+ * The buffer is flushed when it is full, when the interval is reached, when a log which level is
+ * equal or higher than the flush level is written, or by log_flush.
+ *
+ * @param buf_size file buffer size, 0: flush every log
+ * @param interval_ms max time the logs stay in the buffer, it is checked on every write, by the
+ * async output thread and by the flush thread which runs while the file is buffered
+ * @param level the logs on this level or higher level are flushed immediately
+ */
+void log_set_file_flush(size_t buf_size, uint32_t interval_ms, uint8_t level) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(g_log.fp != NULL, return;);
+
+    free(g_log.file_buf);
+    g_log.file_buf       = NULL;
+    g_log.file_buf_size  = buf_size;
+    g_log.file_flush_ms  = interval_ms;
+    g_log.file_flush_lvl = level;
+}
+
+/**
+ * flush all logs, it will wait for the output thread written all queued logs in async mode
+ */
+void log_flush(void) {
+    log_limit_check(true);
+    if (__atomic_load_n(&g_log.async_enabled, __ATOMIC_ACQUIRE)) {
+        log_async_flush(&g_async);
+    }
+
+    log_file_flush(true);
+    log_rotate_wait();
+    log_sink_flush();
+    log_port_output_retry();
+}
+
+/**
+ * set the clock and fraction precision of the time info
+ *
+ * @param clock LOG_TIME_CLOCK_REALTIME, LOG_TIME_CLOCK_REALTIME_COARSE or LOG_TIME_CLOCK_MONOTONIC
+ * @param precision LOG_TIME_PREC_MS, LOG_TIME_PREC_US or LOG_TIME_PREC_NS
+ */
+void log_set_time_format(uint8_t clock, uint8_t precision) {
+    LOG_CHECK(clock >= LOG_TIME_CLOCK_MAX, return;);
+    LOG_CHECK(precision >= LOG_TIME_PREC_MAX, return;);
+
+    g_log.time_clock     = clock;
+    g_log.time_precision = precision;
+}
+
+/**
+ * set the format set of the level, the header layout of the level is rebuilt
+ *
+ * @param level level
+ * @param set LOG_FMT_* formats, they are constants and can't be changed when LOG_FMT_FIXED is
+ * defined
+ */
+void log_set_fmt(uint8_t level, size_t set) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(set & ~(size_t)LOG_FMT_ALL, return;);
+#ifdef LOG_FMT_FIXED
+    LOG_CHECK(set != log_fmt_set(level), return;);
+#else
+    pthread_mutex_lock(&fmt_lock);
+    g_log.enabled_fmt_set[level] = set;
+    pthread_mutex_unlock(&fmt_lock);
+    log_fmt_plan_update(true);
+    /* the keyword filter results of the sites depend on their headers */
+    log_filter_changed();
+#endif
+}
+
+/**
+ * get the format set of the level
+ *
+ * @param level level
+ *
+ * @return LOG_FMT_* formats
+ */
+size_t log_get_fmt(uint8_t level) {
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return 0;);
+
+    return log_fmt_set(level);
+}
+
+/**
+ * set the encoding of the log lines, the raw, hexdump and binary logs are not encoded
+ *
+ * @param encoding LOG_ENC_TEXT, LOG_ENC_JSON or LOG_ENC_LOGFMT
+ */
+void log_set_encoding(uint8_t encoding) {
+    LOG_CHECK(encoding >= LOG_ENC_MAX, return;);
+
+    g_log.encoding = encoding;
+}
+
+/**
+ * set the rate limit of every call site. The lines over it are dropped, their count is reported
+ * when a line of the site passes again or a second after the burst ends.
+ *
+ * @param rate lines per second of a call site, 0: no limit
+ * @param burst lines output at once before the rate applies, 0: 1
+ */
+void log_set_rate_limit(uint32_t rate, uint32_t burst) {
+    __atomic_store_n(&g_log.limit_burst, burst ? burst : 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_log.limit_interval, rate ? 1000000000ULL / rate : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * set the repeated line suppression. The message which a call site outputs again within the
+ * window is dropped, the repeat count is reported when the site outputs another message or the
+ * window passes.
+ *
+ * @param window_ms repeat window, 0: no suppression
+ */
+void log_set_dedup(uint32_t window_ms) {
+    __atomic_store_n(&g_log.dedup_window, window_ms * 1000000ULL, __ATOMIC_RELAXED);
+}
+
+/**
+ * route the console lines of the levels up to the level to stderr, e.g. LOG_LVL_ERROR writes the
+ * error and assert lines to stderr and the others to stdout
+ *
+ * @param level max level written to stderr, LOG_CONSOLE_STDERR_NONE: all lines go to stdout
+ */
+void log_set_console_stderr(uint8_t level) {
+    LOG_CHECK(level > LOG_CONSOLE_STDERR_NONE, return;);
+
+    __atomic_store_n(&g_log.console_stderr_lvl, level, __ATOMIC_RELAXED);
+}
+
+/**
+ * set the non-blocking console. The lines which a paused pipe or slow terminal doesn't take are
+ * kept in a backlog of every fd and written when it is writable again, the lines which don't fit
+ * in the backlog are dropped and counted in log_stats_t.console_drops.
+ * A pipe or terminal is written by an own O_NONBLOCK open file description, the flags of stdout
+ * and stderr are not changed. Call it again after stdout or stderr is redirected.
+ *
+ * @param backlog backlog bytes of stdout and stderr each, 0: blocking writes
+ */
+void log_set_console_nonblock(size_t backlog) {
+    __atomic_store_n(&g_log.console_backlog, backlog, __ATOMIC_RELAXED);
+    log_port_output_reset();
+}
+
+/**
+ * set the max line size, the line which doesn't fit in the line buffer is formatted in a chunk
+ * taken from the line chunk pool, the longer line is truncated
+ *
+ * @param size max line size, from LOG_LINE_BUF_SIZE (no larger buffer) to 65535
+ */
+void log_set_line_max(size_t size) {
+    LOG_CHECK(size < LOG_LINE_BUF_SIZE || size > UINT16_MAX, return;);
+
+    g_log.line_max = size;
+}
+
+/**
+ * enable or disable the statistics collection, the counters are kept when it is disabled
+ *
+ * @param enabled true: collect the statistics
+ */
+void log_set_stats_enabled(bool enabled) {
+    __atomic_store_n(&g_log.stats_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * set the statistics self-report interval, the report is an INFO log of the "log" tag
+ *
+ * @param interval_ms report interval, 0: no report
+ */
+void log_set_stats_report(uint32_t interval_ms) {
+    __atomic_store_n(&stats_report_next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_log.stats_report_ms, interval_ms, __ATOMIC_RELAXED);
+}
+
+/**
+ * get the statistics, the counters of the running threads are read without stopping them
+ *
+ * @param stats statistics
+ */
+void log_get_stats(log_stats_t* stats) {
+    const log_stats_block_t* block;
+    size_t i;
+
+    LOG_CHECK(stats == NULL, return;);
+
+    memset(stats, 0, sizeof(log_stats_t));
+    pthread_mutex_lock(&stats_lock);
+    /* the exited threads first, then the running threads */
+    for (block = &stats_exited; block;
+         block = block == &stats_exited ? stats_blocks : block->next) {
+        for (i = 0; i < LOG_LVL_MAX + 1; i++) {
+            stats->emitted[i] += __atomic_load_n(&block->emitted[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < LOG_LVL_MAX; i++) {
+            stats->filtered[i] += __atomic_load_n(&block->filtered[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < LOG_SINK_MAX_NUM; i++) {
+            stats->sink_bytes[i] += __atomic_load_n(&block->sink_bytes[i], __ATOMIC_RELAXED);
+        }
+        stats->truncated += __atomic_load_n(&block->truncated, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    stats->output_lock_waits   = __atomic_load_n(&stats_output_lock_wait[0], __ATOMIC_RELAXED);
+    stats->output_lock_wait_ns = __atomic_load_n(&stats_output_lock_wait[1], __ATOMIC_RELAXED);
+    stats->file_lock_waits     = __atomic_load_n(&stats_file_lock_wait[0], __ATOMIC_RELAXED);
+    stats->file_lock_wait_ns   = __atomic_load_n(&stats_file_lock_wait[1], __ATOMIC_RELAXED);
+    stats->rotations           = __atomic_load_n(&stats_rotate[0], __ATOMIC_RELAXED);
+    stats->rotate_ns           = __atomic_load_n(&stats_rotate[1], __ATOMIC_RELAXED);
+    if (__atomic_load_n(&g_log.async_enabled, __ATOMIC_ACQUIRE)) {
+        stats->async_depth = __atomic_load_n(&g_async.enqueue_pos, __ATOMIC_RELAXED) -
+                             __atomic_load_n(&g_async.dequeue_pos, __ATOMIC_RELAXED);
+    }
+    log_get_async_drops(&stats->async_drop_newest, &stats->async_drop_oldest);
+    stats->console_drops = __atomic_load_n(&console_drops, __ATOMIC_RELAXED);
+}
+
+/**
+ * get the statistics of the tags, the tags after the table is full are not counted
+ *
+ * @param stats tag statistics, the tag points to the statistics table
+ * @param num max count of the stats
+ *
+ * @return count of the stats got
+ */
+size_t log_get_tag_stats(log_tag_stats_t* stats, size_t num) {
+    const log_stats_tag_t* entry;
+    size_t i, n = 0;
+
+    LOG_CHECK(stats == NULL && num > 0, return 0;);
+
+    for (i = 0; i < LOG_STATS_TAG_NUM && n < num; i++) {
+        entry = &stats_tags[i];
+        if (__atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) != 2) {
+            continue;
+        }
+        stats[n].tag      = entry->tag;
+        stats[n].emitted  = __atomic_load_n(&entry->emitted, __ATOMIC_RELAXED);
+        stats[n].filtered = __atomic_load_n(&entry->filtered, __ATOMIC_RELAXED);
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * set log filter all parameter
+ *
+ * @param level level
+ * @param tag tag
+ * @param keyword keyword
+ */
+void log_set_filter(uint8_t level, const char* tag, const char* keyword) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+
+    log_set_filter_lvl(level);
+    log_set_filter_tag(tag);
+    log_set_filter_kw(keyword);
+}
+
+/**
+ * set log filter's level
+ *
+ * @param level level
+ */
+void log_set_filter_lvl(uint8_t level) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+
+    g_log.filter.level = level;
+    log_filter_changed();
+}
+
+/**
+ * set log filter's tag
+ *
+ * @param tag tag
+ */
+void log_set_filter_tag(const char* tag) {
+    strncpy(g_log.filter.tag, tag, LOG_FILTER_TAG_MAX_LEN);
+    log_filter_changed();
+}
+
+/* keyword filter list writer lock */
+static pthread_mutex_t kw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * find the keyword in the buffer, it compares the first and last byte of the keyword on 16
+ * positions at once, then compares the whole keyword on the candidates
+ *
+ * @param buf buffer, no need to end with '\0'
+ * @param len buffer length
+ * @param kw keyword
+ *
+ * @return true: found
+ */
+static bool log_kw_find(const char* buf, size_t len, const log_kw_filter_t* kw) {
+    size_t i = 0, n = kw->len;
+
+    if (n > len) return false;
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(kw->str[0]);
+    const __m128i last  = _mm_set1_epi8(kw->str[n - 1]);
+    unsigned mask;
+
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i block_last  = _mm_loadu_si128((const __m128i*)(buf + i + n - 1));
+        mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        for (; mask; mask &= mask - 1) {
+            if (!memcmp(buf + i + __builtin_ctz(mask), kw->str, n)) return true;
+        }
+    }
+#endif
+    /* the tail, or the whole buffer without SSE2 */
+    for (; i + n <= len; i++) {
+        if (buf[i] == kw->str[0] && !memcmp(buf + i, kw->str, n)) return true;
+    }
+
+    return false;
+}
+
+/**
+ * search the keywords in the buffer
+ *
+ * @param list keyword filter list
+ * @param buf buffer, no need to end with '\0'
+ * @param len buffer length
+ * @param literal true: buffer is format string text, keywords with '%' are skipped
+ * @param flags result found before
+ *
+ * @return LOG_KW_INCLUDE and LOG_KW_EXCLUDE flags
+ */
+static uint8_t log_kw_search(const log_kw_list_t* list, const char* buf, size_t len, bool literal,
+                             uint8_t flags) {
+    const log_kw_filter_t* kw;
+    uint8_t i;
+
+    for (i = 0; i < list->num && !(flags & LOG_KW_EXCLUDE); i++) {
+        kw = &list->kw[i];
+        if ((literal && !kw->literal) || (!kw->exclude && (flags & LOG_KW_INCLUDE))) {
+            continue;
+        }
+        if (log_kw_find(buf, len, kw)) {
+            flags |= kw->exclude ? LOG_KW_EXCLUDE : LOG_KW_INCLUDE;
+        }
+    }
+
+    return flags;
+}
+
+/**
+ * search the keywords in the text of the format string before formatting, the conversion
+ * specifications are skipped because their output is unknown
+ *
+ * @param list keyword filter list
+ * @param format format string
+ * @param flags result found before
+ *
+ * @return LOG_KW_INCLUDE and LOG_KW_EXCLUDE flags
+ */
+static uint8_t log_kw_search_format(const log_kw_list_t* list, const char* format,
+                                    uint8_t flags) {
+    const char* text;
+
+    while (*format && !(flags & LOG_KW_EXCLUDE)) {
+        text   = format;
+        format += strcspn(format, "%");
+        flags  = log_kw_search(list, text, format - text, true, flags);
+        if (*format == '%') {
+            /* skip flags, width, precision, length and the conversion */
+            format += 1 + strspn(format + 1, "-+ #'0123456789.*$hlLqjzt");
+            if (*format) format++;
+        }
+    }
+
+    return flags;
+}
+
+/* the keyword filter result passes: no exclude keyword and one of the include keywords if any */
+static bool log_kw_pass(const log_kw_list_t* list, uint8_t flags) {
+    return !(flags & LOG_KW_EXCLUDE) && (list->include_num == 0 || (flags & LOG_KW_INCLUDE));
+}
+
+/**
+ * replace the keyword filter list
+ *
+ * @param keyword keyword to add, NULL or "": none
+ * @param exclude true: exclude keyword
+ * @param clear true: remove all keywords before adding
+ */
+static void log_kw_update(const char* keyword, bool exclude, bool clear) {
+    log_kw_list_t *list, *cur;
+    log_kw_filter_t* kw;
+
+    pthread_mutex_lock(&kw_lock);
+
+    cur = g_log.filter.kw;
+    LOG_CHECK(!clear && cur && cur->num >= LOG_FILTER_KW_MAX_NUM, goto __exit;);
+    if ((list = calloc(1, sizeof(log_kw_list_t))) == NULL) goto __exit;
+
+    if (!clear && cur) {
+        memcpy(list->kw, cur->kw, sizeof(list->kw));
+        list->num         = cur->num;
+        list->include_num = cur->include_num;
+    }
+    if (keyword && keyword[0] != '\0') {
+        kw = &list->kw[list->num++];
+        strncpy(kw->str, keyword, LOG_FILTER_KW_MAX_LEN);
+        kw->len     = strlen(kw->str);
+        kw->exclude = exclude;
+        kw->literal = strchr(kw->str, '%') == NULL;
+        list->include_num += !exclude;
+    }
+    __atomic_store_n(&g_log.filter.kw, list->num ? list : NULL, __ATOMIC_RELEASE);
+    if (list->num == 0) {
+        free(list);
+    }
+    log_retire(cur);
+    log_filter_changed();
+
+__exit:
+    pthread_mutex_unlock(&kw_lock);
+}
+
+/**
+ * set log filter's keyword, it replaces all include and exclude keywords
+ *
+ * @param keyword keyword, "": remove all keywords
+ */
+void log_set_filter_kw(const char* keyword) { log_kw_update(keyword, false, true); }
+
+/**
+ * add log filter's keyword. The log is output when it has one of the include keywords (if any)
+ * and has none of the exclude keywords.
+ *
+ * @param keyword keyword
+ * @param exclude false: include keyword   true: exclude keyword
+ */
+void log_add_filter_kw(const char* keyword, bool exclude) {
+    LOG_CHECK(keyword == NULL || keyword[0] == '\0', return;);
+
+    log_kw_update(keyword, exclude, false);
+}
+
+/* tag level filter table writer lock */
+static pthread_mutex_t tag_lvl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a hash on the compared part of the tag */
+static size_t log_tag_lvl_hash(const char* tag) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < LOG_FILTER_TAG_MAX_LEN && tag[i]; i++) {
+        hash = (hash ^ (uint8_t)tag[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * find the tag in the tag level filter table without lock
+ *
+ * @param table table, can be NULL
+ * @param tag tag
+ *
+ * @return the filter entry, NULL when not found
+ */
+static log_tag_lvl_filter_t* log_tag_lvl_find(log_tag_lvl_table_t* table, const char* tag) {
+    log_tag_lvl_filter_t* entry;
+    size_t i;
+
+    if (table == NULL) return NULL;
+
+    /* the table is at most half full, so there is always an empty entry to stop */
+    for (i = log_tag_lvl_hash(tag) & table->mask;; i = (i + 1) & table->mask) {
+        entry = &table->entry[i];
+        if (!__atomic_load_n(&entry->tag_use_flag, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        if (!strncmp(tag, entry->tag, LOG_FILTER_TAG_MAX_LEN)) {
+            return entry;
+        }
+    }
+}
+
+/* insert the tag to the table, the entry is published after its tag and level are written */
+static log_tag_lvl_filter_t* log_tag_lvl_insert(log_tag_lvl_table_t* table, const char* tag,
+                                                uint8_t level, uint32_t sample) {
+    log_tag_lvl_filter_t* entry;
+    size_t i;
+
+    for (i = log_tag_lvl_hash(tag) & table->mask; table->entry[i].tag_use_flag;
+         i = (i + 1) & table->mask) {
+    }
+    entry = &table->entry[i];
+    strncpy(entry->tag, tag, LOG_FILTER_TAG_MAX_LEN);
+    entry->level  = level;
+    entry->sample = sample;
+    __atomic_store_n(&entry->tag_use_flag, true, __ATOMIC_RELEASE);
+    table->used++;
+
+    return entry;
+}
+
+/**
+ * add the tag to the table with no level filter and sampling, the lock must be held
+ *
+ * @param tag tag
+ *
+ * @return the filter entry, NULL: out of memory
+ */
+static log_tag_lvl_filter_t* log_tag_lvl_add(const char* tag) {
+    log_tag_lvl_table_t *table = g_log.filter.tag_lvl, *new_table;
+    size_t i, num;
+
+    if (table == NULL || (table->used + 1) * 2 > table->mask + 1) {
+        /* grow the table, the old one is kept for the readers */
+        num       = table ? (table->mask + 1) * 2 : LOG_FILTER_TAG_LVL_INIT_NUM;
+        new_table = calloc(1, sizeof(log_tag_lvl_table_t) + num * sizeof(log_tag_lvl_filter_t));
+        if (new_table == NULL) return NULL;
+        new_table->old  = table;
+        new_table->mask = num - 1;
+        for (i = 0; table && i <= table->mask; i++) {
+            if (table->entry[i].tag_use_flag) {
+                log_tag_lvl_insert(new_table, table->entry[i].tag, table->entry[i].level,
+                                   table->entry[i].sample);
+            }
+        }
+        __atomic_store_n(&g_log.filter.tag_lvl, new_table, __ATOMIC_RELEASE);
+        table = new_table;
+    }
+
+    return log_tag_lvl_insert(table, tag, LOG_FILTER_LVL_ALL, 0);
+}
+
+/**
+ * Set the filter's level by different tag.
+ * The log on this tag which level is less than it will stop output.
+ *
+ * example:
+ *     // the example tag log enter silent mode
+ *     log_set_filter_tag_lvl("example", LOG_FILTER_LVL_SILENT);
+ *     // the example tag log which level is less than INFO level will stop output
+ *     log_set_filter_tag_lvl("example", LOG_LVL_INFO);
+ *     // remove example tag's level filter, all level log will resume output
+ *     log_set_filter_tag_lvl("example", LOG_FILTER_LVL_ALL);
+ *
+ * @param tag log tag
+ * @param level The filter level. When the level is LOG_FILTER_LVL_SILENT, the log enter silent
+ * mode. When the level is LOG_FILTER_LVL_ALL, it will remove this tag's level filer. Then all level
+ * log will resume output.
+ *
+ */
+void log_set_filter_tag_lvl(const char* tag, uint8_t level) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(tag == NULL, return;);
+    log_tag_lvl_filter_t* entry;
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    pthread_mutex_lock(&tag_lvl_lock);
+
+    /* only add the new tag's level filer when level is not LOG_FILTER_LVL_ALL */
+    if ((entry = log_tag_lvl_find(g_log.filter.tag_lvl, tag)) == NULL &&
+        (level == LOG_FILTER_LVL_ALL || (entry = log_tag_lvl_add(tag)) == NULL)) {
+        goto __exit;
+    }
+    if (entry->level == LOG_FILTER_LVL_ALL && level != LOG_FILTER_LVL_ALL) {
+        __atomic_add_fetch(&g_log.filter.tag_lvl_num, 1, __ATOMIC_RELAXED);
+    } else if (entry->level != LOG_FILTER_LVL_ALL && level == LOG_FILTER_LVL_ALL) {
+        /* remove current tag's level filter when input level is the lowest level */
+        __atomic_sub_fetch(&g_log.filter.tag_lvl_num, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&entry->level, level, __ATOMIC_RELEASE);
+    log_filter_changed();
+
+__exit:
+    pthread_mutex_unlock(&tag_lvl_lock);
+}
+
+/**
+ * set the sampling of the tag, it replaces the level's sampling for the tag's logs
+ *
+ * example:
+ *     // output 1 in 100 logs of the net tag
+ *     log_set_sample_tag("net", 100);
+ *     // remove the net tag's sampling, the level's sampling is used again
+ *     log_set_sample_tag("net", 0);
+ *
+ * @param tag log tag
+ * @param rate 1 in rate logs is output, 1: all logs, 0: the level's sampling
+ */
+void log_set_sample_tag(const char* tag, uint32_t rate) {
+    LOG_CHECK(tag == NULL, return;);
+    log_tag_lvl_filter_t* entry;
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    pthread_mutex_lock(&tag_lvl_lock);
+
+    if ((entry = log_tag_lvl_find(g_log.filter.tag_lvl, tag)) == NULL &&
+        (rate == 0 || (entry = log_tag_lvl_add(tag)) == NULL)) {
+        goto __exit;
+    }
+    if (entry->sample == 0 && rate != 0) {
+        __atomic_add_fetch(&g_log.filter.tag_sample_num, 1, __ATOMIC_RELAXED);
+    } else if (entry->sample != 0 && rate == 0) {
+        __atomic_sub_fetch(&g_log.filter.tag_sample_num, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&entry->sample, rate, __ATOMIC_RELAXED);
+
+__exit:
+    pthread_mutex_unlock(&tag_lvl_lock);
+}
+
+/**
+ * set the sampling of the level, e.g. keep the debug logs enabled at 1 in 1000 of their volume
+ *
+ * @param level level
+ * @param rate 1 in rate logs is output, 0 or 1: all logs
+ */
+void log_set_sample_lvl(uint8_t level, uint32_t rate) {
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+
+    __atomic_store_n(&g_log.filter.sample[level], rate, __ATOMIC_RELAXED);
+}
+
+/**
+ * set the trace id of this thread, the sampling of its logs is decided by the id instead of a
+ * random number. All the logs of a sampled trace are output, and a trace sampled at 1 in N is
+ * also sampled at every rate which divides N.
+ *
+ * @param id trace id, 0: no trace
+ */
+void log_set_trace_id(uint64_t id) { sample_trace = id; }
+
+/**
+ * get the level on tag's level filer
+ *
+ * @param tag tag
+ *
+ * @return It will return the lowest level when tag was not found.
+ *         Other level will return when tag was found.
+ */
+int log_get_filter_tag_lvl(const char* tag) {
+    LOG_CHECK(tag == NULL, return -1;);
+    log_tag_lvl_filter_t* entry;
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    /* no tag has level filter */
+    if (__atomic_load_n(&g_log.filter.tag_lvl_num, __ATOMIC_RELAXED) == 0) {
+        return LOG_FILTER_LVL_ALL;
+    }
+    /* find the tag in table */
+    entry = log_tag_lvl_find(__atomic_load_n(&g_log.filter.tag_lvl, __ATOMIC_ACQUIRE), tag);
+
+    return entry ? __atomic_load_n(&entry->level, __ATOMIC_ACQUIRE) : LOG_FILTER_LVL_ALL;
+}
+
+/* two digits of 0 to 99 */
+static const char digit_pairs[] = "0001020304050607080910111213141516171819"
+                                  "2021222324252627282930313233343536373839"
+                                  "4041424344454647484950515253545556575859"
+                                  "6061626364656667686970717273747576777879"
+                                  "8081828384858687888990919293949596979899";
+
+/**
+ * convert the unsigned integer backward from the end, two digits a step
+ *
+ * @param end buffer end
+ * @param value value
+ *
+ * @return first digit
+ */
+static inline char* log_u64_digits(char* end, uint64_t value) {
+    while (value >= 100) {
+        end -= 2;
+        memcpy(end, digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        end -= 2;
+        memcpy(end, digit_pairs + value * 2, 2);
+    } else {
+        *--end = '0' + value;
+    }
+
+    return end;
+}
+
+/**
+ * convert the unsigned integer without snprintf
+ *
+ * @param buf buffer, LOG_NUM_MAX_LEN
+ * @param value value
+ *
+ * @return length
+ */
+static size_t log_u64_str(char* buf, uint64_t value) {
+    char tmp[LOG_NUM_MAX_LEN];
+    char* p   = log_u64_digits(tmp + sizeof(tmp), value);
+    size_t len = tmp + sizeof(tmp) - p;
+
+    memcpy(buf, p, len);
+
+    return len;
+}
+
+/* convert the signed integer without snprintf */
+static size_t log_i64_str(char* buf, int64_t value) {
+    if (value < 0) {
+        buf[0] = '-';
+        return 1 + log_u64_str(buf + 1, -(uint64_t)value);
+    }
+
+    return log_u64_str(buf, value);
+}
+
+/* conversion spec of the fast formatter */
+typedef struct {
+    bool left;  /* '-' */
+    bool zero;  /* '0' */
+    bool plus;  /* '+' */
+    bool space; /* ' ' */
+    bool alt;   /* '#' */
+    int width;
+    int prec; /* -1: none */
+} log_vfmt_spec_t;
+
+/* formats which the fast formatter doesn't support, they go to vsnprintf directly */
+static const char* vfmt_slow[LOG_VFMT_SLOW_NUM];
+
+/* put the string, the length past the buffer is counted */
+static inline void log_vfmt_put(char* buf, size_t size, size_t* len, const char* str, size_t n) {
+    size_t i, cur = *len;
+
+    *len += n;
+    if (cur >= size) return;
+    n = n < size - cur ? n : size - cur;
+    /* the short pieces are copied without calling memcpy */
+    if (n <= 16) {
+        for (i = 0; i < n; i++) {
+            buf[cur + i] = str[i];
+        }
+    } else {
+        memcpy(buf + cur, str, n);
+    }
+}
+
+/* put the char n times */
+static inline void log_vfmt_fill(char* buf, size_t size, size_t* len, char ch, size_t n) {
+    if (n == 0) return;
+    if (*len < size) {
+        memset(buf + *len, ch, n < size - *len ? n : size - *len);
+    }
+    *len += n;
+}
+
+/* put the string padded to the width, the zero flag is not supported */
+static void log_vfmt_str(char* buf, size_t size, size_t* len, const log_vfmt_spec_t* spec,
+                         const char* str, size_t n) {
+    size_t pad = (size_t)spec->width > n ? spec->width - n : 0;
+
+    if (!spec->left) log_vfmt_fill(buf, size, len, ' ', pad);
+    log_vfmt_put(buf, size, len, str, n);
+    if (spec->left) log_vfmt_fill(buf, size, len, ' ', pad);
+}
+
+/**
+ * put the integer like printf: sign or prefix, precision zeros, zero flag and width padding
+ *
+ * @param buf output buffer
+ * @param size buffer size
+ * @param len output length
+ * @param spec conversion spec
+ * @param conv 'd', 'u', 'x', 'X' or 'o'
+ * @param value absolute value
+ * @param neg the signed value is negative
+ */
+static void log_vfmt_int(char* buf, size_t size, size_t* len, const log_vfmt_spec_t* spec,
+                         char conv, uint64_t value, bool neg) {
+    const char* hex = conv == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+    size_t n, zeros, total, pad, prefix = 0;
+    char tmp[LOG_NUM_MAX_LEN], sign = 0;
+    char* p = tmp + sizeof(tmp);
+
+    if (conv == 'x' || conv == 'X') {
+        prefix = spec->alt && value != 0 ? 2 : 0;
+        do {
+            *--p = hex[value & 0xF];
+        } while (value >>= 4);
+        n = tmp + sizeof(tmp) - p;
+    } else if (conv == 'o') {
+        do {
+            *--p = '0' + (value & 7);
+        } while (value >>= 3);
+        n = tmp + sizeof(tmp) - p;
+    } else {
+        p = log_u64_digits(p, value);
+        n = tmp + sizeof(tmp) - p;
+    }
+    /* zero precision with zero value has no digit */
+    if (spec->prec == 0 && n == 1 && p[0] == '0') {
+        n = 0;
+    }
+    zeros = spec->prec > 0 && (size_t)spec->prec > n ? spec->prec - n : 0;
+    /* the alternate octal form starts with zero */
+    if (conv == 'o' && spec->alt && zeros == 0 && (n == 0 || p[0] != '0')) {
+        zeros = 1;
+    }
+    if (conv == 'd') {
+        sign = neg ? '-' : spec->plus ? '+' : spec->space ? ' ' : 0;
+    }
+    total = (sign != 0) + prefix + zeros + n;
+    if (spec->zero && !spec->left && spec->prec < 0 && (size_t)spec->width > total) {
+        zeros += spec->width - total;
+        total = spec->width;
+    }
+    pad = (size_t)spec->width > total ? spec->width - total : 0;
+
+    if (!spec->left) log_vfmt_fill(buf, size, len, ' ', pad);
+    if (sign) log_vfmt_put(buf, size, len, &sign, 1);
+    if (prefix) log_vfmt_put(buf, size, len, conv == 'X' ? "0X" : "0x", 2);
+    log_vfmt_fill(buf, size, len, '0', zeros);
+    log_vfmt_put(buf, size, len, p, n);
+    if (spec->left) log_vfmt_fill(buf, size, len, ' ', pad);
+}
+
+/**
+ * printf compatible format of the common conversions: d i u x X o c s p with the flags, width,
+ * precision and length modifiers. The output is the same as vsnprintf's.
+ *
+ * @param buf output buffer
+ * @param size buffer size
+ * @param format format
+ * @param args args
+ *
+ * @return the length which would have been written, -1: the format has an unsupported conversion
+ */
+static int log_vfmt_fast(char* buf, size_t size, const char* format, va_list args) {
+    const char *p = format, *q, *str;
+    log_vfmt_spec_t spec;
+    size_t len = 0, n;
+    char length, ch;
+    uint64_t u;
+    int64_t i;
+
+    for (;;) {
+        if ((q = strchr(p, '%')) == NULL) {
+            log_vfmt_put(buf, size, &len, p, strlen(p));
+            break;
+        }
+        log_vfmt_put(buf, size, &len, p, q - p);
+        p = q + 1;
+        if (*p == '%') {
+            log_vfmt_put(buf, size, &len, p++, 1);
+            continue;
+        }
+
+        spec = (log_vfmt_spec_t){.prec = -1};
+        for (;; p++) {
+            if (*p == '-') {
+                spec.left = true;
+            } else if (*p == '0') {
+                spec.zero = true;
+            } else if (*p == '+') {
+                spec.plus = true;
+            } else if (*p == ' ') {
+                spec.space = true;
+            } else if (*p == '#') {
+                spec.alt = true;
+            } else {
+                break;
+            }
+        }
+        if (*p == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < -LOG_VFMT_WIDTH_MAX) return -1;
+            if (spec.width < 0) {
+                spec.left  = true;
+                spec.width = -spec.width;
+            }
+            p++;
+        } else {
+            for (; *p >= '0' && *p <= '9' && spec.width <= LOG_VFMT_WIDTH_MAX; p++) {
+                spec.width = spec.width * 10 + *p - '0';
+            }
+            /* positional argument */
+            if (*p == '$') return -1;
+        }
+        if (*p == '.') {
+            if (*++p == '*') {
+                spec.prec = va_arg(args, int);
+                spec.prec = spec.prec < 0 ? -1 : spec.prec;
+                p++;
+            } else {
+                for (spec.prec = 0; *p >= '0' && *p <= '9' && spec.prec <= LOG_VFMT_WIDTH_MAX;
+                     p++) {
+                    spec.prec = spec.prec * 10 + *p - '0';
+                }
+            }
+        }
+        if (spec.width > LOG_VFMT_WIDTH_MAX || spec.prec > LOG_VFMT_WIDTH_MAX) return -1;
+        /* length modifier, 'H': hh 'L': ll */
+        length = 0;
+        if (*p == 'h' || *p == 'l') {
+            length = *p++;
+            if (*p == length) {
+                length = length == 'h' ? 'H' : 'L';
+                p++;
+            }
+        } else if (*p == 'z' || *p == 'j' || *p == 't') {
+            length = *p++;
+        }
+
+        switch (ch = *p++) {
+        case 'd':
+        case 'i':
+            switch (length) {
+            case 0:
+                i = va_arg(args, int);
+                break;
+            case 'h':
+                i = (short)va_arg(args, int);
+                break;
+            case 'H':
+                i = (signed char)va_arg(args, int);
+                break;
+            case 'l':
+                i = va_arg(args, long);
+                break;
+            case 'L':
+                i = va_arg(args, long long);
+                break;
+            case 'z':
+                i = va_arg(args, ssize_t);
+                break;
+            case 'j':
+                i = va_arg(args, intmax_t);
+                break;
+            default:
+                i = va_arg(args, ptrdiff_t);
+                break;
+            }
+            log_vfmt_int(buf, size, &len, &spec, 'd', i < 0 ? -(uint64_t)i : (uint64_t)i, i < 0);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            switch (length) {
+            case 0:
+                u = va_arg(args, unsigned int);
+                break;
+            case 'h':
+                u = (unsigned short)va_arg(args, unsigned int);
+                break;
+            case 'H':
+                u = (unsigned char)va_arg(args, unsigned int);
+                break;
+            case 'l':
+                u = va_arg(args, unsigned long);
+                break;
+            case 'L':
+                u = va_arg(args, unsigned long long);
+                break;
+            case 'z':
+                u = va_arg(args, size_t);
+                break;
+            case 'j':
+                u = va_arg(args, uintmax_t);
+                break;
+            default:
+                u = (size_t)va_arg(args, ptrdiff_t);
+                break;
+            }
+            log_vfmt_int(buf, size, &len, &spec, ch, u, false);
+            break;
+        case 'c':
+            if (length || spec.zero || spec.plus || spec.space || spec.alt || spec.prec >= 0) {
+                return -1;
+            }
+            ch = (char)va_arg(args, int);
+            log_vfmt_str(buf, size, &len, &spec, &ch, 1);
+            break;
+        case 's':
+            if (length || spec.zero || spec.plus || spec.space || spec.alt) return -1;
+            if ((str = va_arg(args, const char*)) == NULL) {
+                /* glibc prints nothing when the precision is too small for "(null)" */
+                str = spec.prec < 0 || spec.prec >= 6 ? "(null)" : "";
+                n   = strlen(str);
+            } else {
+                n = spec.prec < 0 ? strlen(str) : strnlen(str, spec.prec);
+            }
+            log_vfmt_str(buf, size, &len, &spec, str, n);
+            break;
+        case 'p':
+            if (length || spec.zero || spec.plus || spec.space || spec.alt || spec.prec >= 0) {
+                return -1;
+            }
+            if ((str = va_arg(args, const char*)) == NULL) {
+                log_vfmt_str(buf, size, &len, &spec, "(nil)", 5);
+            } else {
+                spec.alt = true;
+                log_vfmt_int(buf, size, &len, &spec, 'x', (uintptr_t)str, false);
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (len > INT_MAX) return -1;
+    if (size) {
+        buf[len < size ? len : size - 1] = '\0';
+    }
+
+    return len;
+}
+
+/**
+ * vsnprintf with the fast formatter. The format which it doesn't support is remembered by its
+ * address and goes to vsnprintf directly next time; a reused address only costs the fast path.
+ *
+ * @param buf output buffer
+ * @param size buffer size
+ * @param format format
+ * @param args args
+ *
+ * @return the length which would have been written like vsnprintf
+ */
+static int log_vsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    const char** slow = &vfmt_slow[((uintptr_t)format >> 3) % LOG_VFMT_SLOW_NUM];
+    va_list copy;
+    int result;
+
+    if (likely(__atomic_load_n(slow, __ATOMIC_RELAXED) != format)) {
+        va_copy(copy, args);
+        result = log_vfmt_fast(buf, size, format, copy);
+        va_end(copy);
+        if (likely(result >= 0)) {
+            return result;
+        }
+        __atomic_store_n(slow, format, __ATOMIC_RELAXED);
+    }
+
+    return vsnprintf(buf, size, format, args);
+}
+
+/**
+ * output RAW format log
+ *
+ * @param format output format
+ * @param ... args
+ */
+void log_raw(const char* format, ...) {
+    size_t log_len = 0, buf_size = LOG_LINE_BUF_SIZE;
+    char* buf      = log_buf;
+    log_line_t line;
+    va_list args;
+    int fmt_result;
+    LOG_READ_SCOPE();
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    /* check output enabled */
+    if (!g_log.output_enabled) {
+        return;
+    }
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+
+    /* package log data to buffer */
+    fmt_result = log_vsnprintf(log_buf, LOG_LINE_BUF_SIZE, format, args);
+    va_end(args);
+    /* the long log is formatted again in a larger buffer */
+    if (unlikely(fmt_result >= LOG_LINE_BUF_SIZE) &&
+        (buf = log_chunk_buf(&chunk_tls.line, fmt_result + 1, g_log.line_max, &buf_size)) != NULL) {
+        va_start(args, format);
+        log_vsnprintf(buf, buf_size, format, args);
+        va_end(args);
+    } else {
+        buf = log_buf;
+    }
+
+    /* output converted log, the truncated log doesn't include the '\0' added by vsnprintf */
+    if ((fmt_result > -1) && ((size_t)fmt_result < buf_size)) {
+        log_len = fmt_result;
+    } else {
+        log_len = buf_size - 1;
+        log_stats_truncated();
+    }
+    /* output log */
+    log_line_raw(&line, LOG_LVL_RAW, 0, log_len);
+    log_do_output(&line, NULL, buf, log_len);
+}
+
+/**
+ * package the log header prefix: color, level and tag info
+ *
+ * @param buf log buffer
+ * @param part line parts, the color, level and tag end are set
+ * @param level level
+ * @param tag tag
+ * @param tag_len tag length
+ *
+ * @return prefix length
+ */
+static size_t log_format_prefix(char* buf, uint16_t* part, uint8_t level, const char* tag,
+                                size_t tag_len) {
+    size_t log_len                                 = 0;
+    size_t set                                     = log_fmt_set(level);
+    char tag_sapce[LOG_FILTER_TAG_MAX_LEN / 2 + 1] = {0};
+
+    /* add CSI start sign and color info */
+    if (g_log.text_color_enabled) {
+        log_len += log_strncpy(log_len, buf + log_len, CSI_START, sizeof(CSI_START) - 1);
+        log_len += log_strncpy(log_len, buf + log_len, color_output_info[level],
+                               color_output_len[level]);
+    }
+    part[LOG_PART_COLOR] = log_len;
+
+    /* package level info */
+    if (set & LOG_FMT_LVL) {
+        log_len += log_strncpy(log_len, buf + log_len, level_output_info[level], LEVEL_OUTPUT_LEN);
+    }
+    part[LOG_PART_LVL] = log_len;
+    /* package tag info */
+    if (set & LOG_FMT_TAG) {
+        log_len += log_strncpy(log_len, buf + log_len, tag, tag_len);
+        /* if the tag length is less than 50% LOG_FILTER_TAG_MAX_LEN, then fill space */
+        if (tag_len <= LOG_FILTER_TAG_MAX_LEN / 2) {
+            memset(tag_sapce, ' ', LOG_FILTER_TAG_MAX_LEN / 2 - tag_len);
+            log_len += log_strncpy(log_len, buf + log_len, tag_sapce,
+                                   LOG_FILTER_TAG_MAX_LEN / 2 - tag_len);
+        }
+        log_len += log_strncpy(log_len, buf + log_len, " ", 1);
+    }
+    part[LOG_PART_TAG] = log_len;
+
+    return log_len;
+}
+
+#ifdef LOG_FMT_FIXED
+/**
+ * package the log header info with the constant format set: time, process and thread info
+ *
+ * @param set format set
+ * @param buf log buffer
+ * @param cur_len current log length, the buffer is limited by it
+ * @param time time info, NULL: get current time from port
+ * @param p_info process info, NULL: get from port
+ * @param t_info thread info, NULL: get from port
+ *
+ * @return info length
+ */
+static inline __attribute__((always_inline)) size_t log_format_info_set(
+    size_t set, char* buf, size_t cur_len, const char* time, const char* p_info,
+    const char* t_info) {
+    size_t log_len  = cur_len;
+    size_t time_len = 0;
+
+    if (set & (LOG_FMT_TIME | LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
+        log_len += log_strcpy(log_len, buf + log_len, "[");
+        /* package time info */
+        if (set & LOG_FMT_TIME) {
+            if (time == NULL) {
+                time = log_port_get_time(&time_len);
+            } else {
+                time_len = strlen(time);
+            }
+            log_len += log_strncpy(log_len, buf + log_len, time, time_len);
+            if (set & (LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
+                log_len += log_strcpy(log_len, buf + log_len, " ");
+            }
+        }
+        /* package process info */
+        if (set & LOG_FMT_P_INFO) {
+            log_len += log_strcpy(log_len, buf + log_len, p_info ? p_info : log_port_get_p_info());
+            if (set & LOG_FMT_T_INFO) {
+                log_len += log_strcpy(log_len, buf + log_len, " ");
+            }
+        }
+        /* package thread info */
+        if (set & LOG_FMT_T_INFO) {
+            log_len += log_strcpy(log_len, buf + log_len, t_info ? t_info : log_port_get_t_info());
+        }
+        log_len += log_strcpy(log_len, buf + log_len, "] ");
+    }
+
+    return log_len - cur_len;
+}
+
+/**
+ * package the log header location with the constant format set: file, line and function info
+ *
+ * @param set format set
+ * @param buf log buffer
+ * @param cur_len current log length, the buffer is limited by it
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ *
+ * @return location length
+ */
+static inline __attribute__((always_inline)) size_t log_format_loc_set(
+    size_t set, char* buf, size_t cur_len, const char* file, const char* func, long line) {
+    size_t log_len                          = cur_len;
+    char line_num[LOG_NUM_MAX_LEN];
+    size_t line_len;
+
+    if (set & (LOG_FMT_DIR | LOG_FMT_FUNC | LOG_FMT_LINE)) {
+        log_len += log_strcpy(log_len, buf + log_len, "(");
+        /* package file info */
+        if (set & LOG_FMT_DIR) {
+            log_len += log_strcpy(log_len, buf + log_len, file);
+            if (set & LOG_FMT_FUNC) {
+                log_len += log_strcpy(log_len, buf + log_len, ":");
+            } else if (set & LOG_FMT_LINE) {
+                log_len += log_strcpy(log_len, buf + log_len, " ");
+            }
+        }
+        /* package line info */
+        if (set & LOG_FMT_LINE) {
+            line_len = log_i64_str(line_num, line);
+            /* cut like the former snprintf with LOG_LINE_NUM_MAX_LEN */
+            line_num[line_len < LOG_LINE_NUM_MAX_LEN ? line_len : LOG_LINE_NUM_MAX_LEN - 1] = '\0';
+            log_len += log_strcpy(log_len, buf + log_len, line_num);
+            if (set & LOG_FMT_FUNC) {
+                log_len += log_strcpy(log_len, buf + log_len, " ");
+            }
+        }
+        /* package func info */
+        if (set & LOG_FMT_FUNC) {
+            log_len += log_strcpy(log_len, buf + log_len, func);
+        }
+        log_len += log_strcpy(log_len, buf + log_len, ")");
+    }
+
+    return log_len - cur_len;
+}
+#else
+/* values of the header segments */
+typedef struct {
+    const char* time; /* NULL: get current time from port */
+    const char* p_info;
+    const char* t_info;
+    const char* file;
+    const char* func;
+    long line;
+} log_seg_val_t;
+
+/**
+ * package the header segments of the format plan
+ *
+ * @param buf log buffer
+ * @param cur_len current log length, the buffer is limited by it
+ * @param seg segments, ended by LOG_SEG_END
+ * @param val segment values
+ *
+ * @return segments length
+ */
+static size_t log_format_segs(char* buf, size_t cur_len, const log_seg_t* seg,
+                              const log_seg_val_t* val) {
+    char line_num[LOG_NUM_MAX_LEN];
+    size_t log_len = cur_len, len = 0;
+    const char* str;
+
+    for (; seg->op != LOG_SEG_END; seg++) {
+        switch (seg->op) {
+        case LOG_SEG_LIT:
+            str = seg->lit;
+            len = seg->len;
+            break;
+        case LOG_SEG_TIME:
+            if ((str = val->time) == NULL) {
+                str = log_port_get_time(&len);
+            } else {
+                len = strlen(str);
+            }
+            break;
+        case LOG_SEG_P_INFO:
+            str = val->p_info ? val->p_info : log_port_get_p_info();
+            len = strlen(str);
+            break;
+        case LOG_SEG_T_INFO:
+            str = val->t_info ? val->t_info : log_port_get_t_info();
+            len = strlen(str);
+            break;
+        case LOG_SEG_DIR:
+            str = val->file;
+            len = strlen(str);
+            break;
+        case LOG_SEG_LINE:
+            len = log_i64_str(line_num, val->line);
+            len = len < LOG_LINE_NUM_MAX_LEN ? len : LOG_LINE_NUM_MAX_LEN - 1;
+            str = line_num;
+            break;
+        default:
+            str = val->func;
+            len = strlen(str);
+            break;
+        }
+        log_len += log_strncpy(log_len, buf + log_len, str, len);
+    }
+
+    return log_len - cur_len;
+}
+#endif
+
+/**
+ * package the log header info: time, process and thread info
+ *
+ * @param buf log buffer
+ * @param cur_len current log length, the buffer is limited by it
+ * @param level level
+ * @param time time info, NULL: get current time from port
+ * @param p_info process info, NULL: get from port
+ * @param t_info thread info, NULL: get from port
+ *
+ * @return info length
+ */
+static size_t log_format_info(char* buf, size_t cur_len, uint8_t level, const char* time,
+                              const char* p_info, const char* t_info) {
+#ifdef LOG_FMT_FIXED
+    switch (level) {
+    case LOG_LVL_ASSERT:
+        return log_format_info_set(LOG_FMT_SET_ASSERT, buf, cur_len, time, p_info, t_info);
+    case LOG_LVL_ERROR:
+        return log_format_info_set(LOG_FMT_SET_ERROR, buf, cur_len, time, p_info, t_info);
+    case LOG_LVL_WARN:
+        return log_format_info_set(LOG_FMT_SET_WARN, buf, cur_len, time, p_info, t_info);
+    case LOG_LVL_INFO:
+        return log_format_info_set(LOG_FMT_SET_INFO, buf, cur_len, time, p_info, t_info);
+    case LOG_LVL_DEBUG:
+        return log_format_info_set(LOG_FMT_SET_DEBUG, buf, cur_len, time, p_info, t_info);
+    default:
+        return log_format_info_set(LOG_FMT_SET_VERBOSE, buf, cur_len, time, p_info, t_info);
+    }
+#else
+    log_seg_val_t val = {.time = time, .p_info = p_info, .t_info = t_info};
+
+    return log_format_segs(buf, cur_len, log_fmt_plan()->lvl[level].info, &val);
+#endif
+}
+
+/**
+ * package the log header location: file directory and name, line number and function info
+ *
+ * @param buf log buffer
+ * @param cur_len current log length, the buffer is limited by it
+ * @param level level
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ *
+ * @return location length
+ */
+static size_t log_format_loc(char* buf, size_t cur_len, uint8_t level, const char* file,
+                             const char* func, long line) {
+#ifdef LOG_FMT_FIXED
+    switch (level) {
+    case LOG_LVL_ASSERT:
+        return log_format_loc_set(LOG_FMT_SET_ASSERT, buf, cur_len, file, func, line);
+    case LOG_LVL_ERROR:
+        return log_format_loc_set(LOG_FMT_SET_ERROR, buf, cur_len, file, func, line);
+    case LOG_LVL_WARN:
+        return log_format_loc_set(LOG_FMT_SET_WARN, buf, cur_len, file, func, line);
+    case LOG_LVL_INFO:
+        return log_format_loc_set(LOG_FMT_SET_INFO, buf, cur_len, file, func, line);
+    case LOG_LVL_DEBUG:
+        return log_format_loc_set(LOG_FMT_SET_DEBUG, buf, cur_len, file, func, line);
+    default:
+        return log_format_loc_set(LOG_FMT_SET_VERBOSE, buf, cur_len, file, func, line);
+    }
+#else
+    log_seg_val_t val = {.file = file, .func = func, .line = line};
+
+    return log_format_segs(buf, cur_len, log_fmt_plan()->lvl[level].loc, &val);
+#endif
+}
+
+/**
+ * package the log header: color, level, tag, time, process, thread, file, line and function info
+ *
+ * @param buf log buffer
+ * @param part line parts, the header parts are set
+ * @param level level
+ * @param tag tag
+ * @param tag_len tag length
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param time time info, NULL: get current time from port
+ * @param p_info process info, NULL: get from port
+ * @param t_info thread info, NULL: get from port
+ *
+ * @return header length
+ */
+static size_t log_format_header(char* buf, uint16_t* part, uint8_t level, const char* tag,
+                                size_t tag_len, const char* file, const char* func, long line,
+                                const char* time, const char* p_info, const char* t_info) {
+    size_t log_len = log_format_prefix(buf, part, level, tag, tag_len);
+
+    log_len += log_format_info(buf, log_len, level, time, p_info, t_info);
+    part[LOG_PART_INFO] = log_len;
+    log_len += log_format_loc(buf, log_len, level, file, func, line);
+    part[LOG_PART_LOC] = log_len;
+
+    return log_len;
+}
+
+/**
+ * format the message again when the line doesn't fit in the line buffer, the header is copied to
+ * the chunk of this thread
+ *
+ * @param head_len header length in the line buffer
+ * @param fmt_result message length returned by the first vsnprintf
+ * @param buf_size log buffer size
+ * @param format output format
+ * @param args args
+ *
+ * @return log buffer, it is the line buffer when the line fits or no larger buffer is got
+ */
+static char* log_format_long(size_t head_len, int fmt_result, size_t* buf_size, const char* format,
+                             va_list args) {
+    size_t size = head_len + fmt_result + (sizeof(CSI_END) - 1) + (sizeof(LOG_NEWLINE_SIGN) - 1);
+    char* buf;
+
+    *buf_size = LOG_LINE_BUF_SIZE;
+    if (likely(fmt_result < 0 || size <= LOG_LINE_BUF_SIZE) ||
+        (buf = log_chunk_buf(&chunk_tls.line, size, g_log.line_max, buf_size)) == NULL) {
+        return log_buf;
+    }
+    memcpy(buf, log_buf, head_len);
+    log_vsnprintf(buf + head_len, *buf_size - head_len, format, args);
+
+    return buf;
+}
+
+/**
+ * package the log tail after the message: keyword filter, CSI end sign and newline sign
+ *
+ * @param buf log buffer
+ * @param buf_size log buffer size
+ * @param part line parts, the message and tail parts are set
+ * @param log_len header length
+ * @param fmt_result message length returned by vsnprintf
+ * @param kw_flags keyword filter result found before formatting
+ *
+ * @return log length, 0 when the log is filtered by keyword
+ */
+static size_t log_format_tail(char* buf, size_t buf_size, uint16_t* part, size_t log_len,
+                              int fmt_result, uint8_t kw_flags) {
+    log_kw_list_t* list = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE);
+    size_t newline_len  = strlen(LOG_NEWLINE_SIGN);
+    int i;
+
+    /* calculate log length */
+    if ((log_len + fmt_result <= buf_size) && (fmt_result > -1)) {
+        log_len += fmt_result;
+    } else {
+        /* using max length */
+        log_len = buf_size;
+    }
+    /* overflow check and reserve some space for CSI end sign and newline sign */
+    if (log_len + (sizeof(CSI_END) - 1) + newline_len > buf_size) {
+        /* using max length */
+        log_len = buf_size;
+        /* reserve some space for CSI end sign */
+        log_len -= (sizeof(CSI_END) - 1);
+        /* reserve some space for newline sign */
+        log_len -= newline_len;
+        log_stats_truncated();
+    }
+    /* keyword filter */
+    if (list) {
+        kw_flags = log_kw_search(list, buf, log_len, false, kw_flags);
+        if (!log_kw_pass(list, kw_flags)) {
+            return 0;
+        }
+    }
+    /* the header may be cut by the reserved space */
+    for (i = 0; i < LOG_PART_MSG; i++) {
+        if (part[i] > log_len) part[i] = log_len;
+    }
+    part[LOG_PART_MSG] = log_len;
+
+    /* add CSI end sign, the space is reserved above */
+    if (g_log.text_color_enabled) {
+        memcpy(buf + log_len, CSI_END, sizeof(CSI_END) - 1);
+        log_len += sizeof(CSI_END) - 1;
+    }
+    part[LOG_PART_CSI_END] = log_len;
+
+    /* package newline sign */
+    memcpy(buf + log_len, LOG_NEWLINE_SIGN, newline_len);
+    log_len += newline_len;
+    part[LOG_PART_NEWLINE] = log_len;
+
+    return log_len;
+}
+
+/**
+ * check the output enabled, level filter and tag filter
+ *
+ * @param level level
+ * @param tag tag
+ *
+ * @return true: the log passes the filters
+ */
+static bool log_filter_pass(uint8_t level, const char* tag) {
+    /* check output enabled */
+    if (!g_log.output_enabled) {
+        return false;
+    }
+    /* level filter */
+    if (level > g_log.filter.level || level > log_get_filter_tag_lvl(tag)) {
+        return false;
+    } else if (!strstr(tag, g_log.filter.tag)) { /* tag filter */
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * check the sampling of the log before formatting, the tag's rate replaces the level's one
+ *
+ * @param level level
+ * @param tag tag
+ *
+ * @return true: the log is sampled to output
+ */
+static bool log_sample_pass(uint8_t level, const char* tag) {
+    uint32_t rate = __atomic_load_n(&g_log.filter.sample[level], __ATOMIC_RELAXED), tag_rate;
+    log_tag_lvl_filter_t* entry;
+    uint64_t r;
+
+    if (unlikely(__atomic_load_n(&g_log.filter.tag_sample_num, __ATOMIC_RELAXED)) &&
+        (entry = log_tag_lvl_find(__atomic_load_n(&g_log.filter.tag_lvl, __ATOMIC_ACQUIRE),
+                                  tag)) != NULL &&
+        (tag_rate = __atomic_load_n(&entry->sample, __ATOMIC_RELAXED)) != 0) {
+        rate = tag_rate;
+    }
+    if (likely(rate <= 1)) {
+        return true;
+    }
+
+    if (sample_trace) {
+        /* the same trace always has the same decision */
+        r = sample_trace * 0x9E3779B97F4A7C15ULL;
+        r ^= r >> 32;
+    } else {
+        if (unlikely(sample_seed == 0)) {
+            sample_seed = (log_stats_now() ^ (uintptr_t)&sample_seed) | 1;
+        }
+        sample_seed ^= sample_seed << 13;
+        sample_seed ^= sample_seed >> 7;
+        sample_seed ^= sample_seed << 17;
+        r = sample_seed;
+    }
+
+    return r % rate == 0;
+}
+
+/**
+ * check the filters of the binary log site, the result is cached until the filter generation
+ * changes. The keyword filter is done when the binary log is formatted.
+ *
+ * @param state site cached filter state
+ * @param level level
+ * @param tag tag
+ *
+ * @return true: the log passes the filters
+ */
+static bool log_site_pass(uint32_t* state, uint8_t level, const char* tag) {
+    uint32_t gen = __atomic_load_n(&log_filter_gen, __ATOMIC_ACQUIRE) << 2;
+    uint32_t cur = __atomic_load_n(state, __ATOMIC_RELAXED);
+    bool pass;
+
+    if ((cur & ~3u) == gen) {
+        return cur & LOG_SITE_ENABLED;
+    }
+    pass = log_filter_pass(level, tag);
+    __atomic_store_n(state, gen | (pass ? LOG_SITE_ENABLED : 0), __ATOMIC_RELAXED);
+
+    return pass;
+}
+
+/* rate limit and repeat state of the call sites */
+static log_limit_t limit_sites[LOG_LIMIT_SITE_NUM];
+/* next check time of the ended bursts (ns) */
+static uint64_t limit_check_next;
+
+/* FNV-1a hash of the message, it is continued from the last result */
+static uint64_t log_limit_hash(uint64_t hash, const void* data, size_t len) {
+    const uint8_t* p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* find or add the slot of the call site, NULL: no free slot near its hash */
+static log_limit_t* log_limit_slot(uint8_t level, const char* tag, const char* file,
+                                   const char* func, long line) {
+    uint64_t hash = ((uintptr_t)file ^ (uint64_t)line) * 0x9E3779B97F4A7C15ULL;
+    log_limit_t* slot;
+    uint32_t state;
+    size_t n;
+
+    hash ^= hash >> 32;
+    for (n = 0; n < LOG_LIMIT_PROBE_NUM; n++, hash++) {
+        slot  = &limit_sites[hash % LOG_LIMIT_SITE_NUM];
+        state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state == 0 && __atomic_compare_exchange_n(&slot->state, &state, 1, false,
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            slot->level = level;
+            strncpy(slot->tag, tag, LOG_LIMIT_TAG_MAX_LEN);
+            slot->file = file;
+            slot->func = func;
+            slot->line = line;
+            __atomic_store_n(&slot->state, 2, __ATOMIC_RELEASE);
+            return slot;
+        }
+        /* another thread is setting it */
+        while (state == 1) {
+            sched_yield();
+            state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        }
+        if (slot->file == file && slot->line == line) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * output the suppressed count of the call site. It is encoded in its own buffer, so the line
+ * being formatted in the log buffer is kept.
+ *
+ * @param limit slot of the call site
+ * @param msg report message
+ * @param count suppressed lines
+ */
+static void log_limit_report(const log_limit_t* limit, const char* msg, uint64_t count) {
+    log_kv_t kv = LOG_KV_UINT("count", count);
+    char buf[LOG_LINE_BUF_SIZE], *p = buf;
+    log_line_t out;
+    size_t len;
+    LOG_READ_SCOPE();
+
+    if ((len = log_kv_line(&p, sizeof(buf), &out, limit->level, limit->tag, limit->file,
+                           limit->func, limit->line, msg, strlen(msg), &kv, 1, 0)) == 0) {
+        return;
+    }
+    out.level = limit->level;
+    log_do_write(&out, limit->tag, buf, len);
+}
+
+/**
+ * check the rate limit of the call site before formatting. The token bucket is kept as the
+ * theoretical arrival time of the next line (GCRA), so a passed line costs one CAS and a dropped
+ * one an atomic add. The count dropped before is reported when a line passes again.
+ *
+ * @param limit slot of the call site, NULL: not limited
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ *
+ * @return true: the line passes
+ */
+static bool log_limit_pass(log_limit_t** limit, uint8_t level, const char* tag, const char* file,
+                           const char* func, long line) {
+    uint64_t interval = __atomic_load_n(&g_log.limit_interval, __ATOMIC_RELAXED);
+    uint64_t burst, now, tat, next, count;
+    log_limit_t* slot;
+
+    *limit = NULL;
+    if (likely(interval == 0 && __atomic_load_n(&g_log.dedup_window, __ATOMIC_RELAXED) == 0)) {
+        return true;
+    }
+    if ((slot = log_limit_slot(level, tag, file, func, line)) == NULL) {
+        return true;
+    }
+    *limit = slot;
+    if (interval == 0) {
+        return true;
+    }
+
+    burst = __atomic_load_n(&g_log.limit_burst, __ATOMIC_RELAXED) * interval;
+    now   = log_stats_now();
+    tat   = __atomic_load_n(&slot->tat, __ATOMIC_RELAXED);
+    do {
+        next = (tat > now ? tat : now) + interval;
+        if (next - now > burst) {
+            __atomic_add_fetch(&slot->suppressed, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->suppress_time, now, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&slot->tat, &tat, next, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    if (unlikely(__atomic_load_n(&slot->suppressed, __ATOMIC_RELAXED)) &&
+        (count = __atomic_exchange_n(&slot->suppressed, 0, __ATOMIC_RELAXED)) != 0) {
+        log_limit_report(slot, "lines dropped by the rate limit", count);
+    }
+
+    return true;
+}
+
+/**
+ * check whether the formatted message repeats the last one of the call site, the repeat count is
+ * reported when another message is output
+ *
+ * @param limit slot of the call site
+ * @param hash message hash
+ *
+ * @return true: the line repeats the last message and is dropped
+ */
+static bool log_limit_repeat(log_limit_t* limit, uint64_t hash) {
+    uint64_t window = __atomic_load_n(&g_log.dedup_window, __ATOMIC_RELAXED), now, count;
+
+    if (window == 0) {
+        return false;
+    }
+    now = log_stats_now();
+    if (__atomic_load_n(&limit->hash, __ATOMIC_RELAXED) == hash &&
+        now - __atomic_load_n(&limit->emit_time, __ATOMIC_RELAXED) < window) {
+        __atomic_add_fetch(&limit->repeated, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&limit->repeat_time, now, __ATOMIC_RELAXED);
+        return true;
+    }
+    __atomic_store_n(&limit->hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&limit->emit_time, now, __ATOMIC_RELAXED);
+
+    if (unlikely(__atomic_load_n(&limit->repeated, __ATOMIC_RELAXED)) &&
+        (count = __atomic_exchange_n(&limit->repeated, 0, __ATOMIC_RELAXED)) != 0) {
+        log_limit_report(limit, "last message repeated", count);
+    }
+
+    return false;
+}
+
+/**
+ * report the counts of the call sites whose burst ended, it is checked once a second
+ *
+ * @param all true: report all the counts now
+ */
+static void log_limit_check(bool all) {
+    uint64_t window = __atomic_load_n(&g_log.dedup_window, __ATOMIC_RELAXED), now, next, count;
+    log_limit_t* slot;
+    size_t i;
+
+    if (likely(!all && window == 0 &&
+               __atomic_load_n(&g_log.limit_interval, __ATOMIC_RELAXED) == 0)) {
+        return;
+    }
+    now  = log_stats_now();
+    next = __atomic_load_n(&limit_check_next, __ATOMIC_RELAXED);
+    if (!all && (now < next || !__atomic_compare_exchange_n(
+                                   &limit_check_next, &next, now + LOG_LIMIT_REPORT_MS * 1000000ULL,
+                                   false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))) {
+        return;
+    }
+
+    for (i = 0; i < LOG_LIMIT_SITE_NUM; i++) {
+        slot = &limit_sites[i];
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != 2) continue;
+        if (__atomic_load_n(&slot->suppressed, __ATOMIC_RELAXED) &&
+            (all || now - __atomic_load_n(&slot->suppress_time, __ATOMIC_RELAXED) >=
+                        LOG_LIMIT_REPORT_MS * 1000000ULL) &&
+            (count = __atomic_exchange_n(&slot->suppressed, 0, __ATOMIC_RELAXED)) != 0) {
+            log_limit_report(slot, "lines dropped by the rate limit", count);
+        }
+        if (__atomic_load_n(&slot->repeated, __ATOMIC_RELAXED) &&
+            (all || now - __atomic_load_n(&slot->repeat_time, __ATOMIC_RELAXED) >= window) &&
+            (count = __atomic_exchange_n(&slot->repeated, 0, __ATOMIC_RELAXED)) != 0) {
+            log_limit_report(slot, "last message repeated", count);
+        }
+    }
+}
+
+/**
+ * output the log
+ *
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param format output format
+ * @param ... args
+ *
+ */
+void log_output(uint8_t level, const char* tag, const char* file, const char* func, const long line,
+                const char* format, ...) {
+    size_t log_len = 0, buf_size;
+    log_limit_t* limit;
+    log_kw_list_t* list;
+    uint8_t kw_flags = 0;
+    log_line_t out;
+    va_list args;
+    int fmt_result;
+    char* buf;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    if (!log_filter_pass(level, tag) || !log_sample_pass(level, tag)) {
+        goto __filtered;
+    }
+    /* keyword filter on the format string before formatting */
+    if ((list = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE)) != NULL) {
+        kw_flags = log_kw_search_format(list, format, 0);
+        if (kw_flags & LOG_KW_EXCLUDE) {
+            goto __filtered;
+        }
+    }
+    if (!log_limit_pass(&limit, level, tag, file, func, line)) {
+        goto __filtered;
+    }
+    if (unlikely(g_log.encoding != LOG_ENC_TEXT)) {
+        va_start(args, format);
+        log_kv_voutput(level, tag, file, func, line, NULL, 0, kw_flags, limit, format, args);
+        va_end(args);
+        return;
+    }
+
+    log_len = log_format_header(log_buf, out.part, level, tag, strlen(tag), file, func, line, NULL,
+                                NULL, NULL);
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    /* package other log data to buffer. '\0' must be added in the end by log_vsnprintf. */
+    fmt_result = log_vsnprintf(log_buf + log_len, LOG_LINE_BUF_SIZE - log_len, format, args);
+    va_end(args);
+    /* the long line is formatted again in a larger buffer */
+    va_start(args, format);
+    buf = log_format_long(log_len, fmt_result, &buf_size, format, args);
+    va_end(args);
+
+    if ((log_len = log_format_tail(buf, buf_size, out.part, log_len, fmt_result, kw_flags)) == 0) {
+        goto __filtered;
+    }
+    if (limit && log_limit_repeat(limit, log_limit_hash(LOG_LIMIT_HASH_INIT,
+                                                        buf + out.part[LOG_PART_LOC],
+                                                        out.part[LOG_PART_MSG] -
+                                                            out.part[LOG_PART_LOC]))) {
+        goto __filtered;
+    }
+
+    /* output log */
+    out.level = level;
+    log_do_output(&out, tag, buf, log_len);
+    return;
+
+__filtered:
+    log_stats_line(level, tag, false);
+}
+
+/**
+ * get the pre-rendered header of the log site, it is rendered on the first output and again after
+ * a format set is changed
+ *
+ * @param site log site
+ *
+ * @return pre-rendered header, NULL: out of memory
+ */
+static log_site_head_t* log_site_head(log_site_t* site) {
+    log_site_head_t *head, *cur = __atomic_load_n(&site->head, __ATOMIC_ACQUIRE);
+    uint32_t gen = log_fmt_gen();
+    uint16_t part[LOG_PART_MAX];
+    size_t prefix_len, loc_len;
+
+    if (likely(cur != NULL && cur->gen == gen)) {
+        return cur;
+    }
+
+    /* render in the log buffer, it is overwritten by the log later */
+    prefix_len = log_format_prefix(log_buf, part, site->level, site->tag, strlen(site->tag));
+    loc_len    = log_format_loc(log_buf, prefix_len, site->level, site->file, site->func,
+                                site->line);
+    if ((head = malloc(sizeof(log_site_head_t) + prefix_len + loc_len)) == NULL) {
+        return NULL;
+    }
+    memcpy(head->part, part, sizeof(head->part));
+    head->gen     = gen;
+    head->loc_len = loc_len;
+    memcpy(head->buf, log_buf, prefix_len + loc_len);
+
+    /* another thread may render it at the same time, the stale header is retired */
+    if (__atomic_compare_exchange_n(&site->head, &cur, head, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+        if (cur) log_retire(cur);
+    } else {
+        free(head);
+        head = cur;
+    }
+
+    return head;
+}
+
+/**
+ * check the filters of the log site, the result is cached until the filter generation changes.
+ * The keywords are searched in the pre-rendered header, a site whose header has an exclude
+ * keyword is disabled.
+ *
+ * @param site log site
+ *
+ * @return LOG_SITE_ENABLED and LOG_SITE_KW_INCLUDE flags
+ */
+static uint8_t log_site_filter(log_site_t* site) {
+    uint32_t gen = __atomic_load_n(&log_filter_gen, __ATOMIC_ACQUIRE) << 2;
+    uint32_t cur = __atomic_load_n(&site->filter_state, __ATOMIC_RELAXED);
+    log_kw_list_t* list;
+    log_site_head_t* head;
+    uint8_t flags = 0, kw_flags;
+
+    if ((cur & ~3u) == gen) {
+        return cur & 3;
+    }
+    if (log_filter_pass(site->level, site->tag)) {
+        flags = LOG_SITE_ENABLED;
+        list  = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE);
+        if (list && (head = log_site_head(site)) != NULL) {
+            kw_flags =
+                log_kw_search(list, head->buf, head->part[LOG_PART_TAG] + head->loc_len, false, 0);
+            if (kw_flags & LOG_KW_EXCLUDE) {
+                flags = 0;
+            } else if (kw_flags & LOG_KW_INCLUDE) {
+                flags |= LOG_SITE_KW_INCLUDE;
+            }
+        }
+    }
+    __atomic_store_n(&site->filter_state, gen | flags, __ATOMIC_RELAXED);
+
+    return flags;
+}
+
+/**
+ * output the log of the log site
+ *
+ * @param site log site
+ * @param format output format
+ * @param ... args
+ *
+ */
+void log_site_output(log_site_t* site, const char* format, ...) {
+    size_t log_len = 0, buf_size;
+    log_site_head_t* head;
+    log_limit_t* limit;
+    log_kw_list_t* list;
+    uint8_t flags, kw_flags = 0;
+    log_line_t line;
+    va_list args;
+    int fmt_result;
+    char* buf;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(site->level > LOG_LVL_VERBOSE, return;);
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    if (!((flags = log_site_filter(site)) & LOG_SITE_ENABLED) ||
+        !log_sample_pass(site->level, site->tag)) {
+        goto __filtered;
+    }
+    /* keyword filter on the format string before formatting */
+    if ((list = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE)) != NULL) {
+        kw_flags = log_kw_search_format(list, format,
+                                        (flags & LOG_SITE_KW_INCLUDE) ? LOG_KW_INCLUDE : 0);
+        if (kw_flags & LOG_KW_EXCLUDE) {
+            goto __filtered;
+        }
+    }
+    if (!log_limit_pass(&limit, site->level, site->tag, site->file, site->func, site->line)) {
+        goto __filtered;
+    }
+    if (unlikely(g_log.encoding != LOG_ENC_TEXT)) {
+        va_start(args, format);
+        log_kv_voutput(site->level, site->tag, site->file, site->func, site->line, NULL, 0,
+                       kw_flags, limit, format, args);
+        va_end(args);
+        return;
+    }
+
+    if ((head = log_site_head(site)) != NULL) {
+        memcpy(line.part, head->part, sizeof(head->part));
+        log_len = log_strncpy(log_len, log_buf, head->buf, head->part[LOG_PART_TAG]);
+        log_len += log_format_info(log_buf, log_len, site->level, NULL, NULL, NULL);
+        line.part[LOG_PART_INFO] = log_len;
+        log_len += log_strncpy(log_len, log_buf + log_len, head->buf + head->part[LOG_PART_TAG],
+                               head->loc_len);
+        line.part[LOG_PART_LOC] = log_len;
+    } else {
+        log_len = log_format_header(log_buf, line.part, site->level, site->tag, strlen(site->tag),
+                                    site->file, site->func, site->line, NULL, NULL, NULL);
+    }
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    /* package other log data to buffer. '\0' must be added in the end by log_vsnprintf. */
+    fmt_result = log_vsnprintf(log_buf + log_len, LOG_LINE_BUF_SIZE - log_len, format, args);
+    va_end(args);
+    /* the long line is formatted again in a larger buffer */
+    va_start(args, format);
+    buf = log_format_long(log_len, fmt_result, &buf_size, format, args);
+    va_end(args);
+
+    if ((log_len = log_format_tail(buf, buf_size, line.part, log_len, fmt_result, kw_flags)) == 0) {
+        goto __filtered;
+    }
+    if (limit && log_limit_repeat(limit, log_limit_hash(LOG_LIMIT_HASH_INIT,
+                                                        buf + line.part[LOG_PART_LOC],
+                                                        line.part[LOG_PART_MSG] -
+                                                            line.part[LOG_PART_LOC]))) {
+        goto __filtered;
+    }
+
+    /* output log */
+    line.level = site->level;
+    log_do_output(&line, site->tag, buf, log_len);
+    return;
+
+__filtered:
+    log_stats_line(site->level, site->tag, false);
+}
+
+/* reserved tail space of the encoded line: closing quote and brace, CSI end sign and newline */
+#define LOG_ENC_TAIL_LEN (2 + (sizeof(CSI_END) - 1) + (sizeof(LOG_NEWLINE_SIGN) - 1))
+/* number max length */
+#define LOG_ENC_NUM_MAX_LEN 32
+
+/*
+ * bounded line encoder. A token which doesn't fit is not written and the rest of the line is cut.
+ * The needed length is counted past the end, so the line can be encoded again in a larger buffer.
+ */
+typedef struct {
+    char* buf;
+    size_t len;  /* written length */
+    size_t end;  /* writable end, the tail space is reserved after it */
+    size_t need; /* length without the end */
+    bool cut;    /* the line is cut */
+    uint8_t enc; /* LOG_ENC */
+    size_t num;  /* written fields */
+} log_enc_t;
+
+/* structured level names */
+static const char* level_enc_info[] = {
+    [LOG_LVL_ASSERT] = "assert", [LOG_LVL_ERROR] = "error", [LOG_LVL_WARN] = "warn",
+    [LOG_LVL_INFO] = "info",     [LOG_LVL_DEBUG] = "debug", [LOG_LVL_VERBOSE] = "verbose",
+};
+
+/* escape sign of the char in string, 0: no escape 'u': \u00XX */
+static const char enc_escape[256] = {
+    [0x00 ... 0x07] = 'u', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0B] = 'u', ['\f'] = 'f',
+    ['\r'] = 'r',          [0x0E ... 0x1F] = 'u',     ['"'] = '"',  ['\\'] = '\\', [0x7F] = 'u',
+};
+
+/* string of this thread which holds the formatted message */
+static __thread char enc_buf[LOG_LINE_BUF_SIZE];
+
+/* put the token, it is written whole or not at all */
+static void log_enc_put(log_enc_t* e, const char* str, size_t len) {
+    e->need += len;
+    if (e->cut || e->len + len > e->end) {
+        e->cut = true;
+        return;
+    }
+    memcpy(e->buf + e->len, str, len);
+    e->len += len;
+}
+
+/* put the data, the part which fits is written */
+static void log_enc_put_part(log_enc_t* e, const char* str, size_t len) {
+    size_t n = len;
+
+    e->need += len;
+    if (e->cut) return;
+    if (e->len + n > e->end) {
+        n      = e->len < e->end ? e->end - e->len : 0;
+        e->cut = true;
+    }
+    memcpy(e->buf + e->len, str, n);
+    e->len += n;
+}
+
+/**
+ * convert the double without snprintf, it has 6 fraction digits at most. The values from 1e-3 to
+ * 1e15 are fixed-point, others are in scientific notation.
+ *
+ * @param buf buffer, LOG_ENC_NUM_MAX_LEN
+ * @param value value
+ * @param json true: NaN and infinity are null
+ *
+ * @return length
+ */
+static size_t log_enc_double(char* buf, double value, bool json) {
+    size_t len = 0, frac_len;
+    uint64_t ip, frac;
+    int exp = 0, i;
+
+    if (__builtin_isnan(value) || (json && __builtin_isinf(value))) {
+        memcpy(buf, json ? "null" : "NaN", json ? 4 : 3);
+        return json ? 4 : 3;
+    }
+    if (value < 0) {
+        buf[len++] = '-';
+        value      = -value;
+    }
+    if (__builtin_isinf(value)) {
+        memcpy(buf + len, "Inf", 3);
+        return len + 3;
+    }
+    if (value != 0 && (value < 1e-3 || value >= 1e15)) {
+        for (; value >= 10; exp++) {
+            value /= 10;
+        }
+        for (; value < 1; exp--) {
+            value *= 10;
+        }
+    }
+    ip   = (uint64_t)value;
+    frac = (uint64_t)((value - ip) * 1e6 + 0.5);
+    if (frac >= 1000000) {
+        ip++;
+        frac -= 1000000;
+    }
+    /* the rounded mantissa may be 10 */
+    if (exp != 0 && ip >= 10) {
+        ip /= 10;
+        exp++;
+    }
+    len += log_u64_str(buf + len, ip);
+    /* fraction without the trailing zeros */
+    if (frac != 0) {
+        buf[len] = '.';
+        for (i = 6; i > 0; i--, frac /= 10) {
+            buf[len + i] = '0' + frac % 10;
+        }
+        for (frac_len = 6; buf[len + frac_len] == '0'; frac_len--) {
+        }
+        len += frac_len + 1;
+    }
+    if (exp != 0) {
+        buf[len++] = 'e';
+        len += log_i64_str(buf + len, exp);
+    }
+
+    return len;
+}
+
+/**
+ * put the string, it is quoted and escaped for JSON. The logfmt string is only quoted when it is
+ * empty or has a space, '=', '"' or a control char. The cut string is still closed.
+ *
+ * @param e encoder
+ * @param str string
+ * @param len string length
+ */
+static void log_enc_str(log_enc_t* e, const char* str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    bool quote = e->enc == LOG_ENC_JSON || len == 0, open;
+    size_t i, start;
+    char esc[6];
+
+    for (i = 0; i < len && !quote; i++) {
+        quote = enc_escape[(uint8_t)str[i]] || str[i] == ' ' || str[i] == '=';
+    }
+    if (quote) {
+        log_enc_put(e, "\"", 1);
+    }
+    open = quote && !e->cut;
+    for (i = start = 0; i < len; i++) {
+        if (likely(!enc_escape[(uint8_t)str[i]])) continue;
+        log_enc_put_part(e, str + start, i - start);
+        esc[0] = '\\';
+        esc[1] = enc_escape[(uint8_t)str[i]];
+        if (esc[1] == 'u') {
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[(uint8_t)str[i] >> 4];
+            esc[5] = hex[str[i] & 0xF];
+        }
+        log_enc_put(e, esc, esc[1] == 'u' ? 6 : 2);
+        start = i + 1;
+    }
+    log_enc_put_part(e, str + start, len - start);
+    /* the closing quote has the reserved space */
+    if (quote) {
+        e->need++;
+        if (open) e->buf[e->len++] = '"';
+    }
+}
+
+/* put the field key and separator */
+static void log_enc_key(log_enc_t* e, const char* key) {
+    if (e->enc == LOG_ENC_JSON) {
+        if (e->num++) log_enc_put(e, ",", 1);
+        log_enc_str(e, key, strlen(key));
+        log_enc_put(e, ":", 1);
+    } else {
+        if (e->num++) log_enc_put(e, " ", 1);
+        log_enc_put(e, key, strlen(key));
+        log_enc_put(e, "=", 1);
+    }
+}
+
+/**
+ * put the string field, the field which doesn't fit is removed
+ *
+ * @param e encoder
+ * @param key key
+ * @param str string
+ * @param len string length
+ * @param part true: the string can be cut
+ */
+static void log_enc_field_str(log_enc_t* e, const char* key, const char* str, size_t len,
+                              bool part) {
+    size_t mark = e->len;
+    bool cut    = e->cut;
+
+    log_enc_key(e, key);
+    if (e->cut && !cut) {
+        part = false;
+    }
+    log_enc_str(e, str, len);
+    if (e->cut && !cut && !part) {
+        e->len = mark;
+    }
+}
+
+/* put the field, the field which doesn't fit is removed */
+static void log_enc_field(log_enc_t* e, const log_kv_t* kv) {
+    char num[LOG_ENC_NUM_MAX_LEN];
+    size_t mark = e->len, len;
+    bool cut    = e->cut;
+
+    if (kv->type == LOG_KV_TYPE_STR && kv->val.s != NULL) {
+        log_enc_field_str(e, kv->key, kv->val.s, strlen(kv->val.s), false);
+        return;
+    }
+    switch (kv->type) {
+    case LOG_KV_TYPE_INT:
+        len = log_i64_str(num, kv->val.i);
+        break;
+    case LOG_KV_TYPE_UINT:
+        len = log_u64_str(num, kv->val.u);
+        break;
+    case LOG_KV_TYPE_DOUBLE:
+        len = log_enc_double(num, kv->val.d, e->enc == LOG_ENC_JSON);
+        break;
+    case LOG_KV_TYPE_BOOL:
+        len = kv->val.b ? 4 : 5;
+        memcpy(num, kv->val.b ? "true" : "false", len);
+        break;
+    default:
+        len = 4;
+        memcpy(num, "null", len);
+        break;
+    }
+    log_enc_key(e, kv->key);
+    log_enc_put(e, num, len);
+    if (e->cut && !cut) {
+        e->len = mark;
+    }
+}
+
+/**
+ * encode the structured line, the text line only has the message and fields after the header
+ *
+ * @param e encoder
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param time time info
+ * @param time_len time info length
+ * @param msg message
+ * @param msg_len message length
+ * @param kv fields
+ * @param kv_num fields count
+ */
+static void log_kv_encode(log_enc_t* e, uint8_t level, const char* tag, const char* file,
+                          const char* func, long line, const char* time, size_t time_len,
+                          const char* msg, size_t msg_len, const log_kv_t* kv, size_t kv_num) {
+    size_t set = log_fmt_set(level), i;
+    const char* info;
+
+    if (e->enc == LOG_ENC_TEXT) {
+        log_enc_put_part(e, msg, msg_len);
+        /* the fields are separated from the message */
+        e->num = 1;
+    } else {
+        if (e->enc == LOG_ENC_JSON) {
+            log_enc_put(e, "{", 1);
+        }
+        if (set & LOG_FMT_TIME) {
+            log_enc_field_str(e, "time", time, time_len, false);
+        }
+        if (set & LOG_FMT_LVL) {
+            log_enc_field_str(e, "level", level_enc_info[level], strlen(level_enc_info[level]),
+                              false);
+        }
+        if (set & LOG_FMT_TAG) {
+            log_enc_field_str(e, "tag", tag, strlen(tag), false);
+        }
+        if (set & LOG_FMT_P_INFO) {
+            info = log_port_get_p_info();
+            log_enc_field_str(e, "process", info, strlen(info), false);
+        }
+        if (set & LOG_FMT_T_INFO) {
+            info = log_port_get_t_info();
+            log_enc_field_str(e, "thread", info, strlen(info), false);
+        }
+        if (set & LOG_FMT_DIR) {
+            log_enc_field_str(e, "file", file, strlen(file), false);
+        }
+        if (set & LOG_FMT_LINE) {
+            log_enc_field(e, &(log_kv_t){.key = "line", .type = LOG_KV_TYPE_INT, .val.i = line});
+        }
+        if (set & LOG_FMT_FUNC) {
+            log_enc_field_str(e, "func", func, strlen(func), false);
+        }
+        log_enc_field_str(e, "msg", msg, msg_len, true);
+    }
+    for (i = 0; i < kv_num; i++) {
+        log_enc_field(e, &kv[i]);
+    }
+}
+
+/**
+ * format the message of the structured line
+ *
+ * @param format output format
+ * @param args args
+ * @param len message length
+ *
+ * @return message
+ */
+static const char* log_kv_msg(const char* format, va_list args, size_t* len) {
+    size_t size = LOG_LINE_BUF_SIZE;
+    const char* msg;
+    va_list copy;
+    char* buf;
+    int result;
+
+    va_copy(copy, args);
+    result = log_vsnprintf(enc_buf, LOG_LINE_BUF_SIZE, format, args);
+    msg    = enc_buf;
+    /* the long message is formatted again in a larger buffer */
+    if (unlikely(result >= LOG_LINE_BUF_SIZE) &&
+        (buf = log_chunk_buf(&chunk_tls.enc, result + 1, g_log.line_max, &size)) != NULL) {
+        log_vsnprintf(buf, size, format, copy);
+        msg = buf;
+    }
+    va_end(copy);
+    *len = result < 0 ? 0 : (size_t)result < size ? (size_t)result : size - 1;
+
+    return msg;
+}
+
+/**
+ * encode the structured line, the line which doesn't fit in the log buffer is encoded again in a
+ * larger buffer
+ *
+ * @param buf line buffer, it is replaced when the log buffer is too small
+ * @param buf_size line buffer size
+ * @param out line info
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param msg message
+ * @param msg_len message length
+ * @param kv fields
+ * @param kv_num fields count
+ * @param kw_flags keyword filter result found before formatting
+ *
+ * @return line length, 0: filtered by the keyword
+ */
+static size_t log_kv_line(char** buf, size_t buf_size, log_line_t* out, uint8_t level,
+                          const char* tag, const char* file, const char* func, long line,
+                          const char* msg, size_t msg_len, const log_kv_t* kv, size_t kv_num,
+                          uint8_t kw_flags) {
+    log_kw_list_t* list = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE);
+    size_t time_len = 0, head_len = 0, log_len;
+    uint8_t enc      = g_log.encoding;
+    const char* time = NULL;
+    char *cur = *buf, *big;
+    log_enc_t e;
+
+    if (enc == LOG_ENC_TEXT) {
+        head_len = log_format_header(cur, out->part, level, tag, strlen(tag), file, func, line,
+                                     NULL, NULL, NULL);
+    } else if (log_fmt_set(level) & LOG_FMT_TIME) {
+        time = log_port_get_time(&time_len);
+    }
+
+    for (;;) {
+        e = (log_enc_t){.buf = cur, .len = head_len, .end = buf_size - LOG_ENC_TAIL_LEN,
+                        .need = head_len, .enc = enc};
+        log_kv_encode(&e, level, tag, file, func, line, time, time_len, msg, msg_len, kv, kv_num);
+        if (!e.cut || cur != log_buf ||
+            (big = log_chunk_buf(&chunk_tls.line, e.need + LOG_ENC_TAIL_LEN, g_log.line_max,
+                                 &buf_size)) == NULL) {
+            break;
+        }
+        memcpy(big, log_buf, head_len);
+        cur = big;
+    }
+    if (e.cut) {
+        log_stats_truncated();
+    }
+    *buf = cur;
+
+    if (enc == LOG_ENC_TEXT) {
+        return log_format_tail(cur, buf_size, out->part, head_len, e.len - head_len, kw_flags);
+    }
+    if (enc == LOG_ENC_JSON) {
+        cur[e.len++] = '}';
+    }
+    memcpy(cur + e.len, LOG_NEWLINE_SIGN, sizeof(LOG_NEWLINE_SIGN) - 1);
+    log_len = e.len + sizeof(LOG_NEWLINE_SIGN) - 1;
+    if (list && !log_kw_pass(list, log_kw_search(list, cur, log_len, false, kw_flags))) {
+        return 0;
+    }
+    /* the structured line has no part to remove */
+    log_line_raw(out, level, 0, log_len);
+
+    return log_len;
+}
+
+/**
+ * output the structured log, the line is encoded by the current encoding
+ *
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param kv fields
+ * @param kv_num fields count
+ * @param kw_flags keyword filter result found before formatting
+ * @param limit rate limit slot of the call site, NULL: not limited
+ * @param format output format
+ * @param args args
+ */
+static void log_kv_voutput(uint8_t level, const char* tag, const char* file, const char* func,
+                           long line, const log_kv_t* kv, size_t kv_num, uint8_t kw_flags,
+                           log_limit_t* limit, const char* format, va_list args) {
+    size_t msg_len, log_len, i;
+    char* buf = log_buf;
+    const char* msg;
+    log_line_t out;
+    uint64_t hash;
+
+    msg = log_kv_msg(format, args, &msg_len);
+    if (limit) {
+        hash = log_limit_hash(LOG_LIMIT_HASH_INIT, msg, msg_len);
+        for (i = 0; i < kv_num; i++) {
+            hash = log_limit_hash(hash, kv[i].key, strlen(kv[i].key));
+            hash = kv[i].type == LOG_KV_TYPE_STR && kv[i].val.s
+                       ? log_limit_hash(hash, kv[i].val.s, strlen(kv[i].val.s))
+                       : log_limit_hash(hash, &kv[i].val,
+                                        kv[i].type == LOG_KV_TYPE_BOOL ? sizeof(bool) : 8);
+        }
+        if (log_limit_repeat(limit, hash)) {
+            goto __filtered;
+        }
+    }
+
+    if ((log_len = log_kv_line(&buf, LOG_LINE_BUF_SIZE, &out, level, tag, file, func, line, msg,
+                               msg_len, kv, kv_num, kw_flags)) == 0) {
+        goto __filtered;
+    }
+
+    out.level = level;
+    log_do_output(&out, tag, buf, log_len);
+    return;
+
+__filtered:
+    log_stats_line(level, tag, false);
+}
+
+/**
+ * output the log with structured fields
+ *
+ * @param level level
+ * @param tag tag
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param kv fields, the string values must be valid until the call returns
+ * @param kv_num fields count
+ * @param format message format
+ * @param ... args
+ */
+void log_kv_output(uint8_t level, const char* tag, const char* file, const char* func,
+                   const long line, const log_kv_t* kv, size_t kv_num, const char* format, ...) {
+    log_limit_t* limit;
+    log_kw_list_t* list;
+    uint8_t kw_flags = 0;
+    va_list args;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(kv == NULL && kv_num > 0, return;);
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    if (!log_filter_pass(level, tag) || !log_sample_pass(level, tag)) {
+        goto __filtered;
+    }
+    /* keyword filter on the format string before formatting */
+    if ((list = __atomic_load_n(&g_log.filter.kw, __ATOMIC_ACQUIRE)) != NULL) {
+        kw_flags = log_kw_search_format(list, format, 0);
+        if (kw_flags & LOG_KW_EXCLUDE) {
+            goto __filtered;
+        }
+    }
+
+    if (!log_limit_pass(&limit, level, tag, file, func, line)) {
+        goto __filtered;
+    }
+
+    va_start(args, format);
+    log_kv_voutput(level, tag, file, func, line, kv, kv_num, kw_flags, limit, format, args);
+    va_end(args);
+    return;
+
+__filtered:
+    log_stats_line(level, tag, false);
+}
+
+/* binary log record kind */
+#define LOG_BIN_REC_HEAD 'H' /* file head, written on every open */
+#define LOG_BIN_REC_SITE 'S' /* call site strings, written once per file */
+#define LOG_BIN_REC_LOG 'L'  /* log time, thread and arguments */
+/* binary log record common head: kind and record length */
+#define LOG_BIN_REC_HEAD_LEN 3
+/* binary log file magic and version */
+#define LOG_BIN_MAGIC "LOGB"
+#define LOG_BIN_VERSION 1
+/* binary log site string max length */
+#define LOG_BIN_STR_MAX_LEN 8192
+
+/*
+ * Binary log record, the numbers are stored in host byte order, so the binary file must be
+ * decoded on the same architecture. The string arguments point into the encoded buffer.
+ */
+typedef struct {
+    uint64_t site; /* site pointer in the async ring, site id in the binary file */
+    int64_t sec;
+    uint32_t nsec;
+    uint32_t pid;
+    uint64_t tid;
+    uint8_t argc;
+    log_bin_arg_t args[LOG_BIN_ARGS_MAX];
+} log_bin_rec_t;
+
+/* last assigned site id */
+static uint32_t log_bin_site_id;
+/* cached process id, getpid is a syscall */
+static uint32_t log_bin_pid;
+
+static void log_bin_atfork_child(void) { log_bin_pid = getpid(); }
+
+static void log_bin_init(void) {
+    log_bin_pid = getpid();
+    pthread_atfork(NULL, NULL, log_bin_atfork_child);
+}
+
+#define LOG_BIN_PUT(buf, len, val)                  \
+    do {                                            \
+        memcpy((buf) + (len), &(val), sizeof(val)); \
+        (len) += sizeof(val);                       \
+    } while (0)
+
+#define LOG_BIN_GET(buf, len, pos, val)                \
+    do {                                               \
+        if ((pos) + sizeof(val) > (len)) return false; \
+        memcpy(&(val), (buf) + (pos), sizeof(val));    \
+        (pos) += sizeof(val);                          \
+    } while (0)
+
+/**
+ * encode the binary log record
+ *
+ * @param buf record buffer
+ * @param size buffer size, the string arguments are truncated to fit it
+ * @param rec record
+ *
+ * @return record length
+ */
+static size_t log_bin_encode(char* buf, size_t size, const log_bin_rec_t* rec) {
+    size_t len = LOG_BIN_REC_HEAD_LEN, avail;
+    uint16_t str_len, rec_len;
+    uint8_t i;
+
+    buf[0] = LOG_BIN_REC_LOG;
+    LOG_BIN_PUT(buf, len, rec->site);
+    LOG_BIN_PUT(buf, len, rec->sec);
+    LOG_BIN_PUT(buf, len, rec->nsec);
+    LOG_BIN_PUT(buf, len, rec->pid);
+    LOG_BIN_PUT(buf, len, rec->tid);
+    LOG_BIN_PUT(buf, len, rec->argc);
+
+    for (i = 0; i < rec->argc; i++) {
+        buf[len++] = rec->args[i].type;
+        if (rec->args[i].type != LOG_BIN_ARG_STR) {
+            LOG_BIN_PUT(buf, len, rec->args[i].v.u);
+            continue;
+        }
+        /* string is copied with its '\0', 0 length means NULL */
+        str_len = 0;
+        if (rec->args[i].v.s) {
+            /* keep space for the type and value of the rest arguments */
+            avail   = size - len - sizeof(str_len) - (rec->argc - i - 1) * (1 + sizeof(uint64_t));
+            str_len = strnlen(rec->args[i].v.s, avail - 1) + 1;
+        }
+        LOG_BIN_PUT(buf, len, str_len);
+        if (str_len) {
+            memcpy(buf + len, rec->args[i].v.s, str_len - 1);
+            buf[len + str_len - 1] = '\0';
+            len += str_len;
+        }
+    }
+    rec_len = len;
+    memcpy(buf + 1, &rec_len, sizeof(rec_len));
+
+    return len;
+}
+
+/**
+ * decode the binary log record
+ *
+ * @param buf record buffer
+ * @param len record length
+ * @param rec decoded record
+ *
+ * @return false when the record is broken
+ */
+static bool log_bin_decode_rec(const char* buf, size_t len, log_bin_rec_t* rec) {
+    size_t pos = LOG_BIN_REC_HEAD_LEN;
+    uint16_t str_len;
+    uint8_t i;
+
+    LOG_BIN_GET(buf, len, pos, rec->site);
+    LOG_BIN_GET(buf, len, pos, rec->sec);
+    LOG_BIN_GET(buf, len, pos, rec->nsec);
+    LOG_BIN_GET(buf, len, pos, rec->pid);
+    LOG_BIN_GET(buf, len, pos, rec->tid);
+    LOG_BIN_GET(buf, len, pos, rec->argc);
+    if (rec->argc > LOG_BIN_ARGS_MAX) return false;
+
+    for (i = 0; i < rec->argc; i++) {
+        LOG_BIN_GET(buf, len, pos, rec->args[i].type);
+        if (rec->args[i].type != LOG_BIN_ARG_STR) {
+            LOG_BIN_GET(buf, len, pos, rec->args[i].v.u);
+            continue;
+        }
+        LOG_BIN_GET(buf, len, pos, str_len);
+        rec->args[i].v.s = NULL;
+        if (str_len) {
+            if (pos + str_len > len || buf[pos + str_len - 1] != '\0') return false;
+            rec->args[i].v.s = buf + pos;
+            pos += str_len;
+        }
+    }
+
+    return true;
+}
+
+/* argument as integer bits */
+static uint64_t log_bin_arg_bits(const log_bin_arg_t* arg) {
+    if (arg->type == LOG_BIN_ARG_DOUBLE) return (uint64_t)(int64_t)arg->v.f;
+    if (arg->type == LOG_BIN_ARG_STR) return (uintptr_t)arg->v.s;
+    if (arg->type == LOG_BIN_ARG_PTR) return (uintptr_t)arg->v.p;
+
+    return arg->v.u;
+}
+
+/* argument as double */
+static double log_bin_arg_double_val(const log_bin_arg_t* arg) {
+    if (arg->type == LOG_BIN_ARG_DOUBLE) return arg->v.f;
+    if (arg->type == LOG_BIN_ARG_INT) return (double)arg->v.i;
+
+    return (double)log_bin_arg_bits(arg);
+}
+
+/**
+ * printf compatible format with the captured arguments.
+ * Every conversion is done by snprintf with the single argument, the length modifiers are applied
+ * to the 64-bit captured value.
+ *
+ * @param buf output buffer
+ * @param size buffer size
+ * @param format format
+ * @param args arguments
+ * @param argc argument count
+ *
+ * @return the length which would have been written like vsnprintf
+ */
+static int log_bin_vformat(char* buf, size_t size, const char* format, const log_bin_arg_t* args,
+                           uint8_t argc) {
+#define LOG_BIN_NEXT_ARG() (n < argc ? &args[n++] : &none)
+#define LOG_BIN_SPEC_MAX_LEN 32
+
+    static const log_bin_arg_t none = {LOG_BIN_ARG_INT, {.i = 0}};
+    char spec[LOG_BIN_SPEC_MAX_LEN + 4];
+    const char *p = format, *start;
+    size_t len = 0, spec_len;
+    uint64_t val;
+    uint8_t n = 0;
+    int bits, ret;
+    char conv;
+
+    while (*p) {
+        if (*p != '%' || p[1] == '%') {
+            if (len + 1 < size) buf[len] = *p;
+            len++;
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+        start    = p++;
+        spec[0]  = '%';
+        spec_len = 1;
+        /* flags */
+        while (*p && strchr("-+ #0'I", *p) && spec_len < LOG_BIN_SPEC_MAX_LEN) {
+            spec[spec_len++] = *p++;
+        }
+        /* width */
+        if (*p == '*') {
+            spec_len += snprintf(spec + spec_len, LOG_BIN_SPEC_MAX_LEN - spec_len, "%d",
+                                 (int)log_bin_arg_bits(LOG_BIN_NEXT_ARG()));
+            p++;
+        }
+        while (*p >= '0' && *p <= '9' && spec_len < LOG_BIN_SPEC_MAX_LEN) {
+            spec[spec_len++] = *p++;
+        }
+        /* precision */
+        if (*p == '.' && spec_len < LOG_BIN_SPEC_MAX_LEN) {
+            spec[spec_len++] = *p++;
+            if (*p == '*') {
+                spec_len += snprintf(spec + spec_len, LOG_BIN_SPEC_MAX_LEN - spec_len, "%d",
+                                     (int)log_bin_arg_bits(LOG_BIN_NEXT_ARG()));
+                p++;
+            }
+            while (*p >= '0' && *p <= '9' && spec_len < LOG_BIN_SPEC_MAX_LEN) {
+                spec[spec_len++] = *p++;
+            }
+        }
+        /* length modifier */
+        bits = 32;
+        if (p[0] == 'h' && p[1] == 'h') {
+            bits = 8;
+            p += 2;
+        } else if (*p == 'h') {
+            bits = 16;
+            p++;
+        } else if (*p && strchr("lLqjzZt", *p)) {
+            bits = 64;
+            if (*p++ == 'l' && *p == 'l') p++;
+        }
+
+        ret  = 0;
+        conv = *p ? *p++ : '\0';
+        switch (conv) {
+            case 'd':
+            case 'i':
+                val = log_bin_arg_bits(LOG_BIN_NEXT_ARG());
+                memcpy(spec + spec_len, "lld", 4);
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               bits == 8    ? (long long)(int8_t)val
+                               : bits == 16 ? (long long)(int16_t)val
+                               : bits == 32 ? (long long)(int32_t)val
+                                            : (long long)val);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                val = log_bin_arg_bits(LOG_BIN_NEXT_ARG());
+                if (bits < 64) val &= (1ULL << bits) - 1;
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = conv;
+                spec[spec_len]   = '\0';
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               (unsigned long long)val);
+                break;
+            case 'c':
+                memcpy(spec + spec_len, "c", 2);
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               (int)log_bin_arg_bits(LOG_BIN_NEXT_ARG()));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec[spec_len++] = conv;
+                spec[spec_len]   = '\0';
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               log_bin_arg_double_val(LOG_BIN_NEXT_ARG()));
+                break;
+            case 's': {
+                const log_bin_arg_t* arg = LOG_BIN_NEXT_ARG();
+                memcpy(spec + spec_len, "s", 2);
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               arg->type == LOG_BIN_ARG_STR && arg->v.s ? arg->v.s : "(null)");
+                break;
+            }
+            case 'p':
+                memcpy(spec + spec_len, "p", 2);
+                ret = snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, spec,
+                               (void*)(uintptr_t)log_bin_arg_bits(LOG_BIN_NEXT_ARG()));
+                break;
+            case 'n':
+                LOG_BIN_NEXT_ARG();
+                break;
+            default:
+                /* unsupported conversion, output it as it is */
+                for (; start < p; start++, len++) {
+                    if (len + 1 < size) buf[len] = *start;
+                }
+                break;
+        }
+        if (ret > 0) len += ret;
+    }
+    if (size) buf[len < size ? len : size - 1] = '\0';
+
+    return len;
+}
+
+/**
+ * format the binary log to the same text as log_output
+ *
+ * @param buf log buffer, LOG_LINE_BUF_SIZE
+ * @param part line parts
+ * @param site call site
+ * @param args arguments
+ * @param argc argument count
+ * @param time time info, NULL: get current time from port
+ * @param p_info process info, NULL: get from port
+ * @param t_info thread info, NULL: get from port
+ *
+ * @return log length, 0 when the log is filtered by keyword
+ */
+static size_t log_bin_format(char* buf, uint16_t* part, const log_bin_site_t* site,
+                             const log_bin_arg_t* args, uint8_t argc, const char* time,
+                             const char* p_info, const char* t_info) {
+    size_t log_len;
+    int fmt_result;
+
+    log_len    = log_format_header(buf, part, site->level, site->tag, strlen(site->tag), site->file,
+                                   site->func, site->line, time, p_info, t_info);
+    fmt_result =
+        log_bin_vformat(buf + log_len, LOG_LINE_BUF_SIZE - log_len, site->format, args, argc);
+
+    return log_format_tail(buf, LOG_LINE_BUF_SIZE, part, log_len, fmt_result, 0);
+}
+
+/* format the decoded binary log record with its own time, process and thread info */
+static size_t log_bin_format_rec(char* buf, uint16_t* part, const log_bin_site_t* site,
+                                 const log_bin_rec_t* rec, uint8_t clock, uint8_t precision) {
+    struct timespec ts = {.tv_sec = rec->sec, .tv_nsec = rec->nsec};
+    char time[LOG_TIME_MAX_LEN], p_info[10], t_info[10];
+
+    log_port_format_time(&ts, clock, precision, time);
+    snprintf(p_info, sizeof(p_info), "pid:%04d", (int)rec->pid);
+    snprintf(t_info, sizeof(t_info), "tid:%04ld", (long)rec->tid);
+
+    return log_bin_format(buf, part, site, rec->args, rec->argc, time, p_info, t_info);
+}
+
+/**
+ * format the binary log record queued in the async ring to text in place
+ *
+ * @param rec record buffer, LOG_LINE_BUF_SIZE
+ * @param len record length
+ * @param part line parts
+ *
+ * @return log length, 0 when the log is filtered or broken
+ */
+static size_t log_bin_async_format(char* rec, size_t len, uint16_t* part) {
+    const log_bin_site_t* site;
+    log_bin_rec_t bin_rec;
+    LOG_READ_SCOPE();
+
+    if (!log_bin_decode_rec(rec, len, &bin_rec)) return 0;
+
+    site = (const log_bin_site_t*)(uintptr_t)bin_rec.site;
+    len  = log_bin_format_rec(log_buf, part, site, &bin_rec, g_log.time_clock,
+                              g_log.time_precision);
+    memcpy(rec, log_buf, len);
+    log_stats_line(site->level, site->tag, len > 0);
+
+    return len;
+}
+
+/* write a binary file record with the common head */
+static void log_bin_file_put(uint8_t kind, const void* data, size_t size) {
+    uint16_t rec_len = LOG_BIN_REC_HEAD_LEN + size;
+
+    fputc(kind, g_log.bin_fp);
+    fwrite(&rec_len, sizeof(rec_len), 1, g_log.bin_fp);
+    fwrite(data, size, 1, g_log.bin_fp);
+}
+
+/* write the call site strings to binary file */
+static void log_bin_file_put_site(const log_bin_site_t* site) {
+    const char* strs[] = {site->tag, site->file, site->func, site->format};
+    char buf[sizeof(uint64_t) * 2 + 1 + (sizeof(uint16_t) + LOG_BIN_STR_MAX_LEN) * 4];
+    uint64_t id = site->id;
+    int64_t line = site->line;
+    uint16_t str_len;
+    size_t len = 0, i;
+
+    LOG_BIN_PUT(buf, len, id);
+    LOG_BIN_PUT(buf, len, site->level);
+    LOG_BIN_PUT(buf, len, line);
+    for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        str_len = strnlen(strs[i], LOG_BIN_STR_MAX_LEN - 1) + 1;
+        LOG_BIN_PUT(buf, len, str_len);
+        memcpy(buf + len, strs[i], str_len - 1);
+        buf[len + str_len - 1] = '\0';
+        len += str_len;
+    }
+    log_bin_file_put(LOG_BIN_REC_SITE, buf, len);
+}
+
+/**
+ * write the binary log record to binary file, the site strings are written before its first log
+ *
+ * @param site call site
+ * @param rec encoded record
+ * @param len record length
+ */
+static void log_bin_file_write(log_bin_site_t* site, const char* rec, size_t len) {
+    log_file_port_lock();
+
+    if (g_log.bin_fp == NULL) goto __exit;
+
+    if (site->file_gen != g_log.bin_gen) {
+        log_bin_file_put_site(site);
+        site->file_gen = g_log.bin_gen;
+    }
+    fwrite(rec, len, 1, g_log.bin_fp);
+
+    if (site->level <= g_log.file_flush_lvl) {
+        fflush(g_log.bin_fp);
+    }
+
+__exit:
+    log_file_port_unlock();
+}
+
+/**
+ * output the binary log.
+ * The record goes to the binary file when it is enabled, otherwise to the async output thread
+ * which formats it. In sync mode it is formatted immediately.
+ *
+ * @param site call site
+ * @param args arguments
+ * @param argc argument count
+ */
+void log_bin_output(log_bin_site_t* site, const log_bin_arg_t* args, uint8_t argc) {
+    log_limit_t* limit;
+    log_bin_rec_t rec;
+    struct timespec ts;
+    uint32_t id = 0, new_id;
+    log_line_t line;
+    size_t len;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(site->level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(argc > LOG_BIN_ARGS_MAX, return;);
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    /* the message is not formatted here, so only the rate limit applies, not the dedup */
+    if (!log_site_pass(&site->filter_state, site->level, site->tag) ||
+        !log_sample_pass(site->level, site->tag) ||
+        !log_limit_pass(&limit, site->level, site->tag, site->file, site->func, site->line)) {
+        log_stats_line(site->level, site->tag, false);
+        return;
+    }
+
+    if (g_log.bin_fp || __atomic_load_n(&g_log.async_enabled, __ATOMIC_RELAXED)) {
+        log_port_get_clock(g_log.time_clock, &ts);
+        rec.sec  = ts.tv_sec;
+        rec.nsec = ts.tv_nsec;
+        rec.pid  = log_bin_pid;
+        rec.tid  = (uint64_t)pthread_self();
+        rec.argc = argc;
+        memcpy(rec.args, args, argc * sizeof(log_bin_arg_t));
+
+        if (g_log.bin_fp) {
+            if (__atomic_load_n(&site->id, __ATOMIC_ACQUIRE) == 0) {
+                new_id = __atomic_add_fetch(&log_bin_site_id, 1, __ATOMIC_RELAXED);
+                __atomic_compare_exchange_n(&site->id, &id, new_id, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE);
+            }
+            rec.site = site->id;
+            len      = log_bin_encode(log_buf, LOG_LINE_BUF_SIZE, &rec);
+            log_bin_file_write(site, log_buf, len);
+            log_stats_line(site->level, site->tag, true);
+            return;
+        }
+
+        line.level = site->level;
+        if ((line.sinks = log_sink_match(site->level, site->tag)) == 0) {
+            log_stats_line(site->level, site->tag, false);
+            return;
+        }
+        rec.site = (uintptr_t)site;
+        len      = log_bin_encode(log_buf, LOG_LINE_BUF_SIZE, &rec);
+        if (log_async_output(LOG_ASYNC_BIN, &line, log_buf, len)) {
+            return;
+        }
+    }
+
+    /* format now */
+    if ((len = log_bin_format(log_buf, line.part, site, args, argc, NULL, NULL, NULL)) == 0) {
+        log_stats_line(site->level, site->tag, false);
+        return;
+    }
+    line.level = site->level;
+    log_do_output(&line, site->tag, log_buf, len);
+}
+
+/**
+ * set binary log file output enable or disable.
+ * When enabled, the binary logs are only written to this file, use log_bin_decode to read it.
+ *
+ * @param enabled TRUE: enable FALSE: disable
+ */
+void log_set_bin_file_output_enabled(bool enabled) {
+    char head[sizeof(LOG_BIN_MAGIC) - 1 + 3];
+
+    LOG_CHECK(g_log.bin_name == NULL, return );
+
+    if (!g_log.init_ok) {
+        log_init();
+    }
+
+    log_file_port_lock();
+
+    if (enabled && g_log.bin_fp == NULL) {
+        if ((g_log.bin_fp = fopen(g_log.bin_name, "ab")) != NULL) {
+            setvbuf(g_log.bin_fp, NULL, _IOFBF, LOG_FILE_BUF_SIZE);
+            /* the head describes how to format the following logs, the site ids restart from it */
+            memcpy(head, LOG_BIN_MAGIC, sizeof(LOG_BIN_MAGIC) - 1);
+            head[sizeof(LOG_BIN_MAGIC) - 1] = LOG_BIN_VERSION;
+            head[sizeof(LOG_BIN_MAGIC)]     = g_log.time_clock;
+            head[sizeof(LOG_BIN_MAGIC) + 1] = g_log.time_precision;
+            log_bin_file_put(LOG_BIN_REC_HEAD, head, sizeof(head));
+            g_log.bin_gen++;
+        }
+    } else if (!enabled && g_log.bin_fp != NULL) {
+        fclose(g_log.bin_fp);
+        g_log.bin_fp = NULL;
+    }
+
+    log_file_port_unlock();
+}
+
+/**
+ * set binary log file name
+ *
+ * @param name binary log file name
+ */
+void log_set_bin_file_name(const char* name) {
+    LOG_CHECK(name == NULL || strlen(name) == 0, return );
+    LOG_CHECK(g_log.bin_fp != NULL, return );
+
+    g_log.bin_name = (char*)name;
+}
+
+/**
+ * decode the binary log file to the same text as log_output.
+ * The text is formatted with the current format and color settings.
+ *
+ * @param name binary log file name
+ * @param out output stream
+ *
+ * @return 0: success -1: open failed or the file is broken
  */
-void log_raw(const char* format, ...) {
-    va_list args;
-    size_t log_len = 0;
+int log_bin_decode(const char* name, FILE* out) {
+    log_bin_site_t **sites = NULL, *site;
+    size_t sites_num = 0, i, pos;
+    char *rec = NULL, *site_rec;
+    uint8_t clock = LOG_TIME_CLOCK_REALTIME, precision = LOG_TIME_PREC_MS;
+    uint16_t rec_len, str_len, part[LOG_PART_MAX];
+    const char** strs[4];
+    log_bin_rec_t bin_rec;
+    uint64_t id;
+    int64_t line;
+    int kind, result = -1;
+    size_t len;
+    FILE* fp;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(name == NULL || out == NULL, return -1;);
+
+    if ((fp = fopen(name, "rb")) == NULL) return -1;
+    if ((rec = malloc(UINT16_MAX)) == NULL) goto __exit;
+
+    while ((kind = fgetc(fp)) != EOF) {
+        if (fread(&rec_len, sizeof(rec_len), 1, fp) != 1 || rec_len < LOG_BIN_REC_HEAD_LEN) {
+            goto __exit;
+        }
+        rec[0] = kind;
+        memcpy(rec + 1, &rec_len, sizeof(rec_len));
+        len = rec_len - LOG_BIN_REC_HEAD_LEN;
+        if (len && fread(rec + LOG_BIN_REC_HEAD_LEN, len, 1, fp) != 1) goto __exit;
+
+        if (kind == LOG_BIN_REC_HEAD) {
+            if (len < sizeof(LOG_BIN_MAGIC) + 2 ||
+                memcmp(rec + LOG_BIN_REC_HEAD_LEN, LOG_BIN_MAGIC, sizeof(LOG_BIN_MAGIC) - 1) ||
+                rec[LOG_BIN_REC_HEAD_LEN + sizeof(LOG_BIN_MAGIC) - 1] != LOG_BIN_VERSION) {
+                goto __exit;
+            }
+            clock     = rec[LOG_BIN_REC_HEAD_LEN + sizeof(LOG_BIN_MAGIC)];
+            precision = rec[LOG_BIN_REC_HEAD_LEN + sizeof(LOG_BIN_MAGIC) + 1];
+            if (clock >= LOG_TIME_CLOCK_MAX || precision >= LOG_TIME_PREC_MAX) goto __exit;
+            /* a new process appends to the file, its site ids restart */
+            for (i = 0; i < sites_num; i++) {
+                free(sites[i]);
+                sites[i] = NULL;
+            }
+        } else if (kind == LOG_BIN_REC_SITE) {
+            /* the site and its strings are kept in one block */
+            pos = LOG_BIN_REC_HEAD_LEN;
+            if ((site_rec = malloc(sizeof(log_bin_site_t) + rec_len)) == NULL) goto __exit;
+            memcpy(site_rec + sizeof(log_bin_site_t), rec, rec_len);
+            site    = (log_bin_site_t*)site_rec;
+            strs[0] = &site->tag;
+            strs[1] = &site->file;
+            strs[2] = &site->func;
+            strs[3] = &site->format;
+            if (pos + sizeof(id) + sizeof(site->level) + sizeof(line) > rec_len) {
+                free(site_rec);
+                goto __exit;
+            }
+            memcpy(&id, rec + pos, sizeof(id));
+            pos += sizeof(id);
+            memcpy(&site->level, rec + pos, sizeof(site->level));
+            pos += sizeof(site->level);
+            memcpy(&line, rec + pos, sizeof(line));
+            pos += sizeof(line);
+            site->line = line;
+            for (i = 0; i < 4; i++) {
+                if (pos + sizeof(str_len) > rec_len) break;
+                memcpy(&str_len, rec + pos, sizeof(str_len));
+                pos += sizeof(str_len);
+                if (str_len == 0 || pos + str_len > rec_len || rec[pos + str_len - 1] != '\0') {
+                    break;
+                }
+                *strs[i] = site_rec + sizeof(log_bin_site_t) + pos;
+                pos += str_len;
+            }
+            if (i < 4 || site->level > LOG_LVL_VERBOSE || id == 0 || id > UINT32_MAX) {
+                free(site_rec);
+                goto __exit;
+            }
+            if (id >= sites_num) {
+                log_bin_site_t** new_sites = realloc(sites, (id + 1) * 2 * sizeof(sites[0]));
+                if (new_sites == NULL) {
+                    free(site_rec);
+                    goto __exit;
+                }
+                memset(new_sites + sites_num, 0, ((id + 1) * 2 - sites_num) * sizeof(sites[0]));
+                sites     = new_sites;
+                sites_num = (id + 1) * 2;
+            }
+            free(sites[id]);
+            sites[id] = site;
+        } else if (kind == LOG_BIN_REC_LOG) {
+            if (!log_bin_decode_rec(rec, rec_len, &bin_rec) || bin_rec.site >= sites_num ||
+                sites[bin_rec.site] == NULL) {
+                goto __exit;
+            }
+            len = log_bin_format_rec(log_buf, part, sites[bin_rec.site], &bin_rec, clock,
+                                     precision);
+            if (len) {
+                fwrite(log_buf, len, 1, out);
+            }
+        } else {
+            goto __exit;
+        }
+    }
+    result = 0;
+
+__exit:
+    for (i = 0; i < sites_num; i++) {
+        free(sites[i]);
+    }
+    free(sites);
+    free(rec);
+    fclose(fp);
+
+    return result;
+}
+
+/**
+ * Set a hook function to EasyLogger assert. It will run when the expression is false.
+ *
+ * @param hook the hook function
+ */
+void log_assert_set_hook(void (*hook)(const char* expr, const char* func, size_t line)) {
+    log_assert_hook = hook;
+}
+
+/**
+ * find the log level
+ * @note make sure the log level is output on each format
+ *
+ * @param log log buffer
+ *
+ * @return log level, found failed will return -1
+ */
+int log_find_lvl(const char* log) {
+    LOG_CHECK(log == NULL, return -1;);
+    /* make sure the log level is output on each format */
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_ASSERT] & LOG_FMT_LVL) == 0, return -1;);
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_ERROR] & LOG_FMT_LVL) == 0, return -1;);
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_WARN] & LOG_FMT_LVL) == 0, return -1;);
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_INFO] & LOG_FMT_LVL) == 0, return -1;);
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_DEBUG] & LOG_FMT_LVL) == 0, return -1;);
+    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_VERBOSE] & LOG_FMT_LVL) == 0, return -1;);
+
+    uint8_t i;
+    size_t csi_start_len = strlen(CSI_START);
+    for (i = 0; i < LOG_LVL_MAX; i++) {
+        if (!strncmp(color_output_info[i], log + csi_start_len, strlen(color_output_info[i]))) {
+            return i;
+        }
+    }
+    /* found failed */
+    return -1;
+}
+
+/**
+ * find the log tag
+ * @note make sure the log tag is output on each format
+ * @note the tag don't have space in it
+ *
+ * @param log log buffer
+ * @param lvl log level, you can get it by @see log_find_lvl
+ * @param tag_len found tag length
+ *
+ * @return log tag, found failed will return NULL
+ */
+const char* log_find_tag(const char* log, uint8_t lvl, size_t* tag_len) {
+    const char *tag = NULL, *tag_end = NULL;
+
+    LOG_CHECK(log == NULL, return NULL;);
+    LOG_CHECK(tag_len == NULL, return NULL;);
+    LOG_CHECK(lvl >= LOG_LVL_MAX, return NULL;);
+    /* make sure the log tag is output on each format */
+    LOG_CHECK((g_log.enabled_fmt_set[lvl] & LOG_FMT_TAG) == 0, return NULL;);
+
+    tag = log + strlen(CSI_START) + strlen(color_output_info[lvl]) + strlen(level_output_info[lvl]);
+    /* find the first space after tag */
+    if ((tag_end = memchr(tag, ' ', LOG_FILTER_TAG_MAX_LEN)) != NULL) {
+        *tag_len = tag_end - tag;
+    } else {
+        tag = NULL;
+    }
+
+    return tag;
+}
+
+/* hexdump line prefix max length: level, "HEX" and name */
+#define LOG_HEXDUMP_PREFIX_MAX_LEN 128
+/* hexdump row max length: prefix, offsets, 255 hex with group spaces and chars, newline sign */
+#define LOG_HEXDUMP_ROW_MAX_LEN (LOG_HEXDUMP_PREFIX_MAX_LEN + 40 + 255 * 4 + 32 + 2 + 8)
+
+/* hex digit table */
+static const char hex_table[] = "0123456789ABCDEF";
+
+/**
+ * put the offset as hex, at least 4 digits
+ *
+ * @param buf buffer, at least sizeof(size_t) * 2 bytes
+ * @param offset offset
+ *
+ * @return length
+ */
+static size_t log_hexdump_offset(char* buf, size_t offset) {
+    size_t len = 4, i;
+
+    while (len < sizeof(size_t) * 2 && (offset >> (len * 4)) != 0) {
+        len++;
+    }
+    for (i = len; i > 0; i--, offset >>= 4) {
+        buf[i - 1] = hex_table[offset & 0xF];
+    }
+
+    return len;
+}
+
+/**
+ * render one hexdump row without line prefix and newline sign
+ *
+ * @param row row buffer, LOG_HEXDUMP_ROW_MAX_LEN
+ * @param width hex number for every line
+ * @param data row data
+ * @param size row data size, less than width on the last row
+ * @param offset offset of the row
+ *
+ * @return row length
+ */
+static size_t log_hexdump_row(char* row, uint8_t width, const uint8_t* data, size_t size,
+                              size_t offset) {
+#define __is_print(ch) ((unsigned int)((ch) - ' ') < 127u - ' ')
+
+    char* p = row;
+    size_t i;
+
+    p += log_hexdump_offset(p, offset);
+    *p++ = '-';
+    p += log_hexdump_offset(p, offset + width - 1);
+    *p++ = ':';
+    *p++ = ' ';
+    /* dump hex */
+    for (i = 0; i < width; i++) {
+        if (i < size) {
+            p[0] = hex_table[data[i] >> 4];
+            p[1] = hex_table[data[i] & 0xF];
+        } else {
+            p[0] = p[1] = ' ';
+        }
+        p[2] = ' ';
+        p += 3;
+        if ((i + 1) % 8 == 0) {
+            *p++ = ' ';
+        }
+    }
+    *p++ = ' ';
+    *p++ = ' ';
+    /* dump char for hex */
+    for (i = 0; i < size; i++) {
+        *p++ = __is_print(data[i]) ? data[i] : '.';
+    }
+
+    return p - row;
+}
+
+/**
+ * dump the hex format data to log, the rows are packaged to the log buffer as many as fit and
+ * output together
+ *
+ * @param level level
+ * @param tag tag, it will show on log header
+ * @param width hex number for every line, such as: 16, 32
+ * @param buf hex buffer
+ * @param size buffer size
+ * @param offset offset shown for the first byte, such as the base address
+ */
+void log_hexdump_ex(uint8_t level, const char* tag, uint8_t width, const void* buf, size_t size,
+                    size_t offset) {
+    const uint8_t* data = buf;
+    size_t newline_len  = strlen(LOG_NEWLINE_SIGN);
+    size_t log_len = 0, prefix_len, row_len, i, n;
+    char prefix[LOG_HEXDUMP_PREFIX_MAX_LEN];
+    char row[LOG_HEXDUMP_ROW_MAX_LEN];
+    log_line_t line;
+    uint32_t sinks;
     int fmt_result;
+    bool sync;
+    LOG_READ_SCOPE();
+
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(width == 0, return;);
 
     if (!g_log.init_ok) {
         log_init();
     }
 
-    /* check output enabled */
-    if (!g_log.output_enabled) {
+    if (!log_filter_pass(level, tag) || (sinks = log_sink_match(level, tag)) == 0) {
+        log_stats_line(level, tag, false);
         return;
     }
+    log_stats_line(level, tag, true);
+
+    /* package line prefix once */
+    fmt_result = snprintf(prefix, sizeof(prefix), "%c/HEX %s: ", level_output_info[level][0], tag);
+    if (fmt_result < 0) {
+        prefix_len = 0;
+    } else if ((size_t)fmt_result >= sizeof(prefix)) {
+        prefix_len = sizeof(prefix) - 1;
+    } else {
+        prefix_len = fmt_result;
+    }
 
-    /* args point to the first variable parameter */
-    va_start(args, format);
+    /* lock output in sync mode, keep all lines of this dump together */
+    sync = !__atomic_load_n(&g_log.async_enabled, __ATOMIC_ACQUIRE);
+    if (sync) {
+        log_port_output_lock();
+    }
 
-    /* lock output */
-    log_port_output_lock();
+    for (i = 0; i < size; i += width) {
+        n = size - i < width ? size - i : width;
+        memcpy(row, prefix, prefix_len);
+        row_len = prefix_len + log_hexdump_row(row + prefix_len, width, data + i, n, offset + i);
+        /* overflow check and reserve some space for newline sign */
+        if (row_len + newline_len > LOG_LINE_BUF_SIZE) {
+            row_len = LOG_LINE_BUF_SIZE - newline_len;
+        }
+        memcpy(row + row_len, LOG_NEWLINE_SIGN, newline_len);
+        row_len += newline_len;
+        /* output the packaged rows when this one doesn't fit */
+        if (log_len + row_len > LOG_LINE_BUF_SIZE) {
+            log_line_raw(&line, level, sinks, log_len);
+            log_write_direct(&line, log_buf, log_len);
+            if (line.sinks && !log_async_output(LOG_ASYNC_TEXT, &line, log_buf, log_len)) {
+                log_write(&line, log_buf, log_len);
+            }
+            log_len = 0;
+        }
+        memcpy(log_buf + log_len, row, row_len);
+        log_len += row_len;
+    }
+    if (log_len > 0) {
+        log_line_raw(&line, level, sinks, log_len);
+        log_write_direct(&line, log_buf, log_len);
+        if (line.sinks && !log_async_output(LOG_ASYNC_TEXT, &line, log_buf, log_len)) {
+            log_write(&line, log_buf, log_len);
+        }
+    }
+    /* unlock output */
+    if (sync) {
+        log_port_output_unlock();
+    }
+}
 
-    /* package log data to buffer */
-    fmt_result = vsnprintf(log_buf, LOG_LINE_BUF_SIZE, format, args);
+/**
+ * dump the hex format data to log
+ *
+ * @param name name for hex object, it will show on log header
+ * @param width hex number for every line, such as: 16, 32
+ * @param buf hex buffer
+ * @param size buffer size
+ */
+void log_hexdump(const char* name, uint8_t width, const void* buf, size_t size) {
+    log_hexdump_ex(LOG_LVL_DEBUG, name, width, buf, size, 0);
+}
 
-    /* output converted log */
-    if ((fmt_result > -1) && (fmt_result <= LOG_LINE_BUF_SIZE)) {
-        log_len = fmt_result;
-    } else {
-        log_len = LOG_LINE_BUF_SIZE;
+/* publish a copy of the sink tag filter and retire the replaced one, sink lock must be held. The
+ * filter is not changed when out of memory. */
+static void log_sink_set_tag(log_sink_entry_t* sink, const char* tag) {
+    char *cur = sink->tag, *copy = NULL;
+
+    if (tag && tag[0] != '\0' && (copy = strndup(tag, LOG_FILTER_TAG_MAX_LEN)) == NULL) {
+        return;
     }
-    /* output log */
-    log_port_output(log_buf, log_len);
+    __atomic_store_n(&sink->tag, copy, __ATOMIC_RELEASE);
+    sink->cfg.tag = copy;
+    log_retire(cur);
+}
+
+/**
+ * add a log sink. The console and file are the built-in sinks LOG_SINK_CONSOLE and LOG_SINK_FILE.
+ *
+ * @param sink sink config, it is copied
+ *
+ * @return sink id, -1: no free sink, the async queue can't be created or the open failed. The
+ * failed sink is not opened, release it by its close.
+ */
+int log_add_sink(const log_sink_t* sink) {
+    log_sink_entry_t* entry;
+    int id;
 
-    /* write the file */
-    log_file_write(log_buf, log_len);
+    LOG_CHECK(sink == NULL || sink->output == NULL, return -1;);
+    LOG_CHECK(sink->level > LOG_LVL_VERBOSE, return -1;);
+    LOG_CHECK(sink->async_overflow >= LOG_ASYNC_OVERFLOW_MAX, return -1;);
 
-    /* unlock output */
+    pthread_mutex_lock(&sink_lock);
+    for (id = LOG_SINK_FILE + 1; id < LOG_SINK_MAX_NUM; id++) {
+        if (!(sink_active & (1u << id))) break;
+    }
+    if (id == LOG_SINK_MAX_NUM) {
+        id = -1;
+        goto __exit;
+    }
+
+    entry      = &g_sinks[id];
+    entry->cfg = *sink;
+    log_sink_set_tag(entry, sink->tag);
+    entry->queue = NULL;
+    /* the direct sink is written by the producer, it has no queue */
+    if (sink->flags & LOG_SINK_FLAG_DIRECT) {
+        entry->cfg.async_capacity = 0;
+    } else if (sink->async_capacity > 0 &&
+               (entry->queue = log_sink_queue_create(entry)) == NULL) {
+        id = -1;
+        goto __exit;
+    }
+    if (sink->open && sink->open(sink->arg) < 0) {
+        if (entry->queue) {
+            log_sink_queue_destroy(entry->queue);
+            entry->queue = NULL;
+        }
+        id = -1;
+        goto __exit;
+    }
+    if (sink->flags & LOG_SINK_FLAG_DIRECT) {
+        __atomic_or_fetch(&sink_direct, 1u << id, __ATOMIC_RELAXED);
+    }
+    __atomic_or_fetch(&sink_active, 1u << id, __ATOMIC_RELEASE);
+
+__exit:
+    pthread_mutex_unlock(&sink_lock);
+
+    return id;
+}
+
+/**
+ * remove the log sink, the lines queued for it are written before it is closed
+ *
+ * @param id sink id returned by log_add_sink
+ */
+void log_remove_sink(int id) {
+    log_sink_entry_t* entry;
+
+    LOG_CHECK(id <= LOG_SINK_FILE || id >= LOG_SINK_MAX_NUM, return;);
+
+    pthread_mutex_lock(&sink_lock);
+    if (!(sink_active & (1u << id))) goto __exit;
+
+    /* write the lines queued for it in async mode */
+    if (__atomic_load_n(&g_log.async_enabled, __ATOMIC_ACQUIRE)) {
+        log_async_flush(&g_async);
+    }
+    __atomic_and_fetch(&sink_active, ~(1u << id), __ATOMIC_SEQ_CST);
+    __atomic_and_fetch(&sink_direct, ~(1u << id), __ATOMIC_SEQ_CST);
+    /* wait for the producers, sync writers and async output thread which may still use it */
+    while (__atomic_load_n(&sink_direct_users, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+    log_port_output_lock();
     log_port_output_unlock();
+    log_async_lock(&g_async);
+    log_async_unlock(&g_async);
+
+    entry = &g_sinks[id];
+    if (entry->queue) {
+        log_sink_queue_destroy(entry->queue);
+        entry->queue = NULL;
+    }
+    if (entry->cfg.close) {
+        entry->cfg.close(entry->cfg.arg);
+    }
+    log_sink_set_tag(entry, NULL);
+
+__exit:
+    pthread_mutex_unlock(&sink_lock);
+}
+
+/**
+ * set the sink filter and format, it also works for the console and file
+ *
+ * @param id sink id
+ * @param level max output level
+ * @param tag tag filter, NULL or "": all tags
+ * @param fmt LOG_SINK_FMT mask
+ */
+void log_set_sink_filter(int id, uint8_t level, const char* tag, uint8_t fmt) {
+    log_sink_entry_t* entry;
+
+    LOG_CHECK(id < 0 || id >= LOG_SINK_MAX_NUM, return;);
+    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+
+    pthread_mutex_lock(&sink_lock);
+    if (sink_active & (1u << id)) {
+        entry = &g_sinks[id];
+        __atomic_store_n(&entry->cfg.level, level, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->cfg.fmt, fmt, __ATOMIC_RELAXED);
+        log_sink_set_tag(entry, tag);
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+/* memory ring sink, it keeps the newest output */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t size;
+    size_t written; /* total written length */
+    char buf[];
+} log_sink_ring_t;
+
+static void log_sink_ring_output(void* arg, uint8_t level, const char* log, size_t size) {
+    log_sink_ring_t* ring = arg;
+    size_t pos, len;
+
+    pthread_mutex_lock(&ring->lock);
+    /* only the end of the log fits */
+    if (size > ring->size) {
+        ring->written += size - ring->size;
+        log += size - ring->size;
+        size = ring->size;
+    }
+    pos = ring->written % ring->size;
+    len = ring->size - pos < size ? ring->size - pos : size;
+    memcpy(ring->buf + pos, log, len);
+    memcpy(ring->buf, log + len, size - len);
+    ring->written += size;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void log_sink_ring_close(void* arg) {
+    log_sink_ring_t* ring = arg;
+
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+/**
+ * initialize the memory ring sink config, add it by log_add_sink
+ *
+ * @param sink sink config, the output is uncolored and has all other parts
+ * @param size ring size
+ *
+ * @return result
+ */
+int log_sink_ring_init(log_sink_t* sink, size_t size) {
+    log_sink_ring_t* ring;
+
+    LOG_CHECK(sink == NULL || size == 0, return -1;);
+
+    if ((ring = malloc(sizeof(log_sink_ring_t) + size)) == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    ring->size    = size;
+    ring->written = 0;
+
+    memset(sink, 0, sizeof(log_sink_t));
+    sink->output = log_sink_ring_output;
+    sink->close  = log_sink_ring_close;
+    sink->arg    = ring;
+    sink->level  = LOG_LVL_VERBOSE;
+    sink->fmt    = LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR;
+
+    return 0;
+}
+
+/**
+ * read the newest output of the memory ring sink, the oldest line may be cut
+ *
+ * @param ring arg of the memory ring sink config
+ * @param buf output buffer
+ * @param size buffer size
+ *
+ * @return read length
+ */
+size_t log_sink_ring_read(void* ring, char* buf, size_t size) {
+    log_sink_ring_t* r = ring;
+    size_t start, len, first;
+
+    LOG_CHECK(ring == NULL || (buf == NULL && size > 0), return 0;);
+
+    pthread_mutex_lock(&r->lock);
+    len   = r->written < r->size ? r->written : r->size;
+    len   = len < size ? len : size;
+    start = (r->written - len) % r->size;
+    first = r->size - start < len ? r->size - start : len;
+    memcpy(buf, r->buf + start, first);
+    memcpy(buf + first, r->buf, len - first);
+    pthread_mutex_unlock(&r->lock);
+
+    return len;
+}
+
+static void log_sink_syslog_output(void* arg, uint8_t level, const char* log, size_t size) {
+    static const int priority[] = {
+        [LOG_LVL_ASSERT] = LOG_CRIT, [LOG_LVL_ERROR] = LOG_ERR,  [LOG_LVL_WARN] = LOG_WARNING,
+        [LOG_LVL_INFO] = LOG_INFO,   [LOG_LVL_DEBUG] = LOG_DEBUG, [LOG_LVL_VERBOSE] = LOG_DEBUG,
+        [LOG_LVL_RAW] = LOG_INFO,
+    };
+
+    /* syslog ends the message itself */
+    if (size >= sizeof(LOG_NEWLINE_SIGN) - 1 &&
+        !memcmp(log + size - (sizeof(LOG_NEWLINE_SIGN) - 1), LOG_NEWLINE_SIGN,
+                sizeof(LOG_NEWLINE_SIGN) - 1)) {
+        size -= sizeof(LOG_NEWLINE_SIGN) - 1;
+    }
+    syslog(priority[level], "%.*s", (int)size, log);
+}
+
+/* openlog and closelog are process-wide, the syslog sinks share them by the reference count */
+static pthread_mutex_t syslog_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t syslog_users;
+/* ident of the first syslog sink, openlog keeps the pointer */
+static char* syslog_ident;
+
+static void log_sink_syslog_close(void* arg) {
+    pthread_mutex_lock(&syslog_lock);
+    if (--syslog_users == 0) {
+        closelog();
+        free(syslog_ident);
+        syslog_ident = NULL;
+    }
+    pthread_mutex_unlock(&syslog_lock);
+}
+
+/**
+ * initialize the syslog sink config, add it by log_add_sink and the sink is closed by
+ * log_remove_sink. The syslog sinks share the process-wide syslog connection, it is opened by the
+ * first one and closed by the last one.
+ *
+ * @param sink sink config, the time, process and thread info are left to syslog
+ * @param ident syslog ident, NULL: program name. It is ignored when another syslog sink is open.
+ *
+ * @return result
+ */
+int log_sink_syslog_init(log_sink_t* sink, const char* ident) {
+    LOG_CHECK(sink == NULL, return -1;);
+
+    pthread_mutex_lock(&syslog_lock);
+    if (syslog_users == 0) {
+        if (ident && (syslog_ident = strdup(ident)) == NULL) {
+            pthread_mutex_unlock(&syslog_lock);
+            return -1;
+        }
+        openlog(syslog_ident, LOG_PID | LOG_NDELAY, LOG_USER);
+    }
+    syslog_users++;
+    pthread_mutex_unlock(&syslog_lock);
+
+    memset(sink, 0, sizeof(log_sink_t));
+    sink->output = log_sink_syslog_output;
+    sink->close  = log_sink_syslog_close;
+    sink->level  = LOG_LVL_VERBOSE;
+    sink->fmt    = LOG_SINK_FMT_LVL | LOG_SINK_FMT_TAG | LOG_SINK_FMT_LOC;
+
+    return 0;
+}
 
-    va_end(args);
+static void log_sink_udp_output(void* arg, uint8_t level, const char* log, size_t size) {
+    /* the datagram is dropped rather than block the output */
+    send((int)(intptr_t)arg, log, size, MSG_DONTWAIT | MSG_NOSIGNAL);
 }
 
+static void log_sink_udp_close(void* arg) { close((int)(intptr_t)arg); }
+
 /**
- * output the log
+ * initialize the UDP sink config, every line is sent by one datagram. Add it by log_add_sink.
  *
- * @param level level
- * @param tag tag
- * @param file file name
- * @param func function name
- * @param line line number
- * @param format output format
- * @param ... args
+ * @param sink sink config, the output is uncolored and has all other parts
+ * @param host receiver host name or address
+ * @param port receiver port
  *
+ * @return result
  */
-void log_output(uint8_t level, const char* tag, const char* file, const char* func, const long line,
-                const char* format, ...) {
-    size_t tag_len = strlen(tag), newline_len = strlen(LOG_NEWLINE_SIGN);
-    int log_len                                    = 0;
-    char line_num[LOG_LINE_NUM_MAX_LEN + 1]        = {0};
-    char tag_sapce[LOG_FILTER_TAG_MAX_LEN / 2 + 1] = {0};
-    va_list args;
-    int fmt_result;
+int log_sink_udp_init(log_sink_t* sink, const char* host, uint16_t port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM}, *res, *ai;
+    char service[sizeof("65535")];
+    int fd = -1;
 
-    LOG_CHECK(level > LOG_LVL_VERBOSE, return;);
+    LOG_CHECK(sink == NULL || host == NULL, return -1;);
 
-    if (!g_log.init_ok) {
-        log_init();
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        return -1;
     }
-
-    /* check output enabled */
-    if (!g_log.output_enabled) {
-        return;
+    for (ai = res; ai; ai = ai->ai_next) {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
     }
-    /* level filter */
-    if (level > g_log.filter.level || level > log_get_filter_tag_lvl(tag)) {
-        return;
-    } else if (!strstr(tag, g_log.filter.tag)) { /* tag filter */
-        return;
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return -1;
     }
-    /* args point to the first variable parameter */
-    va_start(args, format);
-    /* lock output */
-    log_port_output_lock();
 
-    /* add CSI start sign and color info */
-    if (g_log.text_color_enabled) {
-        log_len += log_strcpy(log_len, log_buf + log_len, CSI_START);
-        log_len += log_strcpy(log_len, log_buf + log_len, color_output_info[level]);
-    }
+    memset(sink, 0, sizeof(log_sink_t));
+    sink->output = log_sink_udp_output;
+    sink->close  = log_sink_udp_close;
+    sink->arg    = (void*)(intptr_t)fd;
+    sink->level  = LOG_LVL_VERBOSE;
+    sink->fmt    = LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR;
 
-    /* package level info */
-    if (get_fmt_enabled(level, LOG_FMT_LVL)) {
-        log_len += log_strcpy(log_len, log_buf + log_len, level_output_info[level]);
-    }
-    /* package tag info */
-    if (get_fmt_enabled(level, LOG_FMT_TAG)) {
-        log_len += log_strcpy(log_len, log_buf + log_len, tag);
-        /* if the tag length is less than 50% LOG_FILTER_TAG_MAX_LEN, then fill space */
-        if (tag_len <= LOG_FILTER_TAG_MAX_LEN / 2) {
-            memset(tag_sapce, ' ', LOG_FILTER_TAG_MAX_LEN / 2 - tag_len);
-            log_len += log_strcpy(log_len, log_buf + log_len, tag_sapce);
-        }
-        log_len += log_strcpy(log_len, log_buf + log_len, " ");
-    }
-    /* package time, process and thread info */
-    if (get_fmt_enabled(level, LOG_FMT_TIME | LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
-        log_len += log_strcpy(log_len, log_buf + log_len, "[");
-        /* package time info */
-        if (get_fmt_enabled(level, LOG_FMT_TIME)) {
-            log_len += log_strcpy(log_len, log_buf + log_len, log_port_get_time());
-            if (get_fmt_enabled(level, LOG_FMT_P_INFO | LOG_FMT_T_INFO)) {
-                log_len += log_strcpy(log_len, log_buf + log_len, " ");
-            }
-        }
-        /* package process info */
-        if (get_fmt_enabled(level, LOG_FMT_P_INFO)) {
-            log_len += log_strcpy(log_len, log_buf + log_len, log_port_get_p_info());
-            if (get_fmt_enabled(level, LOG_FMT_T_INFO)) {
-                log_len += log_strcpy(log_len, log_buf + log_len, " ");
-            }
-        }
-        /* package thread info */
-        if (get_fmt_enabled(level, LOG_FMT_T_INFO)) {
-            log_len += log_strcpy(log_len, log_buf + log_len, log_port_get_t_info());
-        }
-        log_len += log_strcpy(log_len, log_buf + log_len, "] ");
+    return 0;
+}
+
+/* flight recorder, a lock-free ring which keeps the newest lines until a crash dumps it */
+typedef struct {
+    char* name;  /* dump file name */
+    size_t mask; /* ring size - 1 */
+    char* buf;
+    bool opened; /* the signal handlers are installed */
+    size_t pos __attribute__((aligned(64))); /* total reserved length */
+} log_flight_t;
+
+/* the flight recorder dumped on assert and fatal signal, only one is opened */
+static log_flight_t* g_flight;
+/* dumps which may be reading g_flight, the closed recorder is freed after they finished */
+static size_t flight_dumpers;
+/* fatal signals which dump the flight recorder */
+static const int flight_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+/* signal actions replaced by the flight recorder */
+static struct sigaction flight_old_actions[sizeof(flight_signals) / sizeof(flight_signals[0])];
+
+static void log_sink_flight_output(void* arg, uint8_t level, const char* log, size_t size) {
+    log_flight_t* flight = arg;
+    size_t pos, len;
+
+    /* only the end of the log fits */
+    if (size > flight->mask + 1) {
+        log += size - (flight->mask + 1);
+        size = flight->mask + 1;
     }
-    /* package file directory and name, function name and line number info */
-    if (get_fmt_enabled(level, LOG_FMT_DIR | LOG_FMT_FUNC | LOG_FMT_LINE)) {
-        log_len += log_strcpy(log_len, log_buf + log_len, "(");
-        /* package file info */
-        if (get_fmt_enabled(level, LOG_FMT_DIR)) {
-            log_len += log_strcpy(log_len, log_buf + log_len, file);
-            if (get_fmt_enabled(level, LOG_FMT_FUNC)) {
-                log_len += log_strcpy(log_len, log_buf + log_len, ":");
-            } else if (get_fmt_enabled(level, LOG_FMT_LINE)) {
-                log_len += log_strcpy(log_len, log_buf + log_len, " ");
-            }
-        }
-        /* package line info */
-        if (get_fmt_enabled(level, LOG_FMT_LINE)) {
-            snprintf(line_num, LOG_LINE_NUM_MAX_LEN, "%ld", line);
-            log_len += log_strcpy(log_len, log_buf + log_len, line_num);
-            if (get_fmt_enabled(level, LOG_FMT_FUNC)) {
-                log_len += log_strcpy(log_len, log_buf + log_len, " ");
-            }
-        }
-        /* package func info */
-        if (get_fmt_enabled(level, LOG_FMT_FUNC)) {
-            log_len += log_strcpy(log_len, log_buf + log_len, func);
+    /* reserve the space, a writer lapped by a full ring only corrupts the oldest lines */
+    pos = __atomic_fetch_add(&flight->pos, size, __ATOMIC_RELAXED) & flight->mask;
+    len = flight->mask + 1 - pos < size ? flight->mask + 1 - pos : size;
+    memcpy(flight->buf + pos, log, len);
+    memcpy(flight->buf, log + len, size - len);
+}
+
+/* write all data to the file descriptor, it is async-signal-safe */
+static void log_flight_put(int fd, const char* buf, size_t len) {
+    ssize_t ret;
+
+    while (len > 0) {
+        if ((ret = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) continue;
+            return;
         }
-        log_len += log_strcpy(log_len, log_buf + log_len, ")");
+        buf += ret;
+        len -= ret;
     }
-    /* package other log data to buffer. '\0' must be added in the end by vsnprintf. */
-    fmt_result = vsnprintf(log_buf + log_len, LOG_LINE_BUF_SIZE - log_len, format, args);
+}
 
-    va_end(args);
-    /* calculate log length */
-    if ((log_len + fmt_result <= LOG_LINE_BUF_SIZE) && (fmt_result > -1)) {
-        log_len += fmt_result;
-    } else {
-        /* using max length */
-        log_len = LOG_LINE_BUF_SIZE;
-    }
-    /* overflow check and reserve some space for CSI end sign and newline sign */
-    if (log_len + (sizeof(CSI_END) - 1) + newline_len > LOG_LINE_BUF_SIZE) {
-        /* using max length */
-        log_len = LOG_LINE_BUF_SIZE;
-        /* reserve some space for CSI end sign */
-        log_len -= (sizeof(CSI_END) - 1);
-        /* reserve some space for newline sign */
-        log_len -= newline_len;
+/* dump the opened flight recorder, only async-signal-safe calls are used */
+static void log_flight_write(void) {
+    log_flight_t* flight;
+    size_t end, len, start, first;
+    int fd;
+
+    /* the closing thread waits for this dump before freeing the recorder */
+    __atomic_add_fetch(&flight_dumpers, 1, __ATOMIC_SEQ_CST);
+    if ((flight = __atomic_load_n(&g_flight, __ATOMIC_SEQ_CST)) == NULL) goto __exit;
+    if ((fd = open(flight->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        goto __exit;
     }
-    /* keyword filter */
-    if (g_log.filter.keyword[0] != '\0') {
-        /* add string end sign */
-        log_buf[log_len] = '\0';
-        /* find the keyword */
-        if (!strstr(log_buf, g_log.filter.keyword)) {
-            /* unlock output */
-            log_port_output_unlock();
-            return;
+    end   = __atomic_load_n(&flight->pos, __ATOMIC_ACQUIRE);
+    len   = end < flight->mask + 1 ? end : flight->mask + 1;
+    start = (end - len) & flight->mask;
+    first = flight->mask + 1 - start < len ? flight->mask + 1 - start : len;
+    log_flight_put(fd, flight->buf + start, first);
+    log_flight_put(fd, flight->buf, len - first);
+    close(fd);
+
+__exit:
+    __atomic_sub_fetch(&flight_dumpers, 1, __ATOMIC_SEQ_CST);
+}
+
+/* dump the flight recorder on the fatal signal, then let the replaced action handle it */
+static void log_flight_signal(int sig) {
+    int saved_errno = errno;
+    size_t i;
+
+    for (i = 0; i < sizeof(flight_signals) / sizeof(flight_signals[0]); i++) {
+        if (flight_signals[i] == sig) {
+            sigaction(sig, &flight_old_actions[i], NULL);
         }
     }
+    log_flight_write();
+    errno = saved_errno;
+    /* delivered after return, a fault raises the signal again by itself */
+    raise(sig);
+}
 
-    /* add CSI end sign */
-    if (g_log.text_color_enabled) {
-        log_len += log_strcpy(log_len, log_buf + log_len, CSI_END);
+/* open the flight recorder for the dumps when the sink is added, only one can be opened */
+static int log_sink_flight_open(void* arg) {
+    struct sigaction action = {.sa_handler = log_flight_signal, .sa_flags = SA_ONSTACK};
+    log_flight_t *flight = arg, *cur = NULL;
+    size_t i;
+
+    if (!__atomic_compare_exchange_n(&g_flight, &cur, flight, false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_SEQ_CST)) {
+        return -1;
+    }
+    sigemptyset(&action.sa_mask);
+    for (i = 0; i < sizeof(flight_signals) / sizeof(flight_signals[0]); i++) {
+        sigaction(flight_signals[i], &action, &flight_old_actions[i]);
     }
+    flight->opened = true;
 
-    /* package newline sign */
-    log_len += log_strcpy(log_len, log_buf + log_len, LOG_NEWLINE_SIGN);
-    /* output log */
-    log_port_output(log_buf, log_len);
+    return 0;
+}
 
-    /* write the file */
-    log_file_write(log_buf, log_len);
+static void log_sink_flight_close(void* arg) {
+    log_flight_t* flight = arg;
+    size_t i;
 
-    /* unlock output */
-    log_port_output_unlock();
+    if (flight->opened) {
+        for (i = 0; i < sizeof(flight_signals) / sizeof(flight_signals[0]); i++) {
+            sigaction(flight_signals[i], &flight_old_actions[i], NULL);
+        }
+        __atomic_store_n(&g_flight, NULL, __ATOMIC_SEQ_CST);
+        /* wait for the dumps which may have loaded it */
+        while (__atomic_load_n(&flight_dumpers, __ATOMIC_SEQ_CST) != 0) {
+            sched_yield();
+        }
+    }
+    free(flight->buf);
+    free(flight->name);
+    free(flight);
 }
 
 /**
- * get format enabled
+ * initialize the flight recorder sink config, add it by log_add_sink. It is written by the
+ * producer even in async mode and only dumped to file by log_flight_dump, LOG_ASSERT and fatal
+ * signals (SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT). The signal handlers are installed when
+ * the sink is added and restored when it is removed.
+ * Keep the global filter level at LOG_LVL_VERBOSE and lower the other sinks level by
+ * log_set_sink_filter to record the verbose logs without writing them.
  *
- * @param level level
- * @param set format set
+ * @param sink sink config, the output is uncolored and has all other parts
+ * @param size ring size, rounded up to a power of two
+ * @param name dump file name
  *
- * @return enable or disable
+ * @return result, log_add_sink fails when another flight recorder is added
  */
-static bool get_fmt_enabled(uint8_t level, size_t set) {
-    LOG_CHECK(level > LOG_LVL_VERBOSE, return false);
+int log_sink_flight_init(log_sink_t* sink, size_t size, const char* name) {
+    log_flight_t* flight;
+    size_t capacity = 1;
 
-    if (g_log.enabled_fmt_set[level] & set) {
-        return true;
-    } else {
-        return false;
+    LOG_CHECK(sink == NULL || size == 0 || name == NULL, return -1;);
+
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    if ((flight = aligned_alloc(64, sizeof(log_flight_t))) == NULL) {
+        return -1;
     }
+    memset(flight, 0, sizeof(log_flight_t));
+    flight->mask = capacity - 1;
+    flight->buf  = malloc(capacity);
+    flight->name = strdup(name);
+    if (flight->buf == NULL || flight->name == NULL) {
+        free(flight->buf);
+        free(flight->name);
+        free(flight);
+        return -1;
+    }
+
+    memset(sink, 0, sizeof(log_sink_t));
+    sink->output = log_sink_flight_output;
+    sink->open   = log_sink_flight_open;
+    sink->close  = log_sink_flight_close;
+    sink->arg    = flight;
+    sink->flags  = LOG_SINK_FLAG_DIRECT;
+    sink->level  = LOG_LVL_VERBOSE;
+    sink->fmt    = LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR;
+
+    return 0;
 }
 
 /**
- * Set a hook function to EasyLogger assert. It will run when the expression is false.
- *
- * @param hook the hook function
+ * dump the flight recorder to its file, the file is replaced by every dump.
+ * It is async-signal-safe.
  */
-void log_assert_set_hook(void (*hook)(const char* expr, const char* func, size_t line)) {
-    log_assert_hook = hook;
-}
+void log_flight_dump(void) { log_flight_write(); }
+
+/* log port */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* log port initialize */
+static int log_port_init(void) { return 0; }
+
+/* how the non-blocking console writes its fd */
+enum {
+    LOG_CONSOLE_NB_NONE = 0, /* not resolved yet */
+    LOG_CONSOLE_NB_REOPEN,   /* own O_NONBLOCK open file description reopened by /proc/self/fd */
+    LOG_CONSOLE_NB_SOCKET,   /* send with MSG_DONTWAIT */
+    LOG_CONSOLE_NB_FILE,     /* regular file or block device, it doesn't wait for a reader */
+    LOG_CONSOLE_NB_POLL,     /* poll and PIPE_BUF windows, a terminal may still block briefly */
+};
+
+/* console fd, the non-blocking writes keep the bytes which the fd doesn't take in the backlog */
+typedef struct {
+    int fd;
+    int nb_fd;  /* fd of the non-blocking writes */
+    int nb;     /* LOG_CONSOLE_NB */
+    char* backlog;
+    size_t len;  /* bytes in the backlog */
+    size_t size; /* backlog buffer size */
+} log_console_t;
+
+static log_console_t g_console[] = {{.fd = STDOUT_FILENO}, {.fd = STDERR_FILENO}};
+/* console backlog lock, the async output thread and a sync writer may write at once */
+static pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * find the log level
- * @note make sure the log level is output on each format
- *
- * @param log log buffer
+ * resolve how the console fd is written without blocking, console lock must be held. The fd flags
+ * are not changed, they are shared with the application. A pipe or terminal is reopened by
+ * /proc/self/fd to get an own open file description which O_NONBLOCK only applies to.
  *
- * @return log level, found failed will return -1
+ * @param con console
  */
-int log_find_lvl(const char* log) {
-    LOG_CHECK(log == NULL, return -1;);
-    /* make sure the log level is output on each format */
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_ASSERT] & LOG_FMT_LVL) == 0, return -1;);
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_ERROR] & LOG_FMT_LVL) == 0, return -1;);
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_WARN] & LOG_FMT_LVL) == 0, return -1;);
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_INFO] & LOG_FMT_LVL) == 0, return -1;);
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_DEBUG] & LOG_FMT_LVL) == 0, return -1;);
-    LOG_CHECK((g_log.enabled_fmt_set[LOG_LVL_VERBOSE] & LOG_FMT_LVL) == 0, return -1;);
+static void log_console_nb_open(log_console_t* con) {
+    char path[32];
+    struct stat st;
+    int flags;
+
+    con->nb_fd = con->fd;
+    if (fstat(con->fd, &st) < 0 || S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+        con->nb = LOG_CONSOLE_NB_FILE;
+        return;
+    }
+    if (S_ISSOCK(st.st_mode)) {
+        con->nb = LOG_CONSOLE_NB_SOCKET;
+        return;
+    }
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", con->fd);
+    flags = fcntl(con->fd, F_GETFL);
+    if (flags >= 0 && (con->nb_fd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC |
+                                                   (flags & O_APPEND))) >= 0) {
+        con->nb = LOG_CONSOLE_NB_REOPEN;
+        return;
+    }
+    con->nb_fd = con->fd;
+    con->nb    = LOG_CONSOLE_NB_POLL;
+}
 
-    uint8_t i;
-    size_t csi_start_len = strlen(CSI_START);
-    for (i = 0; i < LOG_LVL_MAX; i++) {
-        if (!strncmp(color_output_info[i], log + csi_start_len, strlen(color_output_info[i]))) {
-            return i;
-        }
+/* forget the resolved non-blocking writes, console lock must be held */
+static void log_console_nb_close(log_console_t* con) {
+    if (con->nb == LOG_CONSOLE_NB_REOPEN) {
+        close(con->nb_fd);
     }
-    /* found failed */
-    return -1;
+    con->nb = LOG_CONSOLE_NB_NONE;
 }
 
 /**
- * find the log tag
- * @note make sure the log tag is output on each format
- * @note the tag don't have space in it
+ * write the segments from the offset without blocking, console lock must be held. Only the poll
+ * fallback writes PIPE_BUF bytes at most after every poll, which a writable pipe takes without
+ * blocking.
  *
- * @param log log buffer
- * @param lvl log level, you can get it by @see log_find_lvl
- * @param tag_len found tag length
+ * @param con console
+ * @param iov segments
+ * @param cnt segment count
+ * @param off written bytes to skip
+ * @param error set when the fd fails, the rest can't be written
  *
- * @return log tag, found failed will return NULL
+ * @return bytes written from the offset
  */
-const char* log_find_tag(const char* log, uint8_t lvl, size_t* tag_len) {
-    const char *tag = NULL, *tag_end = NULL;
+static size_t log_console_try_write(log_console_t* con, const struct iovec* iov, int cnt,
+                                    size_t off, bool* error) {
+    struct pollfd pfd = {.fd = con->fd, .events = POLLOUT};
+    struct iovec win[LOG_PART_MAX];
+    struct msghdr msg = {.msg_iov = win};
+    size_t written = 0, len;
+    int i, n;
+    ssize_t ret;
+
+    if (con->nb == LOG_CONSOLE_NB_NONE) {
+        log_console_nb_open(con);
+    }
 
-    LOG_CHECK(log == NULL, return NULL;);
-    LOG_CHECK(tag_len == NULL, return NULL;);
-    LOG_CHECK(lvl >= LOG_LVL_MAX, return NULL;);
-    /* make sure the log tag is output on each format */
-    LOG_CHECK((g_log.enabled_fmt_set[lvl] & LOG_FMT_TAG) == 0, return NULL;);
+    *error = false;
+    for (;;) {
+        /* skip the written segments */
+        for (i = 0, len = off + written; i < cnt && len >= iov[i].iov_len; i++) {
+            len -= iov[i].iov_len;
+        }
+        if (i == cnt) break;
+        win[0].iov_base = (char*)iov[i].iov_base + len;
+        win[0].iov_len  = iov[i].iov_len - len;
+        for (n = 1, len = win[0].iov_len; ++i < cnt && n < LOG_PART_MAX; n++) {
+            win[n] = iov[i];
+            len += iov[i].iov_len;
+        }
 
-    tag = log + strlen(CSI_START) + strlen(color_output_info[lvl]) + strlen(level_output_info[lvl]);
-    /* find the first space after tag */
-    if ((tag_end = memchr(tag, ' ', LOG_FILTER_TAG_MAX_LEN)) != NULL) {
-        *tag_len = tag_end - tag;
-    } else {
-        tag = NULL;
+        if (con->nb == LOG_CONSOLE_NB_POLL) {
+            /* window of PIPE_BUF bytes at most */
+            for (; len > PIPE_BUF && len - win[n - 1].iov_len >= PIPE_BUF; n--) {
+                len -= win[n - 1].iov_len;
+            }
+            if (len > PIPE_BUF) {
+                win[n - 1].iov_len -= len - PIPE_BUF;
+            }
+            if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLOUT)) break;
+        }
+        if (con->nb == LOG_CONSOLE_NB_SOCKET) {
+            msg.msg_iovlen = n;
+            ret            = sendmsg(con->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            ret = writev(con->nb_fd, win, n);
+        }
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            *error = errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        }
+        written += ret;
     }
 
-    return tag;
+    return written;
 }
 
 /**
- * dump the hex format data to log
+ * write the lines to the non-blocking console. The backlog goes first, the lines which the fd
+ * doesn't take are appended to it. The line which doesn't fit in the backlog is dropped, but the
+ * rest of a partly written line is always kept so the output isn't broken.
  *
- * @param name name for hex object, it will show on log header
- * @param width hex number for every line, such as: 16, 32
- * @param buf hex buffer
- * @param size buffer size
+ * @param con console
+ * @param iov segments
+ * @param line_end segment end of every line
+ * @param lines line count
+ * @param cap backlog capacity
  */
-void log_hexdump(const char* name, uint8_t width, uint8_t* buf, uint16_t size) {
-#define __is_print(ch) ((unsigned int)((ch) - ' ') < 127u - ' ')
-
+static void log_console_write(log_console_t* con, const struct iovec* iov, const int* line_end,
+                              int lines, size_t cap) {
+    struct iovec backlog = {.iov_base = con->backlog, .iov_len = con->len};
+    size_t written = 0, pos = 0, blen = con->len, len, skip, need;
+    bool error     = false;
+    char* buf;
     int i, j;
-    int log_len         = 0;
-    char dump_string[8] = {0};
-    int fmt_result;
 
-    if (!g_log.init_ok) {
-        log_init();
-    }
-
-    if (!g_log.output_enabled) {
-        return;
+    if (blen > 0) {
+        written = log_console_try_write(con, &backlog, 1, 0, &error);
+        blen    = error ? 0 : blen - written;
+        memmove(con->backlog, con->backlog + written, blen);
+        written = 0;
     }
-
-    /* level filter */
-    if (LOG_LVL_DEBUG > g_log.filter.level) {
-        return;
-    } else if (!strstr(name, g_log.filter.tag)) { /* tag filter */
-        return;
+    if (blen == 0 && lines > 0 && !error) {
+        written = log_console_try_write(con, iov, line_end[lines - 1], 0, &error);
     }
 
-    /* lock output */
-    log_port_output_lock();
-
-    for (i = 0; i < size; i += width) {
-        /* package header */
-        fmt_result =
-            snprintf(log_buf, LOG_LINE_BUF_SIZE, "D/HEX %s: %04X-%04X: ", name, i, i + width - 1);
-        /* calculate log length */
-        if ((fmt_result > -1) && (fmt_result <= LOG_LINE_BUF_SIZE)) {
-            log_len = fmt_result;
-        } else {
-            log_len = LOG_LINE_BUF_SIZE;
+    for (i = 0, j = 0; i < lines && !error; i++) {
+        for (len = 0; j < line_end[i]; j++) {
+            len += iov[j].iov_len;
         }
-        /* dump hex */
-        for (j = 0; j < width; j++) {
-            if (i + j < size) {
-                snprintf(dump_string, sizeof(dump_string), "%02X ", buf[i + j]);
-            } else {
-                strncpy(dump_string, "   ", sizeof(dump_string));
-            }
-            log_len += log_strcpy(log_len, log_buf + log_len, dump_string);
-            if ((j + 1) % 8 == 0) {
-                log_len += log_strcpy(log_len, log_buf + log_len, " ");
+        if (pos + len <= written) {
+            pos += len;
+            continue;
+        }
+        skip = written > pos ? written - pos : 0;
+        need = blen + len - skip;
+        pos += len;
+        if (skip == 0 && need > cap) {
+            __atomic_add_fetch(&console_drops, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (need > con->size) {
+            if ((buf = realloc(con->backlog, need > cap ? need : cap)) == NULL) {
+                __atomic_add_fetch(&console_drops, 1, __ATOMIC_RELAXED);
+                continue;
             }
+            con->backlog = buf;
+            con->size    = need > cap ? need : cap;
         }
-        log_len += log_strcpy(log_len, log_buf + log_len, "  ");
-        /* dump char for hex */
-        for (j = 0; j < width; j++) {
-            if (i + j < size) {
-                snprintf(dump_string, sizeof(dump_string), "%c",
-                         __is_print(buf[i + j]) ? buf[i + j] : '.');
-                log_len += log_strcpy(log_len, log_buf + log_len, dump_string);
+        /* copy the segments of the line after the written bytes */
+        for (j = i > 0 ? line_end[i - 1] : 0; j < line_end[i]; j++) {
+            if (skip >= iov[j].iov_len) {
+                skip -= iov[j].iov_len;
+                continue;
             }
+            memcpy(con->backlog + blen, (char*)iov[j].iov_base + skip, iov[j].iov_len - skip);
+            blen += iov[j].iov_len - skip;
+            skip = 0;
         }
-        /* overflow check and reserve some space for newline sign */
-        if (log_len + strlen(LOG_NEWLINE_SIGN) > LOG_LINE_BUF_SIZE) {
-            log_len = LOG_LINE_BUF_SIZE - strlen(LOG_NEWLINE_SIGN);
+    }
+    __atomic_store_n(&con->len, blen, __ATOMIC_RELAXED);
+}
+
+/**
+ * output the lines by one writev, iov will be modified when the write is partial. The
+ * non-blocking console writes what the fd takes and keeps the rest in the backlog.
+ *
+ * @param fd STDOUT_FILENO or STDERR_FILENO
+ * @param iov segments
+ * @param cnt segment count
+ * @param line_end segment end of every line
+ * @param lines line count
+ */
+static void log_port_output_v(int fd, struct iovec* iov, int cnt, const int* line_end, int lines) {
+    log_console_t* con = &g_console[fd == STDERR_FILENO];
+    size_t cap         = __atomic_load_n(&g_log.console_backlog, __ATOMIC_RELAXED);
+    ssize_t ret;
+
+    if (cap > 0 || __atomic_load_n(&con->len, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&console_lock);
+        /* the backlog left by the non-blocking mode is written first */
+        if (cap == 0 && con->len > 0) {
+            struct iovec backlog = {.iov_base = con->backlog, .iov_len = con->len};
+
+            __atomic_store_n(&con->len, 0, __ATOMIC_RELAXED);
+            log_port_output_v(fd, &backlog, 1, NULL, 0);
+        }
+        if (cap > 0) {
+            log_console_write(con, iov, line_end, lines, cap);
+            pthread_mutex_unlock(&console_lock);
+            return;
         }
-        /* package newline sign */
-        log_len += log_strcpy(log_len, log_buf + log_len, LOG_NEWLINE_SIGN);
-        /* do log output */
-        log_port_output(log_buf, log_len);
+        pthread_mutex_unlock(&console_lock);
+    }
 
-        /* write the file */
-        log_file_write(log_buf, log_len);
+    while (cnt > 0) {
+        ret = writev(fd, iov, cnt);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        /* skip the written segments */
+        while (cnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
     }
-    /* unlock output */
-    log_port_output_unlock();
 }
 
-/* log port */
-static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+/* retry the backlog of the non-blocking console, called when the output is idle */
+static void log_port_output_retry(void) {
+    size_t i;
 
-/* log port initialize */
-static int log_port_init(void) { return 0; }
+    for (i = 0; i < sizeof(g_console) / sizeof(g_console[0]); i++) {
+        if (__atomic_load_n(&g_console[i].len, __ATOMIC_RELAXED) > 0) {
+            log_port_output_v(g_console[i].fd, NULL, 0, NULL, 0);
+        }
+    }
+}
+
+/* resolve the non-blocking writes of the consoles again on the next write */
+static void log_port_output_reset(void) {
+    size_t i;
 
-/* output log */
-static void log_port_output(const char* log, size_t size) { printf("%.*s", (int)size, log); }
+    pthread_mutex_lock(&console_lock);
+    for (i = 0; i < sizeof(g_console) / sizeof(g_console[0]); i++) {
+        log_console_nb_close(&g_console[i]);
+    }
+    pthread_mutex_unlock(&console_lock);
+}
 
 /* output lock */
-static void log_port_output_lock(void) { pthread_mutex_lock(&output_lock); }
+static void log_port_output_lock(void) { log_stats_lock(&output_lock, stats_output_lock_wait); }
 
 /* output unlock */
 static void log_port_output_unlock(void) { pthread_mutex_unlock(&output_lock); }
 
-/* current time */
-static const char* log_port_get_time(void) {
-    static char cur_system_time[32] = {0};
+/* clock and fraction of the time info */
+static const clockid_t time_clock_id[] = {
+    [LOG_TIME_CLOCK_REALTIME]        = CLOCK_REALTIME,
+    [LOG_TIME_CLOCK_REALTIME_COARSE] = CLOCK_REALTIME_COARSE,
+    [LOG_TIME_CLOCK_MONOTONIC]       = CLOCK_MONOTONIC,
+};
+static const long time_frac_div[] = {[LOG_TIME_PREC_MS] = 1000000, [LOG_TIME_PREC_US] = 1000,
+                                     [LOG_TIME_PREC_NS] = 1};
+static const int time_frac_width[] = {[LOG_TIME_PREC_MS] = 3, [LOG_TIME_PREC_US] = 6,
+                                      [LOG_TIME_PREC_NS] = 9};
+
+/* read the clock of the time info */
+static void log_port_get_clock(uint8_t clock, struct timespec* ts) {
+    clock_gettime(time_clock_id[clock], ts);
+}
+
+/* patch the fraction digits in front of end */
+static void log_port_format_frac(const struct timespec* ts, uint8_t precision, char* end) {
+    long frac = ts->tv_nsec / time_frac_div[precision];
+    int i;
+
+    for (i = 0; i < time_frac_width[precision]; i++) {
+        *--end = '0' + frac % 10;
+        frac /= 10;
+    }
+}
 
-    time_t cur_t;
+/* format the time info, buf size must be at least LOG_TIME_MAX_LEN */
+static size_t log_port_format_time(const struct timespec* ts, uint8_t clock, uint8_t precision,
+                                   char* buf) {
     struct tm cur_tm;
-    struct timeval tv;
-    char system_time[24] = {0};
+    size_t len;
+
+    if (clock == LOG_TIME_CLOCK_MONOTONIC) {
+        len = snprintf(buf, LOG_TIME_MAX_LEN, "%ld.", (long)ts->tv_sec);
+    } else {
+        localtime_r(&ts->tv_sec, &cur_tm);
+        len = strftime(buf, LOG_TIME_MAX_LEN, "%Y-%m-%d %T-", &cur_tm);
+    }
+    len += time_frac_width[precision];
+    log_port_format_frac(ts, precision, buf + len);
+    buf[len] = '\0';
 
-    gettimeofday(&tv, NULL);
-    cur_t = tv.tv_sec;
-    localtime_r(&cur_t, &cur_tm);
+    return len;
+}
 
-    strftime(system_time, sizeof(system_time), "%Y-%m-%d %T", &cur_tm);
-    snprintf(cur_system_time, sizeof(cur_system_time), "%s-%03ld", system_time, tv.tv_usec / 1000);
+/* current time, the date and second prefix is only formatted when the second changes */
+static const char* log_port_get_time(size_t* len) {
+    static __thread struct {
+        time_t sec;
+        uint8_t clock;
+        uint8_t precision;
+        size_t len;
+        char buf[LOG_TIME_MAX_LEN];
+    } cache = {.sec = -1};
+
+    uint8_t clock = g_log.time_clock, precision = g_log.time_precision;
+    struct timespec ts;
+
+    log_port_get_clock(clock, &ts);
+
+    if (ts.tv_sec != cache.sec || clock != cache.clock || precision != cache.precision) {
+        cache.len       = log_port_format_time(&ts, clock, precision, cache.buf);
+        cache.sec       = ts.tv_sec;
+        cache.clock     = clock;
+        cache.precision = precision;
+    } else {
+        log_port_format_frac(&ts, precision, cache.buf + cache.len);
+    }
+    *len = cache.len;
 
-    return cur_system_time;
+    return cache.buf;
 }
 
 /* current process name */
 static const char* log_port_get_p_info(void) {
-    static char cur_process_info[10] = {0};
+    static __thread char cur_process_info[10];
 
     snprintf(cur_process_info, 10, "pid:%04d", getpid());
 
@@ -907,7 +7428,7 @@ static const char* log_port_get_p_info(void) {
 
 /* current thread name */
 static const char* log_port_get_t_info(void) {
-    static char cur_thread_info[10] = {0};
+    static __thread char cur_thread_info[10];
 
     snprintf(cur_thread_info, 10, "tid:%04ld", pthread_self());
 
@@ -921,7 +7442,7 @@ static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
 static int log_file_port_init(void) { return 0; }
 
 /* file log lock */
-static void inline log_file_port_lock(void) { pthread_mutex_lock(&file_lock); }
+static void inline log_file_port_lock(void) { log_stats_lock(&file_lock, stats_file_lock_wait); }
 
 /* file log unlock */
 static void inline log_file_port_unlock(void) { pthread_mutex_unlock(&file_lock); }
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,17 +21,170 @@ typedef enum {
     LOG_LVL_MAX,
 } LOG_LEVEL;
 
+/* all formats index */
+typedef enum {
+    LOG_FMT_LVL    = 1 << 0, /**< level */
+    LOG_FMT_TAG    = 1 << 1, /**< tag */
+    LOG_FMT_TIME   = 1 << 2, /**< current time */
+    LOG_FMT_P_INFO = 1 << 3, /**< process info */
+    LOG_FMT_T_INFO = 1 << 4, /**< thread info */
+    LOG_FMT_DIR    = 1 << 5, /**< file directory and name */
+    LOG_FMT_FUNC   = 1 << 6, /**< function name */
+    LOG_FMT_LINE   = 1 << 7, /**< line number */
+} LOG_FMT;
+
+/* macro definition for all formats */
+#define LOG_FMT_ALL                                                                             \
+    (LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_TIME | LOG_FMT_P_INFO | LOG_FMT_T_INFO | LOG_FMT_DIR | \
+     LOG_FMT_FUNC | LOG_FMT_LINE)
+
+/* async output ring overflow policy */
+typedef enum {
+    LOG_ASYNC_OVERFLOW_BLOCK = 0,   /**< wait for a free slot */
+    LOG_ASYNC_OVERFLOW_DROP_NEWEST, /**< drop the line being logged */
+    LOG_ASYNC_OVERFLOW_DROP_OLDEST, /**< drop the oldest queued line */
+    LOG_ASYNC_OVERFLOW_MAX,
+} LOG_ASYNC_OVERFLOW;
+
+/* clock of the time info */
+typedef enum {
+    LOG_TIME_CLOCK_REALTIME = 0,    /**< wall clock date and time */
+    LOG_TIME_CLOCK_REALTIME_COARSE, /**< wall clock, cheaper but only tick resolution */
+    LOG_TIME_CLOCK_MONOTONIC,       /**< seconds since boot */
+    LOG_TIME_CLOCK_MAX,
+} LOG_TIME_CLOCK;
+
+/* fraction precision of the time info */
+typedef enum {
+    LOG_TIME_PREC_MS = 0,
+    LOG_TIME_PREC_US,
+    LOG_TIME_PREC_NS,
+    LOG_TIME_PREC_MAX,
+} LOG_TIME_PREC;
+
+/* file rotation by time, it works with the rotation by size */
+typedef enum {
+    LOG_FILE_ROTATE_SIZE = 0, /**< only rotate by size */
+    LOG_FILE_ROTATE_HOURLY,   /**< also rotate at the start of every local hour */
+    LOG_FILE_ROTATE_DAILY,    /**< also rotate at local midnight */
+    LOG_FILE_ROTATE_MAX,
+} LOG_FILE_ROTATE;
+
+/* rotated file compression, it is done by the external tool in background */
+typedef enum {
+    LOG_FILE_COMPRESS_NONE = 0,
+    LOG_FILE_COMPRESS_GZIP, /**< gzip, xxx.log.n.gz */
+    LOG_FILE_COMPRESS_ZSTD, /**< zstd, xxx.log.n.zst */
+    LOG_FILE_COMPRESS_MAX,
+} LOG_FILE_COMPRESS;
+
+/* encoding of the log lines */
+typedef enum {
+    LOG_ENC_TEXT = 0, /**< formatted header and message */
+    LOG_ENC_JSON,     /**< one JSON object per line */
+    LOG_ENC_LOGFMT,   /**< key=value pairs */
+    LOG_ENC_MAX,
+} LOG_ENC;
+
+/* structured field value type */
+typedef enum {
+    LOG_KV_TYPE_STR = 0,
+    LOG_KV_TYPE_INT,
+    LOG_KV_TYPE_UINT,
+    LOG_KV_TYPE_DOUBLE,
+    LOG_KV_TYPE_BOOL,
+} LOG_KV_TYPE;
+
+/* structured field, the key is not escaped in logfmt */
+typedef struct {
+    const char* key;
+    uint8_t type; /* LOG_KV_TYPE */
+    union {
+        const char* s; /* NULL: null */
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+    } val;
+} log_kv_t;
+
+/* log parts which the sink outputs, the message is always output */
+typedef enum {
+    LOG_SINK_FMT_COLOR = 1 << 0, /**< CSI color sign */
+    LOG_SINK_FMT_LVL   = 1 << 1, /**< level info */
+    LOG_SINK_FMT_TAG   = 1 << 2, /**< tag info */
+    LOG_SINK_FMT_INFO  = 1 << 3, /**< time, process and thread info */
+    LOG_SINK_FMT_LOC   = 1 << 4, /**< file, line and function info */
+    LOG_SINK_FMT_ALL   = 0x1F,
+} LOG_SINK_FMT;
+
+/* id of the built-in console and file sinks */
+#define LOG_SINK_CONSOLE 0
+#define LOG_SINK_FILE 1
+/* max sinks, including the console and file */
+#define LOG_SINK_MAX_NUM 32
+
+/* log sink flags */
+typedef enum {
+    LOG_SINK_FLAG_DIRECT = 1 << 0, /**< written by the producer even in async mode, no own queue */
+} LOG_SINK_FLAG;
+
+/* log sink, the output is called with the formatted line (newline included) */
+typedef struct {
+    void (*output)(void* arg, uint8_t level, const char* log, size_t size);
+    void (*flush)(void* arg); /* optional, called by log_flush */
+    int (*open)(void* arg);   /* optional, called when the sink is added, < 0: not added */
+    void (*close)(void* arg); /* optional, called when the sink is removed */
+    void* arg;
+    uint8_t flags;          /* LOG_SINK_FLAG mask */
+    uint8_t level;          /* max output level, LOG_LVL_VERBOSE: all levels */
+    const char* tag;        /* tag filter, NULL or "": all tags */
+    uint8_t fmt;            /* LOG_SINK_FMT mask, only removes parts of the level's format */
+    size_t async_capacity;  /* own async queue lines, 0: output in the caller's thread */
+    uint8_t async_overflow; /* LOG_ASYNC_OVERFLOW policy of the own async queue */
+} log_sink_t;
+
+/* logger statistics, they are collected after log_set_stats_enabled */
+typedef struct {
+    uint64_t emitted[LOG_LVL_MAX + 1];     /* lines output per level, the last one is raw */
+    uint64_t filtered[LOG_LVL_MAX];        /* lines dropped by the filters per level */
+    uint64_t truncated;                    /* lines cut to the line buffer size */
+    uint64_t sink_bytes[LOG_SINK_MAX_NUM]; /* bytes written per sink */
+    uint64_t output_lock_waits;            /* contended output lock acquisitions */
+    uint64_t output_lock_wait_ns;          /* time waited for the output lock */
+    uint64_t file_lock_waits;              /* contended file lock acquisitions */
+    uint64_t file_lock_wait_ns;            /* time waited for the file lock */
+    uint64_t rotations;                    /* file rotations */
+    uint64_t rotate_ns;                    /* time spent by the writers on rotation */
+    size_t async_depth;                    /* lines queued in the async ring */
+    size_t async_drop_newest;
+    size_t async_drop_oldest;
+    size_t console_drops; /* lines dropped by the full non-blocking console backlog */
+} log_stats_t;
+
+/* logger statistics of a tag */
+typedef struct {
+    const char* tag;
+    uint64_t emitted;
+    uint64_t filtered;
+} log_tag_stats_t;
+
 /* the output silent level and all level for filter setting */
 #define LOG_FILTER_LVL_SILENT LOG_LVL_ASSERT
 #define LOG_FILTER_LVL_ALL LOG_LVL_VERBOSE
 
+/* no level goes to stderr, for log_set_console_stderr */
+#define LOG_CONSOLE_STDERR_NONE LOG_LVL_MAX
+
 #define LOG_ASSERT(EXPR)                                                                           \
     if (!(EXPR)) {                                                                                 \
         if (log_assert_hook == NULL) {                                                             \
             log_assert("log", "(%s) has assert failed at %s:%ld.", #EXPR, __FUNCTION__, __LINE__); \
+            log_flight_dump();                                                                     \
             while (1)                                                                              \
                 ;                                                                                  \
         } else {                                                                                   \
+            log_flight_dump();                                                                     \
             log_assert_hook(#EXPR, __FUNCTION__, __LINE__);                                        \
         }                                                                                          \
     }
@@ -43,22 +197,48 @@ typedef enum {
         }                                                    \
     } while (0)
 
-#define log_assert(tag, ...) \
-    log_output(LOG_LVL_ASSERT, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define log_error(tag, ...) \
-    log_output(LOG_LVL_ERROR, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define log_warn(tag, ...) \
-    log_output(LOG_LVL_WARN, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define log_info(tag, ...) \
-    log_output(LOG_LVL_INFO, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define log_debug(tag, ...) \
-    log_output(LOG_LVL_DEBUG, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define log_verbose(tag, ...) \
-    log_output(LOG_LVL_VERBOSE, tag, __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+/* log call site, every log statement has a static one */
+typedef struct {
+    uint8_t level;
+    const char* tag;
+    const char* file;
+    const char* func;
+    long line;
+    uint32_t filter_state; /* (filter generation << 2) | flags, cached on the last output */
+    void* head;            /* pre-rendered header, created by log.c on the first output */
+} log_site_t;
+
+/* filter generation, increased when any filter or output setting is changed */
+extern uint32_t log_filter_gen;
+
+/* the site is disabled by the current filter, it costs a load and a branch */
+#define LOG_SITE_DISABLED(site)                                           \
+    (__atomic_load_n(&(site)->filter_state, __ATOMIC_RELAXED) ==          \
+     (__atomic_load_n(&log_filter_gen, __ATOMIC_RELAXED) << 2))
+
+/* a void expression like the log_output call it replaced, so it also works in comma expressions
+ * and ternaries */
+#define log_site(level, tag, ...)                                                              \
+    ({                                                                                         \
+        static log_site_t _log_site = {level, tag, __FILE__, __FUNCTION__, __LINE__, 0, NULL}; \
+        if (!LOG_SITE_DISABLED(&_log_site)) log_site_output(&_log_site, __VA_ARGS__);          \
+        (void)0;                                                                               \
+    })
+
+#define log_assert(tag, ...) log_site(LOG_LVL_ASSERT, tag, __VA_ARGS__)
+#define log_error(tag, ...) log_site(LOG_LVL_ERROR, tag, __VA_ARGS__)
+#define log_warn(tag, ...) log_site(LOG_LVL_WARN, tag, __VA_ARGS__)
+#define log_info(tag, ...) log_site(LOG_LVL_INFO, tag, __VA_ARGS__)
+#define log_debug(tag, ...) log_site(LOG_LVL_DEBUG, tag, __VA_ARGS__)
+#define log_verbose(tag, ...) log_site(LOG_LVL_VERBOSE, tag, __VA_ARGS__)
 
 extern void (*log_assert_hook)(const char* expr, const char* func, size_t line);
 extern void log_output(uint8_t level, const char* tag, const char* file, const char* func,
                        const long line, const char* format, ...);
+extern void log_site_output(log_site_t* site, const char* format, ...);
+extern void log_kv_output(uint8_t level, const char* tag, const char* file, const char* func,
+                          const long line, const log_kv_t* kv, size_t kv_num, const char* format,
+                          ...);
 
 #if !defined(LOG_TAG)
 #define LOG_TAG "NO_TAG"
@@ -98,20 +278,257 @@ extern void log_output(uint8_t level, const char* tag, const char* file, const c
 #define log_v(...) ((void)0);
 #endif
 
+/* binary log argument type */
+typedef enum {
+    LOG_BIN_ARG_INT = 0,
+    LOG_BIN_ARG_UINT,
+    LOG_BIN_ARG_DOUBLE,
+    LOG_BIN_ARG_STR,
+    LOG_BIN_ARG_PTR,
+} LOG_BIN_ARG;
+
+/* binary log argument, the type is captured at the call site */
+typedef struct {
+    uint8_t type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double f;
+        const char* s;
+        const void* p;
+    } v;
+} log_bin_arg_t;
+
+/* binary log call site, its strings are recorded once per binary file */
+typedef struct {
+    uint32_t id; /* assigned on the first output */
+    uint8_t level;
+    const char* tag;
+    const char* file;
+    const char* func;
+    long line;
+    const char* format;
+    uint32_t file_gen;     /* binary file generation which the site is recorded in */
+    uint32_t filter_state; /* (filter generation << 2) | flags, cached on the last output */
+} log_bin_site_t;
+
+/* binary log max argument count */
+#define LOG_BIN_ARGS_MAX 12
+
+extern void log_bin_output(log_bin_site_t* site, const log_bin_arg_t* args, uint8_t argc);
+
+#ifndef __cplusplus
+static inline log_bin_arg_t log_bin_arg_int(int64_t v) {
+    log_bin_arg_t arg = {LOG_BIN_ARG_INT, {.i = v}};
+    return arg;
+}
+static inline log_bin_arg_t log_bin_arg_uint(uint64_t v) {
+    log_bin_arg_t arg = {LOG_BIN_ARG_UINT, {.u = v}};
+    return arg;
+}
+static inline log_bin_arg_t log_bin_arg_double(double v) {
+    log_bin_arg_t arg = {LOG_BIN_ARG_DOUBLE, {.f = v}};
+    return arg;
+}
+static inline log_bin_arg_t log_bin_arg_str(const char* v) {
+    log_bin_arg_t arg = {LOG_BIN_ARG_STR, {.s = v}};
+    return arg;
+}
+static inline log_bin_arg_t log_bin_arg_ptr(const void* v) {
+    log_bin_arg_t arg = {LOG_BIN_ARG_PTR, {.p = v}};
+    return arg;
+}
+/* never called, only lets the compiler check the format and arguments */
+static inline void __attribute__((format(printf, 1, 2))) log_bin_check(const char* format, ...) {
+    (void)format;
+}
+
+/* capture the argument by its type */
+#define LOG_BIN_ARG(x)                                                                             \
+    _Generic((x),                                                                                  \
+        _Bool: log_bin_arg_uint, char: log_bin_arg_int, signed char: log_bin_arg_int,              \
+        unsigned char: log_bin_arg_uint, short: log_bin_arg_int, unsigned short: log_bin_arg_uint, \
+        int: log_bin_arg_int, unsigned int: log_bin_arg_uint, long: log_bin_arg_int,               \
+        unsigned long: log_bin_arg_uint, long long: log_bin_arg_int,                               \
+        unsigned long long: log_bin_arg_uint, float: log_bin_arg_double,                           \
+        double: log_bin_arg_double, long double: log_bin_arg_double, char*: log_bin_arg_str,       \
+        const char*: log_bin_arg_str, default: log_bin_arg_ptr)(x),
+
+#define LOG_BIN_CAT_(a, b) a##b
+#define LOG_BIN_CAT(a, b) LOG_BIN_CAT_(a, b)
+#define LOG_BIN_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, N, ...) N
+#define LOG_BIN_NARGS(...) \
+    LOG_BIN_NARGS_(0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_BIN_ARGS_0()
+#define LOG_BIN_ARGS_1(a) LOG_BIN_ARG(a)
+#define LOG_BIN_ARGS_2(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_1(__VA_ARGS__)
+#define LOG_BIN_ARGS_3(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_2(__VA_ARGS__)
+#define LOG_BIN_ARGS_4(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_3(__VA_ARGS__)
+#define LOG_BIN_ARGS_5(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_4(__VA_ARGS__)
+#define LOG_BIN_ARGS_6(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_5(__VA_ARGS__)
+#define LOG_BIN_ARGS_7(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_6(__VA_ARGS__)
+#define LOG_BIN_ARGS_8(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_7(__VA_ARGS__)
+#define LOG_BIN_ARGS_9(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_8(__VA_ARGS__)
+#define LOG_BIN_ARGS_10(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_9(__VA_ARGS__)
+#define LOG_BIN_ARGS_11(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_10(__VA_ARGS__)
+#define LOG_BIN_ARGS_12(a, ...) LOG_BIN_ARG(a) LOG_BIN_ARGS_11(__VA_ARGS__)
+#define LOG_BIN_ARGS(...) LOG_BIN_CAT(LOG_BIN_ARGS_, LOG_BIN_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/*
+ * binary log, only the call site and the raw arguments are recorded, the format is done later
+ * by the async output thread or offline by log_bin_decode
+ */
+#define log_bin(level, tag, format, ...)                                                     \
+    do {                                                                                     \
+        static log_bin_site_t _log_bin_site = {0,        level,    tag, __FILE__,            \
+                                               __func__, __LINE__, format};                  \
+        if (0) log_bin_check(format, ##__VA_ARGS__);                                         \
+        if (!LOG_SITE_DISABLED(&_log_bin_site)) {                                            \
+            const log_bin_arg_t _log_bin_args[] = {LOG_BIN_ARGS(__VA_ARGS__){0}};            \
+            log_bin_output(&_log_bin_site, _log_bin_args, LOG_BIN_NARGS(__VA_ARGS__));       \
+        }                                                                                    \
+    } while (0)
+
+#if LOG_LVL >= LOG_LVL_ASSERT
+#define log_bin_a(...) log_bin(LOG_LVL_ASSERT, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_a(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_ERROR
+#define log_bin_e(...) log_bin(LOG_LVL_ERROR, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_e(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_WARN
+#define log_bin_w(...) log_bin(LOG_LVL_WARN, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_w(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_INFO
+#define log_bin_i(...) log_bin(LOG_LVL_INFO, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_i(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_DEBUG
+#define log_bin_d(...) log_bin(LOG_LVL_DEBUG, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_d(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_VERBOSE
+#define log_bin_v(...) log_bin(LOG_LVL_VERBOSE, LOG_TAG, __VA_ARGS__)
+#else
+#define log_bin_v(...) ((void)0);
+#endif
+
+/* structured fields */
+#define LOG_KV_STR(k, v) ((log_kv_t){.key = (k), .type = LOG_KV_TYPE_STR, .val.s = (v)})
+#define LOG_KV_INT(k, v) ((log_kv_t){.key = (k), .type = LOG_KV_TYPE_INT, .val.i = (v)})
+#define LOG_KV_UINT(k, v) ((log_kv_t){.key = (k), .type = LOG_KV_TYPE_UINT, .val.u = (v)})
+#define LOG_KV_DOUBLE(k, v) ((log_kv_t){.key = (k), .type = LOG_KV_TYPE_DOUBLE, .val.d = (v)})
+#define LOG_KV_BOOL(k, v) ((log_kv_t){.key = (k), .type = LOG_KV_TYPE_BOOL, .val.b = (v)})
+/* fields array and count, e.g. LOG_KV(LOG_KV_STR("user", name), LOG_KV_INT("id", id)) */
+#define LOG_KV(...) \
+    (const log_kv_t[]){__VA_ARGS__}, sizeof((const log_kv_t[]){__VA_ARGS__}) / sizeof(log_kv_t)
+
+/* structured log, the fields are encoded by log_set_encoding */
+#define log_kv(level, tag, fields, ...) \
+    log_kv_output(level, tag, __FILE__, __FUNCTION__, __LINE__, fields, __VA_ARGS__)
+
+#if LOG_LVL >= LOG_LVL_ASSERT
+#define log_kv_a(...) log_kv(LOG_LVL_ASSERT, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_a(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_ERROR
+#define log_kv_e(...) log_kv(LOG_LVL_ERROR, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_e(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_WARN
+#define log_kv_w(...) log_kv(LOG_LVL_WARN, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_w(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_INFO
+#define log_kv_i(...) log_kv(LOG_LVL_INFO, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_i(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_DEBUG
+#define log_kv_d(...) log_kv(LOG_LVL_DEBUG, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_d(...) ((void)0);
+#endif
+#if LOG_LVL >= LOG_LVL_VERBOSE
+#define log_kv_v(...) log_kv(LOG_LVL_VERBOSE, LOG_TAG, __VA_ARGS__)
+#else
+#define log_kv_v(...) ((void)0);
+#endif
+#endif /* __cplusplus */
+
 void log_set_output_enabled(bool enabled);
 void log_raw(const char* format, ...);
-void log_hexdump(const char* name, uint8_t width, uint8_t* buf, uint16_t size);
+void log_hexdump(const char* name, uint8_t width, const void* buf, size_t size);
+void log_hexdump_ex(uint8_t level, const char* tag, uint8_t width, const void* buf, size_t size,
+                    size_t offset);
 void log_assert_set_hook(void (*hook)(const char* expr, const char* func, size_t line));
 
 void log_set_file_output_enabled(bool enabled);
 void log_set_file_name(const char* name); /* name set before file_output enable */
+void log_set_file_mmap_enabled(bool enabled); /* mode set before file_output enable */
+void log_set_file_rotate(size_t max_size, int max_rotate);
+void log_set_file_rotate_time(uint8_t policy);
+void log_set_file_compress(uint8_t compress);
+void log_set_file_retention(size_t max_bytes);
+void log_set_file_flush(size_t buf_size, uint32_t interval_ms,
+                        uint8_t level); /* flush policy set before file_output enable */
+
+void log_set_async_enabled(bool enabled);
+void log_set_async_capacity(size_t capacity); /* capacity set before async enable */
+void log_set_async_overflow(uint8_t policy);
+void log_get_async_drops(size_t* newest, size_t* oldest);
+void log_flush(void);
+
+void log_set_time_format(uint8_t clock, uint8_t precision);
+
+void log_set_fmt(uint8_t level, size_t set);
+size_t log_get_fmt(uint8_t level);
+void log_set_line_max(size_t size);
+void log_set_encoding(uint8_t encoding);
+void log_set_rate_limit(uint32_t rate, uint32_t burst);
+void log_set_dedup(uint32_t window_ms);
+void log_set_console_stderr(uint8_t level);
+void log_set_console_nonblock(size_t backlog);
+
+void log_set_stats_enabled(bool enabled);
+void log_set_stats_report(uint32_t interval_ms);
+void log_get_stats(log_stats_t* stats);
+size_t log_get_tag_stats(log_tag_stats_t* stats, size_t num);
+
+int log_add_sink(const log_sink_t* sink);
+void log_remove_sink(int id);
+void log_set_sink_filter(int id, uint8_t level, const char* tag, uint8_t fmt);
+int log_sink_ring_init(log_sink_t* sink, size_t size);
+size_t log_sink_ring_read(void* ring, char* buf, size_t size);
+int log_sink_syslog_init(log_sink_t* sink, const char* ident);
+int log_sink_udp_init(log_sink_t* sink, const char* host, uint16_t port);
+int log_sink_flight_init(log_sink_t* sink, size_t size, const char* name);
+void log_flight_dump(void);
+
+void log_set_bin_file_output_enabled(bool enabled);
+void log_set_bin_file_name(const char* name); /* name set before bin_file_output enable */
+int log_bin_decode(const char* name, FILE* out);
 
 void log_set_filter(uint8_t level, const char* tag, const char* keyword);
 void log_set_filter_lvl(uint8_t level);
 void log_set_filter_tag(const char* tag);
 void log_set_filter_kw(const char* keyword);
+void log_add_filter_kw(const char* keyword, bool exclude);
 void log_set_filter_tag_lvl(const char* tag, uint8_t level);
 int log_get_filter_tag_lvl(const char* tag);
+void log_set_sample_lvl(uint8_t level, uint32_t rate);
+void log_set_sample_tag(const char* tag, uint32_t rate);
+void log_set_trace_id(uint64_t id);
 int log_find_lvl(const char* log);
 const char* log_find_tag(const char* log, uint8_t lvl, size_t* tag_len);
 
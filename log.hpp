@@ -0,0 +1,252 @@
+#ifndef __LOG_HPP__
+#define __LOG_HPP__
+
+/*
+ * C++17 front end of the log. The format is checked against the arguments at compile time, the
+ * arguments are captured by their types without va_list and output through the binary log call
+ * site, so the filters, sampling, rate limit, sinks and async output of log.c all apply.
+ *
+ * The tag and max level are constants of the enclosing scope:
+ *
+ *     namespace net {
+ *     ELOG_SCOPE("net", LOG_LVL_INFO);
+ *
+ *     void connect(const std::string& host, int port) {
+ *         ELOG_I("connect %s:%d", host, port);
+ *         ELOG_D("resolved");  // compiled to nothing, the scope level is info
+ *     }
+ *     }  // namespace net
+ *
+ * Without ELOG_SCOPE the scope is LOG_TAG and LOG_LVL.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "log.h"
+
+namespace elog {
+
+/* log scope, its tag and the max level which is compiled */
+struct scope {
+    const char* tag;
+    uint8_t level;
+};
+
+namespace detail {
+
+/* argument kind which the conversion is checked against */
+enum class kind : uint8_t {
+    int32 = 0, /* integer which fits in the conversion without a length modifier */
+    int64,
+    floating,
+    string,
+    pointer,
+    none, /* not supported */
+};
+
+template <typename T>
+constexpr kind kind_of() {
+    using U = std::decay_t<T>;
+
+    if constexpr (std::is_enum_v<U>) {
+        return kind_of<std::underlying_type_t<U>>();
+    } else if constexpr (std::is_integral_v<U>) {
+        return sizeof(U) <= sizeof(int) ? kind::int32 : kind::int64;
+    } else if constexpr (std::is_floating_point_v<U>) {
+        return kind::floating;
+    } else if constexpr (std::is_same_v<U, char*> || std::is_same_v<U, const char*> ||
+                         std::is_same_v<U, std::string>) {
+        return kind::string;
+    } else if constexpr (std::is_pointer_v<U> || std::is_null_pointer_v<U>) {
+        return kind::pointer;
+    } else {
+        return kind::none;
+    }
+}
+
+/* argument kinds of the call, the last one is a sentinel */
+template <kind... K>
+struct kinds {
+    static constexpr size_t size         = sizeof...(K);
+    static constexpr kind list[size + 1] = {K..., kind::none};
+};
+
+/* only used in decltype, the arguments are never evaluated */
+template <typename... T>
+kinds<kind_of<T>()...> kinds_of(const T&...);
+
+/**
+ * check whether the argument can be the conversion
+ *
+ * @param arg argument kind
+ * @param conv conversion character
+ * @param wide the conversion has a 64 bits length modifier
+ *
+ * @return true: the argument matches the conversion
+ */
+constexpr bool conv_ok(kind arg, char conv, bool wide) {
+    switch (conv) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+        return arg == kind::int32 || (arg == kind::int64 && wide);
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return arg == kind::floating;
+    case 's':
+        return arg == kind::string;
+    case 'p':
+        return arg == kind::pointer || arg == kind::string;
+    default:
+        /* %n and the unknown conversions */
+        return false;
+    }
+}
+
+/**
+ * parse the format at compile time like log_bin_vformat and check the argument kinds
+ *
+ * @param format format
+ *
+ * @return true: every conversion has its argument and no argument is left
+ */
+template <typename K>
+constexpr bool format_ok(const char* format) {
+    const char* p = format;
+    size_t n      = 0;
+    bool wide     = false;
+
+    if (K::size > LOG_BIN_ARGS_MAX) {
+        return false;
+    }
+    while (*p) {
+        if (*p != '%' || p[1] == '%') {
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+        p++;
+        /* flags */
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'') {
+            p++;
+        }
+        /* width and precision, '*' takes an int argument */
+        for (bool prec = false;; prec = true) {
+            if (*p == '*') {
+                if (K::list[n++] != kind::int32) return false;
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+            if (prec || *p != '.') break;
+            p++;
+        }
+        /* length modifier */
+        wide = false;
+        if (*p == 'h') {
+            p += p[1] == 'h' ? 2 : 1;
+        } else if (*p == 'l' || *p == 'L' || *p == 'q' || *p == 'j' || *p == 'z' || *p == 't') {
+            wide = true;
+            p += (p[0] == 'l' && p[1] == 'l') ? 2 : 1;
+        }
+        if (!conv_ok(K::list[n++], *p, wide)) {
+            return false;
+        }
+        p++;
+    }
+
+    return n == K::size;
+}
+
+/* capture the argument by its type */
+template <typename T>
+inline log_bin_arg_t arg(const T& v) {
+    using U = std::decay_t<T>;
+    log_bin_arg_t a{};
+
+    if constexpr (std::is_enum_v<U>) {
+        return arg(static_cast<std::underlying_type_t<U>>(v));
+    } else if constexpr (std::is_same_v<U, bool> ||
+                         (std::is_integral_v<U> && std::is_unsigned_v<U>)) {
+        a.type = LOG_BIN_ARG_UINT;
+        a.v.u  = v;
+    } else if constexpr (std::is_integral_v<U>) {
+        a.type = LOG_BIN_ARG_INT;
+        a.v.i  = v;
+    } else if constexpr (std::is_floating_point_v<U>) {
+        a.type = LOG_BIN_ARG_DOUBLE;
+        a.v.f  = v;
+    } else if constexpr (std::is_same_v<U, std::string>) {
+        a.type = LOG_BIN_ARG_STR;
+        a.v.s  = v.c_str();
+    } else if constexpr (std::is_same_v<U, char*> || std::is_same_v<U, const char*>) {
+        a.type = LOG_BIN_ARG_STR;
+        a.v.s  = v;
+    } else if constexpr (std::is_null_pointer_v<U>) {
+        a.type = LOG_BIN_ARG_PTR;
+        a.v.p  = nullptr;
+    } else {
+        a.type = LOG_BIN_ARG_PTR;
+        a.v.p  = reinterpret_cast<const void*>(v);
+    }
+
+    return a;
+}
+
+/* the strings are copied by log_bin_output, so the temporaries may end after the call */
+template <typename... T>
+inline void output(log_bin_site_t* site, const T&... v) {
+    const log_bin_arg_t args[sizeof...(T) + 1] = {arg(v)..., {}};
+
+    log_bin_output(site, args, sizeof...(T));
+}
+
+}  // namespace detail
+}  // namespace elog
+
+/* default scope, hidden by ELOG_SCOPE in the inner scopes */
+static constexpr elog::scope elog_scope{LOG_TAG, LOG_LVL};
+
+/* set the tag and max level of the enclosing namespace, class or block */
+#define ELOG_SCOPE(tag, level) static constexpr elog::scope elog_scope{tag, level}
+
+/*
+ * the levels above the scope level are discarded at compile time, the format must be a string
+ * literal or constexpr and is checked against the arguments
+ */
+#define ELOG(lvl, fmt, ...)                                                                    \
+    do {                                                                                       \
+        static_assert(                                                                         \
+            elog::detail::format_ok<decltype(elog::detail::kinds_of(__VA_ARGS__))>(fmt),       \
+            "log format doesn't match the arguments");                                         \
+        if constexpr ((lvl) <= elog_scope.level) {                                             \
+            static log_bin_site_t _elog_site = {0,        lvl,      elog_scope.tag, __FILE__,  \
+                                                __func__, __LINE__, fmt,            0,         \
+                                                0};                                            \
+            if (!LOG_SITE_DISABLED(&_elog_site)) {                                             \
+                elog::detail::output(&_elog_site, ##__VA_ARGS__);                              \
+            }                                                                                  \
+        }                                                                                      \
+    } while (0)
+
+#define ELOG_A(...) ELOG(LOG_LVL_ASSERT, __VA_ARGS__)
+#define ELOG_E(...) ELOG(LOG_LVL_ERROR, __VA_ARGS__)
+#define ELOG_W(...) ELOG(LOG_LVL_WARN, __VA_ARGS__)
+#define ELOG_I(...) ELOG(LOG_LVL_INFO, __VA_ARGS__)
+#define ELOG_D(...) ELOG(LOG_LVL_DEBUG, __VA_ARGS__)
+#define ELOG_V(...) ELOG(LOG_LVL_VERBOSE, __VA_ARGS__)
+
+#endif /* __LOG_HPP__ */
@@ -0,0 +1,26 @@
+/*
+ * @Description: decode the binary log file written by log_set_bin_file_output_enabled to text
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+int main(int argc, char* argv[]) {
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <binary log file>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (log_bin_decode(argv[i], stdout) != 0) {
+            fprintf(stderr, "%s: decode %s failed\n", argv[0], argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
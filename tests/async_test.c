@@ -0,0 +1,141 @@
+/*
+ * @Description: async output ring with several producers, the lines of a thread keep their order,
+ * the overflow policies drop and count the lines, and log_flush writes all queued lines
+ */
+
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_THREADS 4
+#define TEST_LINES 1000
+/* ring capacity, much less than the lines so it is full most of the time */
+#define TEST_CAPACITY 16
+
+/* output delay of the slow sink (us) */
+static int test_delay_us;
+/* max producers seen sleeping on the full ring */
+static size_t test_blocked_max;
+static bool test_running;
+
+/* a sink which makes the output thread slower than the producers */
+static void test_slow_output(void* arg, uint8_t level, const char* log, size_t size) {
+    usleep(test_delay_us);
+}
+
+static void* test_producer(void* arg) {
+    int id = (int)(intptr_t)arg, i;
+
+    for (i = 0; i < TEST_LINES; i++) log_info("async", "p%d %05d", id, i);
+
+    return NULL;
+}
+
+/* watch the sleeping producers until the producers are done */
+static void* test_watcher(void* arg) {
+    size_t blocked;
+
+    while (__atomic_load_n(&test_running, __ATOMIC_ACQUIRE)) {
+        blocked = __atomic_load_n(&g_async.blocked, __ATOMIC_RELAXED);
+        if (blocked > test_blocked_max) test_blocked_max = blocked;
+        usleep(100);
+    }
+
+    return NULL;
+}
+
+/**
+ * log from all producers and check the lines of every thread are in order
+ *
+ * @param policy LOG_ASYNC_OVERFLOW policy
+ *
+ * @return lines written to the sink
+ */
+static int test_produce(uint8_t policy) {
+    static test_ring_t ring;
+    pthread_t threads[TEST_THREADS], watcher;
+    int i, id, line, last[TEST_THREADS], lines = 0;
+    const char *text, *p;
+
+    log_set_async_overflow(policy);
+    test_ring_open(&ring, 0);
+    test_blocked_max = 0;
+    __atomic_store_n(&test_running, true, __ATOMIC_RELEASE);
+    pthread_create(&watcher, NULL, test_watcher, NULL);
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, test_producer, (void*)(intptr_t)i);
+    }
+    for (i = 0; i < TEST_THREADS; i++) pthread_join(threads[i], NULL);
+    __atomic_store_n(&test_running, false, __ATOMIC_RELEASE);
+    pthread_join(watcher, NULL);
+
+    /* the ring sink is read after log_flush */
+    text = test_ring_close(&ring);
+    for (i = 0; i < TEST_THREADS; i++) last[i] = -1;
+    for (p = text; *p; p = strchr(p, '\n') + 1) {
+        if (sscanf(p, "p%d %d", &id, &line) != 2 || id < 0 || id >= TEST_THREADS) {
+            TEST_CHECK(false, "bad line %.20s", p);
+        } else if (policy == LOG_ASYNC_OVERFLOW_BLOCK) {
+            TEST_CHECK(line == last[id] + 1, "thread %d: line %d after %d", id, line, last[id]);
+        } else {
+            TEST_CHECK(line > last[id], "thread %d: line %d after %d", id, line, last[id]);
+        }
+        last[id] = line;
+        lines++;
+        if (strchr(p, '\n') == NULL) break;
+    }
+    for (i = 0; i < TEST_THREADS && policy == LOG_ASYNC_OVERFLOW_BLOCK; i++) {
+        TEST_CHECK(last[i] == TEST_LINES - 1, "thread %d: the last line is %d", i, last[i]);
+    }
+
+    return lines;
+}
+
+static void test_async(void) {
+    static log_sink_t slow = {.output = test_slow_output, .level = LOG_LVL_VERBOSE};
+    size_t newest, oldest, newest_base, oldest_base;
+    int slow_id, lines;
+
+    log_set_async_capacity(TEST_CAPACITY);
+    log_set_async_enabled(true);
+    slow_id = log_add_sink(&slow);
+    TEST_CHECK(slow_id >= 0, "add slow sink");
+
+    /* the producers sleep on the full ring and no line is lost */
+    test_delay_us = 50;
+    lines         = test_produce(LOG_ASYNC_OVERFLOW_BLOCK);
+    TEST_CHECK(lines == TEST_THREADS * TEST_LINES, "%d lines are written", lines);
+    TEST_CHECK(test_blocked_max > 0, "the producers sleep instead of spinning");
+    TEST_CHECK(g_async.blocked == 0, "%zu producers still sleep", g_async.blocked);
+    log_get_async_drops(&newest_base, &oldest_base);
+    TEST_CHECK(newest_base == 0 && oldest_base == 0, "dropped %zu newest %zu oldest", newest_base,
+               oldest_base);
+
+    /* every line is either written or counted */
+    test_delay_us = 200;
+    lines         = test_produce(LOG_ASYNC_OVERFLOW_DROP_NEWEST);
+    log_get_async_drops(&newest, &oldest);
+    TEST_CHECK(newest > newest_base && oldest == oldest_base, "dropped %zu newest %zu oldest",
+               newest - newest_base, oldest - oldest_base);
+    TEST_CHECK(lines + (newest - newest_base) == TEST_THREADS * TEST_LINES,
+               "%d lines are written and %zu dropped", lines, newest - newest_base);
+
+    newest_base = newest;
+    lines       = test_produce(LOG_ASYNC_OVERFLOW_DROP_OLDEST);
+    log_get_async_drops(&newest, &oldest);
+    TEST_CHECK(oldest > oldest_base && newest == newest_base, "dropped %zu newest %zu oldest",
+               newest - newest_base, oldest - oldest_base);
+    TEST_CHECK(lines + (oldest - oldest_base) == TEST_THREADS * TEST_LINES,
+               "%d lines are written and %zu dropped", lines, oldest - oldest_base);
+
+    log_remove_sink(slow_id);
+    log_set_async_overflow(LOG_ASYNC_OVERFLOW_BLOCK);
+    log_set_async_enabled(false);
+}
+
+int main(void) {
+    test_init();
+    test_async();
+
+    return test_report("async_test");
+}
@@ -0,0 +1,95 @@
+/*
+ * @Description: the binary log file is decoded to the same text as the logs formatted at once
+ */
+
+#include <unistd.h>
+
+#include "test.h"
+
+/* remove the [time pid tid] parts, they differ between the output and the decode */
+static void test_strip_time(char* text) {
+    char *src = text, *dst = text, prev = '\0';
+
+    while (*src) {
+        /* the CSI color signs also start with '[' */
+        if (*src == '[' && prev != '\033' && src[1] >= '0' && src[1] <= '9' && strchr(src, ']')) {
+            src = strchr(src, ']') + 1;
+        } else {
+            prev = *src;
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+}
+
+/* the binary logs of the round trip, every call site is output once */
+static void test_bin_log(int i) {
+    log_bin(LOG_LVL_INFO, "bin", "no args");
+    log_bin(LOG_LVL_WARN, "bin", "int %d %u %x %lld %llu", -42, 7u, 0xff, -5LL, 6ULL + i);
+    log_bin(LOG_LVL_ERROR, "bin", "str %s %c %s|", "abc", 'z', "");
+    log_bin(LOG_LVL_DEBUG, "bin", "double %.2f %g", 1.5, -0.25);
+    log_bin(LOG_LVL_INFO, "bin", "width %5d|%-5d|%05x|%.3s", 1, 2, 3, "abcdef");
+}
+
+static void test_bin_decode(void) {
+    static char expect[TEST_RING_SIZE + 1], text[TEST_RING_SIZE + 1];
+    static test_ring_t ring;
+    char name[64];
+    FILE* fp;
+    size_t len;
+    int i;
+
+    snprintf(name, sizeof(name), "/tmp/log_test_%d.bin", (int)getpid());
+    unlink(name);
+    log_set_fmt(LOG_LVL_ERROR, LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_FUNC);
+    log_set_fmt(LOG_LVL_WARN, LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_FUNC);
+    log_set_fmt(LOG_LVL_INFO, LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_FUNC);
+    log_set_fmt(LOG_LVL_DEBUG, LOG_FMT_LVL | LOG_FMT_TAG | LOG_FMT_FUNC);
+
+    /* the same logs formatted at once are the expected text, the decode outputs the color */
+    test_ring_open(&ring, LOG_SINK_FMT_ALL);
+    for (i = 0; i < 3; i++) test_bin_log(i);
+    snprintf(expect, sizeof(expect), "%s", test_ring_close(&ring));
+    TEST_CHECK(test_count(expect, "no args") == 3, "bin logs formatted at once:\n%s", expect);
+
+    log_set_bin_file_name(name);
+    log_set_bin_file_output_enabled(true);
+    test_ring_open(&ring, LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR);
+    for (i = 0; i < 3; i++) test_bin_log(i);
+    TEST_CHECK(test_ring_close(&ring)[0] == '\0', "bin logs are only written to the file");
+    log_set_bin_file_output_enabled(false);
+
+    fp = tmpfile();
+    TEST_CHECK(fp != NULL, "tmpfile");
+    if (fp == NULL) return;
+    TEST_CHECK(log_bin_decode(name, fp) == 0, "decode %s", name);
+    rewind(fp);
+    len       = fread(text, 1, TEST_RING_SIZE, fp);
+    text[len] = '\0';
+    fclose(fp);
+    test_strip_time(text);
+    test_strip_time(expect);
+    TEST_CHECK(!strcmp(text, expect), "decoded text:\n%s\nexpected:\n%s", text, expect);
+
+    /* a file which isn't a binary log */
+    fp = fopen(name, "wb");
+    TEST_CHECK(fp != NULL, "open %s", name);
+    if (fp != NULL) {
+        fputs("not a binary log\n", fp);
+        fclose(fp);
+        fp = tmpfile();
+        TEST_CHECK(log_bin_decode(name, fp) == -1, "decode a broken file");
+        fclose(fp);
+    }
+    TEST_CHECK(log_bin_decode("/tmp/log_test_missing.bin", stdout) == -1, "decode a missing file");
+    unlink(name);
+
+    for (i = LOG_LVL_ASSERT; i <= LOG_LVL_VERBOSE; i++) log_set_fmt(i, LOG_FMT_ALL);
+}
+
+int main(void) {
+    test_init();
+    test_bin_decode();
+
+    return test_report("bin_test");
+}
@@ -0,0 +1,152 @@
+/*
+ * @Description: the rotated files are compressed and removed by the retention in background, the
+ * renames of the next rotations and log_flush don't wait for the compression tool
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_MAX_SIZE 1000
+#define TEST_MAX_ROTATE 5
+/* delay of the fake compression tool */
+#define TEST_TOOL_DELAY_MS 500
+
+static char test_dir[64];
+static char test_name[80];
+
+static uint64_t test_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* run the command and read its output, return the output size or -1 when it fails */
+static long test_command(const char* cmd, char* buf, size_t size) {
+    FILE* fp = popen(cmd, "r");
+    size_t len;
+
+    if (fp == NULL) return -1;
+    len      = fread(buf, 1, size - 1, fp);
+    buf[len] = '\0';
+
+    return pclose(fp) == 0 ? (long)len : -1;
+}
+
+/* the lines of one call site, they are numbered from first */
+static void test_compress_log(int first, int num) {
+    int i;
+
+    for (i = first; i < first + num; i++) log_info("compress", "line %05d", i);
+}
+
+/* check whether the file exists */
+static bool test_exists(const char* suffix, int n) {
+    char path[128];
+
+    snprintf(path, sizeof(path), "%s.%d%s", test_name, n, suffix);
+
+    return access(path, F_OK) == 0;
+}
+
+/* a slow gzip found first in PATH, it shows whether the rotation waits for the tool */
+static void test_slow_gzip(void) {
+    char path[128], gzip[128], env[512];
+    FILE* fp;
+
+    TEST_CHECK(test_command("command -v gzip", gzip, sizeof(gzip)) > 0, "gzip is not found");
+    gzip[strcspn(gzip, "\n")] = '\0';
+    snprintf(path, sizeof(path), "%s/gzip", test_dir);
+    fp = fopen(path, "w");
+    TEST_CHECK(fp != NULL, "create %s", path);
+    if (fp == NULL) return;
+    fprintf(fp, "#!/bin/sh\nsleep %d.%03d\nexec %s \"$@\"\n", TEST_TOOL_DELAY_MS / 1000,
+            TEST_TOOL_DELAY_MS % 1000, gzip);
+    fclose(fp);
+    chmod(path, 0755);
+    snprintf(env, sizeof(env), "%s:%s", test_dir, getenv("PATH") ? getenv("PATH") : "/usr/bin");
+    setenv("PATH", env, 1);
+}
+
+static void test_compress(void) {
+    char cmd[256], text[TEST_MAX_SIZE * 2], *p;
+    int n, line, expect = -1;
+    uint64_t start;
+    long len;
+
+    /* the rotations are renamed at once, the tool compresses them later */
+    log_set_file_compress(LOG_FILE_COMPRESS_GZIP);
+    start = test_now_ms();
+    test_compress_log(0, 300);
+    log_flush();
+    TEST_CHECK(test_now_ms() - start < TEST_TOOL_DELAY_MS, "log_flush waited %" PRIu64 " ms",
+               test_now_ms() - start);
+    TEST_CHECK(test_exists("", 1) || test_exists(".gz", 1), "the rotations are renamed");
+    pthread_mutex_lock(&g_rotate.lock);
+    TEST_CHECK(g_rotate.compress_head != NULL, "the compression is done in background");
+    pthread_mutex_unlock(&g_rotate.lock);
+
+    /* more rotations than kept files while compressing */
+    test_compress_log(300, 500);
+    log_flush();
+    log_compress_wait();
+    for (n = TEST_MAX_ROTATE - 1; n >= 0; n--) {
+        TEST_CHECK(!test_exists("", n) && test_exists(".gz", n), "%s.%d isn't compressed",
+                   test_name, n);
+        snprintf(cmd, sizeof(cmd), "gzip -dc %s.%d.gz", test_name, n);
+        len = test_command(cmd, text, sizeof(text));
+        TEST_CHECK(len > 0, "%s", cmd);
+        if (len <= 0) continue;
+        for (p = text; *p; p = strchr(p, '\n') + 1) {
+            TEST_CHECK(sscanf(p, "line %d", &line) == 1, "%s: bad line %.20s", cmd, p);
+            TEST_CHECK(expect < 0 || line == expect + 1, "%s: line %d after %d", cmd, line,
+                       expect);
+            expect = line;
+            if (strchr(p, '\n') == NULL) break;
+        }
+    }
+    TEST_CHECK(expect > 0 && expect < 799, "the current file keeps the last lines, %d", expect);
+    snprintf(cmd, sizeof(cmd), "ls %s | grep -q -e rotating -e compressing", test_dir);
+    TEST_CHECK(system(cmd) != 0, "temporary file is left in %s", test_dir);
+    log_set_file_compress(LOG_FILE_COMPRESS_NONE);
+
+    /* the oldest files over the retention are removed */
+    log_set_file_retention(TEST_MAX_SIZE * 2 + 100);
+    test_compress_log(800, 500);
+    log_flush();
+    log_compress_wait();
+    TEST_CHECK(test_exists("", 0) && test_exists("", 1), "the newest files are kept");
+    for (n = 2; n < TEST_MAX_ROTATE; n++) {
+        TEST_CHECK(!test_exists("", n) && !test_exists(".gz", n), "%s.%d is over the retention",
+                   test_name, n);
+    }
+    log_set_file_retention(0);
+}
+
+int main(void) {
+    char cmd[128];
+
+    test_init();
+
+    snprintf(test_dir, sizeof(test_dir), "/tmp/log_compress_test_%d", (int)getpid());
+    snprintf(test_name, sizeof(test_name), "%s/test.log", test_dir);
+    TEST_CHECK(mkdir(test_dir, 0755) == 0, "mkdir %s", test_dir);
+    test_slow_gzip();
+
+    /* message only, 11 bytes a line */
+    log_set_sink_filter(LOG_SINK_FILE, LOG_LVL_VERBOSE, NULL, 0);
+    log_set_file_name(test_name);
+    log_set_file_rotate(TEST_MAX_SIZE, TEST_MAX_ROTATE);
+    log_set_file_output_enabled(true);
+
+    test_compress();
+
+    log_set_file_output_enabled(false);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    TEST_CHECK(system(cmd) == 0, "%s", cmd);
+
+    return test_report("compress_test");
+}
@@ -0,0 +1,124 @@
+/*
+ * @Description: the non-blocking console doesn't wait for a pipe nobody reads, it keeps the lines
+ * which the pipe doesn't take in the bounded backlog and counts the dropped lines
+ */
+
+/* F_SETPIPE_SZ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_LINES 2000
+/* backlog of the console, much less than the lines */
+#define TEST_BACKLOG 4096
+/* the producer must return long before it */
+#define TEST_TIMEOUT_S 10
+
+static uint64_t test_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* read what the pipe has without waiting, return the read size */
+static size_t test_read_pipe(int fd, char* buf, size_t size) {
+    size_t len = 0;
+    ssize_t ret;
+
+    while (len < size - 1 && (ret = read(fd, buf + len, size - 1 - len)) > 0) {
+        len += ret;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* the numbered lines must be in order, the dropped lines are the gaps */
+static size_t test_check_lines(const char* text, int* last) {
+    size_t lines = 0;
+    const char* p;
+    int line;
+
+    for (p = text; *p && strchr(p, '\n'); p = strchr(p, '\n') + 1) {
+        TEST_CHECK(sscanf(p, "console line %d", &line) == 1, "bad line %.30s", p);
+        TEST_CHECK(line > *last, "line %d after %d", line, *last);
+        *last = line;
+        lines++;
+    }
+
+    return lines;
+}
+
+static void test_console(void) {
+    static char text[TEST_LINES * 32];
+    size_t drops_base, drops, piped, backlog, len;
+    int fds[2], saved, i, last = -1;
+    uint64_t start;
+    char* copy;
+
+    /* stdout is a pipe which nobody reads until the lines are logged */
+    TEST_CHECK(pipe(fds) == 0, "pipe");
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETPIPE_SZ, TEST_BACKLOG);
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    /* message only */
+    log_set_sink_filter(LOG_SINK_CONSOLE, LOG_LVL_VERBOSE, NULL, 0);
+    log_set_console_nonblock(TEST_BACKLOG);
+    drops_base = __atomic_load_n(&console_drops, __ATOMIC_RELAXED);
+    /* killed by SIGALRM when the producer blocks */
+    alarm(TEST_TIMEOUT_S);
+    start = test_now_ms();
+    for (i = 0; i < TEST_LINES; i++) log_info("console", "console line %05d", i);
+    alarm(0);
+    TEST_CHECK(test_now_ms() - start < TEST_TIMEOUT_S * 1000 / 2,
+               "the producer waited %" PRIu64 " ms", test_now_ms() - start);
+
+    /* every line is in the pipe, in the backlog or dropped */
+    pthread_mutex_lock(&console_lock);
+    backlog = g_console[0].len;
+    copy    = strndup(g_console[0].backlog, backlog);
+    pthread_mutex_unlock(&console_lock);
+    TEST_CHECK(backlog > 0 && backlog <= TEST_BACKLOG, "backlog is %zu bytes", backlog);
+    drops = __atomic_load_n(&console_drops, __ATOMIC_RELAXED) - drops_base;
+    len   = test_read_pipe(fds[0], text, sizeof(text));
+    piped = test_count(text, "\n");
+    TEST_CHECK(drops > 0, "no line is dropped");
+    TEST_CHECK(piped + test_count(copy, "\n") + drops == TEST_LINES,
+               "%zu lines in the pipe, %zu in the backlog and %zu dropped", piped,
+               test_count(copy, "\n"), drops);
+    free(copy);
+
+    /* the backlog is written before the new line when the pipe is read again */
+    log_info("console", "console line %05d", TEST_LINES);
+    for (i = 0; i < 4 && g_console[0].len > 0; i++) {
+        len += test_read_pipe(fds[0], text + len, sizeof(text) - len);
+        log_flush();
+    }
+    len += test_read_pipe(fds[0], text + len, sizeof(text) - len);
+    TEST_CHECK(g_console[0].len == 0, "%zu bytes left in the backlog", g_console[0].len);
+    TEST_CHECK(test_check_lines(text, &last) + drops == TEST_LINES + 1 && last == TEST_LINES,
+               "the lines are in order and the last line is %d", last);
+    TEST_CHECK(len > 0 && text[len - 1] == '\n', "a line is broken");
+
+    log_set_console_nonblock(0);
+    log_set_sink_filter(LOG_SINK_CONSOLE, LOG_LVL_ASSERT, "\x01", LOG_SINK_FMT_ALL);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(fds[0]);
+}
+
+int main(void) {
+    test_init();
+    test_console();
+
+    return test_report("console_test");
+}
@@ -0,0 +1,131 @@
+/*
+ * @Description: the flight recorder keeps the newest lines of every level and dumps them by
+ * log_flight_dump, LOG_ASSERT and a fatal signal
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/* flight recorder ring size, much less than the logged lines */
+#define TEST_FLIGHT_SIZE 256
+
+static char test_name[64];
+static bool test_asserted;
+
+static void test_assert_hook(const char* expr, const char* func, size_t line) {
+    test_asserted = true;
+}
+
+/* add the flight recorder which records the lines without the format */
+static int test_flight_open(void) {
+    log_sink_t sink;
+    int id;
+
+    TEST_CHECK(log_sink_flight_init(&sink, TEST_FLIGHT_SIZE, test_name) == 0, "flight init");
+    sink.fmt = 0;
+    id       = log_add_sink(&sink);
+    TEST_CHECK(id > LOG_SINK_FILE, "add flight recorder");
+
+    return id;
+}
+
+/* check the dump ends with the numbered lines up to last, the oldest line may be cut */
+static void test_check_dump(int last) {
+    char text[TEST_FLIGHT_SIZE * 2], *p;
+    int line, expect = -1;
+    long len;
+
+    len = test_read_file(test_name, text, sizeof(text));
+    TEST_CHECK(len == TEST_FLIGHT_SIZE, "dump is %ld bytes", len);
+    if (len <= 0) return;
+    /* skip the cut line */
+    for (p = strchr(text, '\n') + 1; *p; p = strchr(p, '\n') + 1) {
+        TEST_CHECK(sscanf(p, "flight %d", &line) == 1, "bad line %.20s", p);
+        TEST_CHECK(expect < 0 || line == expect + 1, "line %d after %d", line, expect);
+        expect = line;
+        if (strchr(p, '\n') == NULL) break;
+    }
+    TEST_CHECK(expect == last, "the last line is %d, expected %d", expect, last);
+}
+
+static void test_dump(void) {
+    static test_ring_t ring;
+    struct sigaction action;
+    log_sink_t other;
+    const char* text;
+    int id, i;
+
+    /* the verbose lines are recorded while the other sinks only write the warnings */
+    id = test_flight_open();
+    test_ring_open(&ring, 0);
+    log_set_sink_filter(ring.id, LOG_LVL_WARN, NULL, 0);
+    for (i = 0; i < 100; i++) log_verbose("flight", "flight %05d", i);
+    log_flight_dump();
+    test_check_dump(99);
+    text = test_ring_close(&ring);
+    TEST_CHECK(text[0] == '\0', "the verbose lines are written:\n%s", text);
+
+    /* only one recorder can be dumped */
+    TEST_CHECK(log_sink_flight_init(&other, TEST_FLIGHT_SIZE, "unused") == 0, "flight init");
+    TEST_CHECK(log_add_sink(&other) < 0, "the second flight recorder is added");
+    other.close(other.arg);
+
+    /* the producer records the line before the async output thread writes it */
+    log_set_async_enabled(true);
+    for (i = 100; i < 200; i++) log_debug("flight", "flight %05d", i);
+    log_flight_dump();
+    test_check_dump(199);
+    log_set_async_enabled(false);
+
+    /* dumped before the assert hook */
+    log_assert_set_hook(test_assert_hook);
+    for (i = 200; i < 300; i++) log_info("flight", "flight %05d", i);
+    remove(test_name);
+    LOG_ASSERT(i < 300);
+    TEST_CHECK(test_asserted, "the assert hook isn't called");
+    test_check_dump(299);
+    log_assert_set_hook(NULL);
+
+    /* the signal actions are restored and the dump does nothing after the removal */
+    log_remove_sink(id);
+    TEST_CHECK(sigaction(SIGSEGV, NULL, &action) == 0 && action.sa_handler == SIG_DFL,
+               "the SIGSEGV action isn't restored");
+    remove(test_name);
+    log_flight_dump();
+    TEST_CHECK(access(test_name, F_OK) != 0, "the removed recorder is dumped");
+}
+
+/* the crashed child dumps its recorder and is still killed by the signal */
+static void test_crash(void) {
+    struct rlimit core = {0, 0};
+    int status, i;
+    pid_t pid;
+
+    remove(test_name);
+    pid = fork();
+    TEST_CHECK(pid >= 0, "fork");
+    if (pid == 0) {
+        setrlimit(RLIMIT_CORE, &core);
+        test_flight_open();
+        for (i = 300; i < 400; i++) log_info("flight", "flight %05d", i);
+        raise(SIGSEGV);
+        _exit(0);
+    }
+    TEST_CHECK(waitpid(pid, &status, 0) == pid, "waitpid");
+    TEST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, "child status 0x%x", status);
+    test_check_dump(399);
+    remove(test_name);
+}
+
+int main(void) {
+    test_init();
+    snprintf(test_name, sizeof(test_name), "/tmp/log_flight_test_%d.log", (int)getpid());
+
+    test_dump();
+    test_crash();
+
+    return test_report("flight_test");
+}
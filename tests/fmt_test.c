@@ -0,0 +1,103 @@
+/*
+ * @Description: the fast formatter is compared with vsnprintf byte by byte
+ */
+
+#include <limits.h>
+#include <sys/types.h>
+
+#include "test.h"
+
+/**
+ * compare the fast formatter with vsnprintf at several buffer sizes, including the bytes after
+ * the written ones
+ *
+ * @param fast true: the format must be done by the fast path
+ * @param format format
+ * @param ... args
+ */
+static void __attribute__((format(printf, 2, 3))) test_fmt(bool fast, const char* format, ...) {
+    static const size_t sizes[] = {0, 1, 2, 5, 16, 64, 512};
+    char expect[600], actual[600];
+    int expect_len, actual_len;
+    va_list args, copy;
+    size_t i;
+
+    va_start(args, format);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        memset(expect, 0x5a, sizeof(expect));
+        memset(actual, 0x5a, sizeof(actual));
+        va_copy(copy, args);
+        expect_len = vsnprintf(expect, sizes[i], format, copy);
+        va_end(copy);
+
+        va_copy(copy, args);
+        actual_len = log_vfmt_fast(actual, sizes[i], format, copy);
+        va_end(copy);
+        if (fast) {
+            TEST_CHECK(actual_len >= 0, "\"%s\" isn't done by the fast path", format);
+        }
+        if (actual_len >= 0) {
+            TEST_CHECK(actual_len == expect_len && !memcmp(actual, expect, sizeof(expect)),
+                       "\"%s\" size %zu: \"%.*s\" (%d) != \"%.*s\" (%d)", format, sizes[i],
+                       (int)strnlen(actual, sizeof(actual)), actual, actual_len,
+                       (int)strnlen(expect, sizeof(expect)), expect, expect_len);
+        }
+
+        /* log_vsnprintf falls back to vsnprintf for the unsupported formats */
+        memset(actual, 0x5a, sizeof(actual));
+        va_copy(copy, args);
+        actual_len = log_vsnprintf(actual, sizes[i], format, copy);
+        va_end(copy);
+        TEST_CHECK(actual_len == expect_len && !memcmp(actual, expect, sizeof(expect)),
+                   "log_vsnprintf \"%s\" size %zu", format, sizes[i]);
+    }
+    va_end(args);
+}
+
+static void test_formatter(void) {
+    static const char long_str[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmno";
+    int x;
+
+    test_fmt(true, "plain text");
+    test_fmt(true, "%%");
+    test_fmt(true, "100%% %d%%", 5);
+    test_fmt(true, "%d", 0);
+    test_fmt(true, "%d", -1);
+    test_fmt(true, "%d %d", INT_MAX, INT_MIN);
+    test_fmt(true, "%i", 42);
+    test_fmt(true, "%5d|%-5d|%05d", 42, 42, -42);
+    test_fmt(true, "%+d % d %+d % d", 42, 42, -42, -42);
+    test_fmt(true, "%.3d|%8.3d|%-8.3d|%+.3d", 7, -7, 7, 7);
+    test_fmt(true, "%.0d|%5.0d|%.0x|%#.0o", 0, 0, 0, 0);
+    test_fmt(true, "%u %u", 0, UINT_MAX);
+    test_fmt(true, "%x %X", 0xdeadbeef, 0xdeadbeef);
+    test_fmt(true, "%#x %#X %#o %#x %#o", 255, 255, 8, 0, 0);
+    test_fmt(true, "%#10x|%-#10x|%#010x", 255, 255, 255);
+    test_fmt(true, "%o %.5o %#.5o", 511, 511, 511);
+    test_fmt(true, "%hhd %hhu %hd %hu", -1, 300, 70000, 70000);
+    test_fmt(true, "%ld %ld %lu", LONG_MIN, LONG_MAX, ULONG_MAX);
+    test_fmt(true, "%lld %lld %llu %llx", LLONG_MIN, LLONG_MAX, ULLONG_MAX, ULLONG_MAX);
+    test_fmt(true, "%zu %zd %zx", SIZE_MAX, (ssize_t)-5, (size_t)0x1234);
+    test_fmt(true, "%jd %ju", INTMAX_MIN, UINTMAX_MAX);
+    test_fmt(true, "%c|%3c|%-3c|", 'A', 'b', 'c');
+    test_fmt(true, "%s|%10s|%-10s|", "hello", "hi", "hi");
+    test_fmt(true, "%.2s|%.0s|%5.3s|%-5.3s|", "hello", "hello", "hello", "hello");
+    test_fmt(true, "%s", "");
+    test_fmt(true, "%s", long_str);
+    test_fmt(true, "%*d|%-*d|%*d|", 6, 42, 6, 42, -6, 42);
+    test_fmt(true, "%.*s|%.*d|%.*d", 3, "abcdef", 4, 7, -1, 7);
+    test_fmt(true, "%p", (void*)&x);
+    test_fmt(true, "[%s:%d] %s=%#06x %-8s|%+5ld", "main.c", 123, "flags", 0x1f, "ok", -9L);
+
+    /* unsupported conversions go to vsnprintf */
+    test_fmt(false, "%f %.2f %e %g", 1.5, -2.25, 1e10, 0.0001);
+    test_fmt(false, "%d %f", 3, 2.5);
+    test_fmt(false, "%p", NULL);
+}
+
+int main(void) {
+    test_init();
+    test_formatter();
+
+    return test_report("fmt_test");
+}
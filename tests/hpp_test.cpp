@@ -0,0 +1,68 @@
+/*
+ * @Description: C++17 front end, the scope sets the tag and compiles out the levels above it, the
+ * arguments are captured by their types and formatted like printf
+ */
+
+#include <cinttypes>
+#include <string>
+
+#include "log.hpp"
+#include "test.h"
+
+/* never defined, the program only links when the calls are compiled out */
+int test_not_compiled();
+
+namespace hpp {
+
+ELOG_SCOPE("hpp", LOG_LVL_INFO);
+
+enum class color : int { red = 1, green = 2 };
+enum wide : uint64_t { wide_max = UINT64_MAX };
+
+/* the levels above the scope level are compiled to nothing, the arguments aren't evaluated */
+static void log_disabled() {
+    ELOG_D("debug %d", test_not_compiled());
+    ELOG_V("verbose %d", test_not_compiled());
+}
+
+static void log_args() {
+    std::string name = "string value";
+    int64_t i64      = INT64_MIN;
+    uint64_t u64     = UINT64_MAX;
+
+    ELOG_I("str %s tmp %s", name, std::string("temp") + " value");
+    ELOG_I("enum %d wide %" PRIu64, color::green, wide_max);
+    ELOG_W("i64 %" PRId64 " u64 %" PRIu64 " hex %" PRIx64, i64, u64, u64 >> 4);
+}
+
+}  // namespace hpp
+
+static void test_hpp() {
+    static test_ring_t ring;
+    char expect[256];
+    const char* text;
+
+    /* message and tag only */
+    test_ring_open(&ring, LOG_SINK_FMT_TAG);
+    hpp::log_disabled();
+    hpp::log_args();
+    text = test_ring_close(&ring);
+
+    TEST_CHECK(strstr(text, "debug") == NULL && strstr(text, "verbose") == NULL,
+               "disabled level is output:\n%s", text);
+    TEST_CHECK(test_count(text, "hpp") == 3, "the scope tag is used:\n%s", text);
+    TEST_CHECK(strstr(text, "str string value tmp temp value\n") != NULL,
+               "std::string arguments:\n%s", text);
+    snprintf(expect, sizeof(expect), "enum %d wide %" PRIu64 "\n", 2, UINT64_MAX);
+    TEST_CHECK(strstr(text, expect) != NULL, "enum arguments, expected %s:\n%s", expect, text);
+    snprintf(expect, sizeof(expect), "i64 %" PRId64 " u64 %" PRIu64 " hex %" PRIx64 "\n",
+             INT64_MIN, UINT64_MAX, UINT64_MAX >> 4);
+    TEST_CHECK(strstr(text, expect) != NULL, "64 bits arguments, expected %s:\n%s", expect, text);
+}
+
+int main() {
+    test_init();
+    test_hpp();
+
+    return test_report("hpp_test");
+}
@@ -0,0 +1,58 @@
+/*
+ * @Description: rate limit and repeated line suppression of the call sites
+ */
+
+#include <unistd.h>
+
+#include "test.h"
+
+/* the lines of one call site, the rate limit is kept by the site */
+static void test_limit_log(int num) {
+    int i;
+
+    for (i = 0; i < num; i++) log_info("limit", "rate limited line %d", i);
+}
+
+static void test_rate_limit(void) {
+    static test_ring_t ring;
+    const char* text;
+    int i;
+
+    /* one line per second after a burst of 5, the loop ends long before the next token */
+    log_set_rate_limit(1, 5);
+    test_ring_open(&ring, LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR);
+    test_limit_log(100);
+    text = test_ring_close(&ring);
+    TEST_CHECK(test_count(text, "rate limited line") == 5, "burst of 5 lines:\n%s", text);
+    TEST_CHECK(strstr(text, "rate limited line 4\n") != NULL, "the burst is the first lines");
+    TEST_CHECK(strstr(text, "lines dropped by the rate limit count=95\n") != NULL,
+               "dropped count reported by the flush:\n%s", text);
+
+    /* a token is added a second later */
+    usleep(1100 * 1000);
+    test_ring_open(&ring, LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR);
+    test_limit_log(100);
+    text = test_ring_close(&ring);
+    TEST_CHECK(test_count(text, "rate limited line") == 1, "one line per second:\n%s", text);
+    TEST_CHECK(strstr(text, "lines dropped by the rate limit count=99\n") != NULL,
+               "dropped count report:\n%s", text);
+    log_set_rate_limit(0, 0);
+
+    /* the repeated message of a site is dropped and counted */
+    log_set_dedup(10000);
+    test_ring_open(&ring, LOG_SINK_FMT_ALL & ~LOG_SINK_FMT_COLOR);
+    for (i = 0; i < 10; i++) log_info("dedup", "%s", i < 9 ? "same message" : "other message");
+    text = test_ring_close(&ring);
+    TEST_CHECK(test_count(text, "same message") == 1, "repeated lines dropped:\n%s", text);
+    TEST_CHECK(test_count(text, "other message") == 1, "new message output:\n%s", text);
+    TEST_CHECK(strstr(text, "last message repeated count=8\n") != NULL,
+               "repeat count report:\n%s", text);
+    log_set_dedup(0);
+}
+
+int main(void) {
+    test_init();
+    test_rate_limit();
+
+    return test_report("limit_test");
+}
@@ -0,0 +1,114 @@
+/*
+ * @Description: the mapped file is appended after the data of the last process, rotated when the
+ * segment is full, and the rotated files are cut to their data
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_MAX_SIZE 1000
+#define TEST_MAX_ROTATE 5
+
+static char test_dir[64];
+static char test_name[80];
+
+/* the lines of one call site, they are numbered from first */
+static void test_mmap_log(int first, int num) {
+    int i;
+
+    for (i = first; i < first + num; i++) log_info("mmap", "line %05d", i);
+}
+
+/**
+ * check the rotated files from the oldest to the current file, the numbered lines must be in
+ * order and end with last
+ *
+ * @param last number of the last line
+ * @param mapped the current file is still mapped and ends with the preallocated zeros
+ */
+static void test_check_files(int last, bool mapped) {
+    static char text[TEST_MAX_SIZE * 4];
+    int n, line, expect = -1;
+    char path[128], *p;
+    long len;
+
+    for (n = TEST_MAX_ROTATE - 1; n >= -1; n--) {
+        if (n >= 0) {
+            snprintf(path, sizeof(path), "%s.%d", test_name, n);
+        } else {
+            snprintf(path, sizeof(path), "%s", test_name);
+        }
+        len = test_read_file(path, text, sizeof(text));
+        TEST_CHECK(len > 0, "%s is missing", path);
+        if (len <= 0) continue;
+        TEST_CHECK(len <= TEST_MAX_SIZE, "%s is %ld bytes", path, len);
+        TEST_CHECK((n < 0 && mapped) || (long)strlen(text) == len,
+                   "%s has the preallocated zeros", path);
+        for (p = text; *p; p = strchr(p, '\n') + 1) {
+            TEST_CHECK(sscanf(p, "line %d", &line) == 1, "%s: bad line %.20s", path, p);
+            TEST_CHECK(expect < 0 || line == expect + 1, "%s: line %d after %d", path, line,
+                       expect);
+            expect = line;
+            if (strchr(p, '\n') == NULL) break;
+        }
+    }
+    TEST_CHECK(expect == last, "the last line is %d, expected %d", expect, last);
+}
+
+static void test_mmap(void) {
+    char path[128], text[TEST_MAX_SIZE + 1];
+    struct stat st;
+    FILE* fp;
+
+    snprintf(test_dir, sizeof(test_dir), "/tmp/log_mmap_test_%d", (int)getpid());
+    snprintf(test_name, sizeof(test_name), "%s/test.log", test_dir);
+    TEST_CHECK(mkdir(test_dir, 0755) == 0, "mkdir %s", test_dir);
+
+    /* the file of a crashed process ends with the preallocated zeros */
+    fp = fopen(test_name, "w");
+    TEST_CHECK(fp != NULL, "create %s", test_name);
+    if (fp == NULL) return;
+    fputs("line 00000\n", fp);
+    TEST_CHECK(ftruncate(fileno(fp), TEST_MAX_SIZE) == 0, "preallocate %s", test_name);
+    fclose(fp);
+
+    /* message only, 11 bytes a line */
+    log_set_sink_filter(LOG_SINK_FILE, LOG_LVL_VERBOSE, NULL, 0);
+    log_set_file_name(test_name);
+    log_set_file_rotate(TEST_MAX_SIZE, TEST_MAX_ROTATE);
+    log_set_file_mmap_enabled(true);
+    log_set_file_output_enabled(true);
+    TEST_CHECK(g_log.mmap_seg != NULL, "%s is mapped", test_name);
+
+    /* appended after the data */
+    test_mmap_log(1, 9);
+    log_flush();
+    TEST_CHECK(stat(test_name, &st) == 0 && st.st_size == TEST_MAX_SIZE, "%s is preallocated",
+               test_name);
+    TEST_CHECK(test_read_file(test_name, text, sizeof(text)) == TEST_MAX_SIZE &&
+                   strlen(text) == 110,
+               "the logs follow the data of the last process");
+
+    /* back to back rotations of the full segments */
+    test_mmap_log(10, 990);
+    log_flush();
+    test_check_files(999, true);
+    snprintf(path, sizeof(path), "%s.%d", test_name, TEST_MAX_ROTATE);
+    TEST_CHECK(access(path, F_OK) != 0, "%s exists", path);
+
+    /* the current file is cut to its data when closed */
+    log_set_file_output_enabled(false);
+    test_check_files(999, false);
+
+    snprintf(path, sizeof(path), "rm -rf %s", test_dir);
+    TEST_CHECK(system(path) == 0, "%s", path);
+}
+
+int main(void) {
+    test_init();
+    test_mmap();
+
+    return test_report("mmap_test");
+}
@@ -0,0 +1,146 @@
+/*
+ * @Description: the rotated files keep the xxx.log.0..n layout and all lines in order, also with
+ * the rotating files which a crash left behind
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_MAX_SIZE 1000
+#define TEST_MAX_ROTATE 5
+
+static char test_dir[64];
+static char test_name[80];
+
+static void test_write_file(const char* path, const char* text) {
+    FILE* fp = fopen(path, "w");
+
+    TEST_CHECK(fp != NULL, "create %s", path);
+    if (fp == NULL) return;
+    fputs(text, fp);
+    fclose(fp);
+}
+
+/* remove the test files */
+static void test_clean(void) {
+    char cmd[128];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    TEST_CHECK(system(cmd) == 0, "%s", cmd);
+}
+
+/* the lines of one call site, they are numbered from first */
+static void test_rotate_log(int first, int num) {
+    int i;
+
+    for (i = first; i < first + num; i++) log_info("rotate", "line %05d", i);
+}
+
+/**
+ * check the rotated files from the oldest to the current file, the numbered lines must be in
+ * order and end with last
+ *
+ * @param oldest the oldest rotated file number
+ * @param last number of the last line
+ * @param extra text expected at the start of the rotated files, NULL: none
+ */
+static void test_check_files(int oldest, int last, const char* const* extra) {
+    static char text[TEST_MAX_SIZE * 4];
+    int n, line, expect = -1, extra_n = 0;
+    char path[128], *p;
+    long len;
+
+    for (n = oldest; n >= -1; n--) {
+        if (n >= 0) {
+            snprintf(path, sizeof(path), "%s.%d", test_name, n);
+        } else {
+            snprintf(path, sizeof(path), "%s", test_name);
+        }
+        len = test_read_file(path, text, sizeof(text));
+        TEST_CHECK(len >= 0, "%s is missing", path);
+        if (len < 0) continue;
+        if (n >= 0) {
+            TEST_CHECK(len > 0, "%s is empty", path);
+        }
+        if (extra && extra[extra_n] && !strcmp(text, extra[extra_n])) {
+            extra_n++;
+            continue;
+        }
+        TEST_CHECK(n < 0 || len <= TEST_MAX_SIZE + 64, "%s is %ld bytes", path, len);
+        for (p = text; *p; p = strchr(p, '\n') + 1) {
+            TEST_CHECK(sscanf(p, "line %d", &line) == 1, "%s: bad line %.20s", path, p);
+            TEST_CHECK(expect < 0 || line == expect + 1, "%s: line %d after %d", path, line,
+                       expect);
+            expect = line;
+            if (strchr(p, '\n') == NULL) break;
+        }
+    }
+    TEST_CHECK(expect == last, "the last line is %d, expected %d", expect, last);
+    TEST_CHECK(extra == NULL || extra[extra_n] == NULL, "leftover file %d isn't rotated",
+               extra_n);
+
+    /* only xxx.log.0..max_rotate-1 are kept */
+    snprintf(path, sizeof(path), "%s.%d", test_name, TEST_MAX_ROTATE);
+    TEST_CHECK(access(path, F_OK) != 0, "%s exists", path);
+}
+
+/* the rotating files are renamed when the rotation is done */
+static void test_check_no_rotating(void) {
+    char cmd[160];
+
+    snprintf(cmd, sizeof(cmd), "ls %s | grep -q rotating", test_dir);
+    TEST_CHECK(system(cmd) != 0, "rotating file is left in %s", test_dir);
+}
+
+static void test_rotate(void) {
+    static const char* const leftover[] = {"crash 1\n", "crash 2\n", NULL};
+    char path[128], text[16];
+    int i;
+
+    snprintf(test_dir, sizeof(test_dir), "/tmp/log_rotate_test_%d", (int)getpid());
+    snprintf(test_name, sizeof(test_name), "%s/test.log", test_dir);
+    TEST_CHECK(mkdir(test_dir, 0755) == 0, "mkdir %s", test_dir);
+
+    /* message only, 11 bytes a line */
+    log_set_sink_filter(LOG_SINK_FILE, LOG_LVL_VERBOSE, NULL, 0);
+    log_set_file_name(test_name);
+    log_set_file_rotate(TEST_MAX_SIZE, TEST_MAX_ROTATE);
+    log_set_file_output_enabled(true);
+
+    /* back to back rotations, the oldest files are removed */
+    for (i = 0; i < 10; i++) test_rotate_log(i * 100, 100);
+    log_flush();
+    test_check_no_rotating();
+    test_check_files(TEST_MAX_ROTATE - 1, 999, NULL);
+
+    /* the rotating files of a crashed process are rotated in their id order when reopened */
+    log_set_file_output_enabled(false);
+    snprintf(path, sizeof(path), "%s.rotating.1000", test_name);
+    test_write_file(path, "crash 1\n");
+    snprintf(path, sizeof(path), "%s.rotating.1001", test_name);
+    test_write_file(path, "crash 2\n");
+    log_set_file_output_enabled(true);
+    log_flush();
+    test_check_no_rotating();
+    snprintf(path, sizeof(path), "%s.0", test_name);
+    TEST_CHECK(test_read_file(path, text, sizeof(text)) > 0 && !strcmp(text, "crash 2\n"),
+               "the newest leftover is %s", path);
+
+    /* the new rotations follow the recovered ones */
+    test_rotate_log(1000, 100);
+    log_flush();
+    test_check_no_rotating();
+    test_check_files(TEST_MAX_ROTATE - 1, 1099, leftover);
+
+    log_set_file_output_enabled(false);
+    test_clean();
+}
+
+int main(void) {
+    test_init();
+    test_rotate();
+
+    return test_report("rotate_test");
+}
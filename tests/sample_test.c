@@ -0,0 +1,70 @@
+/*
+ * @Description: level, tag and trace sampling
+ */
+
+#include "test.h"
+
+static void test_sampling(void) {
+    static test_ring_t ring;
+    size_t count, rate2, rate5;
+    const char* text;
+    uint64_t trace;
+    int i;
+
+    /* 1 in 10 random sampling, the xorshift keeps it within a few percent over 10000 lines */
+    log_set_sample_lvl(LOG_LVL_DEBUG, 10);
+    test_ring_open(&ring, LOG_SINK_FMT_LVL);
+    for (i = 0; i < 10000; i++) log_debug("sample", "sampled");
+    log_info("sample", "not sampled");
+    text  = test_ring_close(&ring);
+    count = test_count(text, "sampled\n") - 1;
+    TEST_CHECK(count >= 800 && count <= 1200, "1 in 10 sampling output %zu lines", count);
+    TEST_CHECK(strstr(text, "not sampled") != NULL, "other levels aren't sampled");
+
+    /* the tag rate overrides the level rate */
+    log_set_sample_tag("all", 1);
+    log_set_sample_tag("none", 1000000000);
+    test_ring_open(&ring, LOG_SINK_FMT_LVL);
+    for (i = 0; i < 1000; i++) {
+        log_debug("all", "tag all");
+        log_debug("none", "tag none");
+    }
+    text = test_ring_close(&ring);
+    TEST_CHECK(test_count(text, "tag all") == 1000, "tag rate 1 outputs all lines");
+    TEST_CHECK(test_count(text, "tag none") <= 1, "tag rate 1e9 outputs almost nothing");
+    log_set_sample_tag("all", 0);
+    log_set_sample_tag("none", 0);
+
+    /* the logs of a trace are all output or all dropped, a trace sampled at 10 also is at 5, 2 */
+    for (trace = 1; trace < 1000; trace++) {
+        log_set_trace_id(trace);
+        test_ring_open(&ring, LOG_SINK_FMT_LVL);
+        for (i = 0; i < 20; i++) log_debug("trace", "traced");
+        count = test_count(test_ring_close(&ring), "traced");
+        TEST_CHECK(count == 0 || count == 20, "trace %llu output %zu of 20 lines",
+                   (unsigned long long)trace, count);
+        if (count == 0) continue;
+
+        log_set_sample_lvl(LOG_LVL_DEBUG, 5);
+        test_ring_open(&ring, LOG_SINK_FMT_LVL);
+        for (i = 0; i < 20; i++) log_debug("trace", "traced");
+        rate5 = test_count(test_ring_close(&ring), "traced");
+        log_set_sample_lvl(LOG_LVL_DEBUG, 2);
+        test_ring_open(&ring, LOG_SINK_FMT_LVL);
+        for (i = 0; i < 20; i++) log_debug("trace", "traced");
+        rate2 = test_count(test_ring_close(&ring), "traced");
+        TEST_CHECK(rate5 == 20 && rate2 == 20, "trace %llu sampled at 10 but %zu/%zu at 5/2",
+                   (unsigned long long)trace, rate5, rate2);
+        break;
+    }
+    TEST_CHECK(trace < 1000, "no trace sampled at 1 in 10");
+    log_set_trace_id(0);
+    log_set_sample_lvl(LOG_LVL_DEBUG, 0);
+}
+
+int main(void) {
+    test_init();
+    test_sampling();
+
+    return test_report("sample_test");
+}
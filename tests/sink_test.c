@@ -0,0 +1,240 @@
+/*
+ * @Description: the sinks are added and removed while other threads log, every sink has its own
+ * level, tag and format filter, and the ring, syslog and UDP sinks output the lines
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TEST_THREADS 4
+/* times a sink is added and removed while the threads log */
+#define TEST_ROUNDS 200
+
+static bool test_running;
+
+/* a sink which counts its lines and the lines output after it is closed */
+typedef struct {
+    size_t lines;
+    size_t late; /* output after close */
+    bool closed;
+} test_counter_t;
+
+static void test_counter_output(void* arg, uint8_t level, const char* log, size_t size) {
+    test_counter_t* counter = arg;
+
+    if (__atomic_load_n(&counter->closed, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&counter->late, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&counter->lines, 1, __ATOMIC_RELAXED);
+}
+
+static void test_counter_close(void* arg) {
+    test_counter_t* counter = arg;
+
+    __atomic_store_n(&counter->closed, true, __ATOMIC_RELEASE);
+}
+
+static int test_fail_open(void* arg) { return -1; }
+
+static void* test_producer(void* arg) {
+    int i = 0;
+
+    while (__atomic_load_n(&test_running, __ATOMIC_ACQUIRE)) log_info("sink", "line %d", i++);
+
+    return NULL;
+}
+
+/* the sink is removed while it is being written, it isn't used after its close */
+static void test_remove_while_logging(size_t async_capacity) {
+    static test_counter_t counters[TEST_ROUNDS];
+    log_sink_t sink = {.output         = test_counter_output,
+                       .close          = test_counter_close,
+                       .level          = LOG_LVL_VERBOSE,
+                       .fmt            = LOG_SINK_FMT_ALL,
+                       .async_capacity = async_capacity};
+    pthread_t threads[TEST_THREADS];
+    size_t lines = 0, late = 0;
+    int i, id;
+
+    memset(counters, 0, sizeof(counters));
+    __atomic_store_n(&test_running, true, __ATOMIC_RELEASE);
+    for (i = 0; i < TEST_THREADS; i++) pthread_create(&threads[i], NULL, test_producer, NULL);
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        sink.arg = &counters[i];
+        id       = log_add_sink(&sink);
+        TEST_CHECK(id > LOG_SINK_FILE, "add sink round %d", i);
+        usleep(100);
+        log_remove_sink(id);
+        lines += counters[i].lines;
+    }
+    __atomic_store_n(&test_running, false, __ATOMIC_RELEASE);
+    for (i = 0; i < TEST_THREADS; i++) pthread_join(threads[i], NULL);
+    log_flush();
+
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        TEST_CHECK(counters[i].closed, "sink of round %d isn't closed", i);
+        late += counters[i].late;
+    }
+    TEST_CHECK(late == 0, "%zu lines output after the sink is closed", late);
+    TEST_CHECK(lines > 0, "the sinks got no line");
+}
+
+static void test_add_remove(void) {
+    static test_counter_t counter;
+    log_sink_t sink = {.output = test_counter_output, .arg = &counter, .level = LOG_LVL_VERBOSE};
+    int ids[LOG_SINK_MAX_NUM], i, n;
+
+    /* every free id is used once */
+    for (n = 0; (ids[n] = log_add_sink(&sink)) >= 0; n++) {
+        TEST_CHECK(ids[n] > LOG_SINK_FILE, "sink id %d", ids[n]);
+        TEST_CHECK(n == 0 || ids[n] != ids[n - 1], "sink id %d is used twice", ids[n]);
+    }
+    TEST_CHECK(n == LOG_SINK_MAX_NUM - LOG_SINK_FILE - 1, "%d sinks are added", n);
+    for (i = 0; i < n; i++) log_remove_sink(ids[i]);
+    TEST_CHECK(sink_active == ((1u << LOG_SINK_CONSOLE) | (1u << LOG_SINK_FILE)),
+               "sinks left 0x%x", sink_active);
+
+    /* the sink whose open fails isn't added */
+    sink.open = test_fail_open;
+    TEST_CHECK(log_add_sink(&sink) < 0, "the sink is added after its open failed");
+    TEST_CHECK(sink_active == ((1u << LOG_SINK_CONSOLE) | (1u << LOG_SINK_FILE)),
+               "sinks left 0x%x", sink_active);
+
+    test_remove_while_logging(0);
+    log_set_async_enabled(true);
+    test_remove_while_logging(0);
+    test_remove_while_logging(64);
+    log_set_async_enabled(false);
+}
+
+static void test_filter(void) {
+    static test_ring_t all, warn, net;
+    const char* text;
+
+    test_ring_open(&all, 0);
+    test_ring_open(&warn, 0);
+    test_ring_open(&net, LOG_SINK_FMT_TAG);
+    log_set_sink_filter(warn.id, LOG_LVL_WARN, NULL, 0);
+    log_set_sink_filter(net.id, LOG_LVL_VERBOSE, "net", LOG_SINK_FMT_TAG);
+
+    log_debug("disk", "debug disk");
+    log_warn("disk", "warn disk");
+    log_info("network", "info network");
+    log_error("net", "error net");
+
+    /* the net sink drops its tag filter and keeps the message only */
+    log_set_sink_filter(net.id, LOG_LVL_VERBOSE, NULL, 0);
+    log_info("disk", "info disk");
+
+    text = test_ring_close(&all);
+    TEST_CHECK(!strcmp(text, "debug disk\nwarn disk\ninfo network\nerror net\ninfo disk\n"),
+               "all levels and tags:\n%s", text);
+    text = test_ring_close(&warn);
+    TEST_CHECK(!strcmp(text, "warn disk\nerror net\n"), "warn and higher levels:\n%s", text);
+    text = test_ring_close(&net);
+    TEST_CHECK(test_count(text, "disk") == 1 && strstr(text, "info disk\n") != NULL,
+               "the other tags:\n%s", text);
+    TEST_CHECK(test_count(text, "network") == 2, "the tag is in the format:\n%s", text);
+    TEST_CHECK(test_count(text, "error net\n") == 1 && test_count(text, "net") == 4,
+               "the tags containing net:\n%s", text);
+}
+
+static void test_ring(void) {
+    static const char line[] = "0123456789\n";
+    log_sink_t sink;
+    char buf[64];
+    size_t len;
+    int id, i;
+
+    /* the ring keeps the newest bytes */
+    TEST_CHECK(log_sink_ring_init(&sink, 32) == 0, "ring init");
+    sink.fmt = 0;
+    id       = log_add_sink(&sink);
+    TEST_CHECK(id > LOG_SINK_FILE, "add ring sink");
+    for (i = 0; i < 5; i++) log_info("ring", "%d123456789", i);
+    log_flush();
+    len = log_sink_ring_read(sink.arg, buf, sizeof(buf));
+    TEST_CHECK(len == 32 && !memcmp(buf, "123456789\n3123456789\n4123456789\n", 32),
+               "ring content %.*s", (int)len, buf);
+    len = log_sink_ring_read(sink.arg, buf, sizeof(line) - 1);
+    TEST_CHECK(len == sizeof(line) - 1 && !memcmp(buf, "4123456789\n", len),
+               "the newest bytes are read %.*s", (int)len, buf);
+
+    /* a line longer than the ring keeps its end */
+    log_info("ring", "%s%s%s%s", line, line, line, "end");
+    log_flush();
+    len = log_sink_ring_read(sink.arg, buf, sizeof(buf));
+    TEST_CHECK(len == 32 && !memcmp(buf + 32 - 5, "\nend\n", 5), "ring content %.*s", (int)len,
+               buf);
+    log_remove_sink(id);
+}
+
+/* the syslog sinks share the connection, the last one closes it */
+static void test_syslog(void) {
+    log_sink_t first, second;
+    int id1, id2;
+
+    TEST_CHECK(log_sink_syslog_init(&first, "sink_test") == 0, "syslog init");
+    TEST_CHECK(log_sink_syslog_init(&second, "ignored") == 0, "second syslog init");
+    id1 = log_add_sink(&first);
+    id2 = log_add_sink(&second);
+    TEST_CHECK(id1 > LOG_SINK_FILE && id2 > LOG_SINK_FILE, "add syslog sinks");
+    TEST_CHECK(syslog_users == 2 && !strcmp(syslog_ident, "sink_test"), "syslog ident %s",
+               syslog_ident);
+    log_info("syslog", "sink test line");
+    log_remove_sink(id1);
+    TEST_CHECK(syslog_users == 1 && syslog_ident != NULL, "the syslog is closed by one sink");
+    log_remove_sink(id2);
+    TEST_CHECK(syslog_users == 0 && syslog_ident == NULL, "the syslog isn't closed");
+}
+
+/* every line is a datagram, the level filter of the sink applies */
+static void test_udp(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    struct timeval timeout  = {.tv_sec = 1};
+    socklen_t addr_len      = sizeof(addr);
+    log_sink_t sink;
+    char buf[128];
+    ssize_t len;
+    int fd, id;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    TEST_CHECK(fd >= 0, "socket");
+    TEST_CHECK(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "bind");
+    TEST_CHECK(getsockname(fd, (struct sockaddr*)&addr, &addr_len) == 0, "getsockname");
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    TEST_CHECK(log_sink_udp_init(&sink, "127.0.0.1", ntohs(addr.sin_port)) == 0, "udp init");
+    sink.level = LOG_LVL_INFO;
+    sink.fmt   = 0;
+    id         = log_add_sink(&sink);
+    TEST_CHECK(id > LOG_SINK_FILE, "add udp sink");
+    log_info("udp", "first datagram");
+    log_debug("udp", "filtered datagram");
+    log_warn("udp", "second datagram");
+    log_flush();
+    log_remove_sink(id);
+
+    len = recv(fd, buf, sizeof(buf), 0);
+    TEST_CHECK(len == 15 && !memcmp(buf, "first datagram\n", 15), "datagram %.*s", (int)len, buf);
+    len = recv(fd, buf, sizeof(buf), 0);
+    TEST_CHECK(len == 16 && !memcmp(buf, "second datagram\n", 16), "datagram %.*s", (int)len,
+               buf);
+    len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    TEST_CHECK(len < 0, "the filtered line is sent %.*s", (int)len, buf);
+    close(fd);
+}
+
+int main(void) {
+    test_init();
+    test_add_remove();
+    test_filter();
+    test_ring();
+    test_syslog();
+    test_udp();
+
+    return test_report("sink_test");
+}
@@ -0,0 +1,111 @@
+/*
+ * @Description: common part of the unit tests, every test is a program of its own. The C tests
+ * include log.c so its static functions and state can be tested directly.
+ */
+
+#ifndef __LOG_TEST_H__
+#define __LOG_TEST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+#include "log.h"
+#else
+#include "log.c"
+#endif
+
+/* size of the memory ring sink which captures the output */
+#define TEST_RING_SIZE (256 * 1024)
+
+static int test_failed;
+static int test_checked;
+
+#define TEST_CHECK(cond, ...)                                                                      \
+    do {                                                                                           \
+        test_checked++;                                                                            \
+        if (!(cond)) {                                                                             \
+            test_failed++;                                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond);               \
+            fprintf(stderr, __VA_ARGS__);                                                          \
+            fputc('\n', stderr);                                                                   \
+        }                                                                                          \
+    } while (0)
+
+/* memory ring sink which captures the output of a test */
+typedef struct {
+    int id;
+    log_sink_t sink;
+    char buf[TEST_RING_SIZE + 1];
+    size_t len;
+} test_ring_t;
+
+static void test_ring_open(test_ring_t* ring, uint8_t fmt) {
+    log_sink_ring_init(&ring->sink, TEST_RING_SIZE);
+    ring->sink.fmt = fmt;
+    ring->id       = log_add_sink(&ring->sink);
+    ring->len      = 0;
+    TEST_CHECK(ring->id >= 0, "add ring sink");
+}
+
+/* read the captured output, the ring sink is removed */
+static const char* test_ring_close(test_ring_t* ring) {
+    log_flush();
+    ring->len            = log_sink_ring_read(ring->sink.arg, ring->buf, TEST_RING_SIZE);
+    ring->buf[ring->len] = '\0';
+    log_remove_sink(ring->id);
+
+    return ring->buf;
+}
+
+/* count the occurrences of the string */
+static size_t test_count(const char* text, const char* str) {
+    size_t count = 0;
+
+    while ((text = strstr(text, str)) != NULL) {
+        count++;
+        text += strlen(str);
+    }
+
+    return count;
+}
+
+/* read the whole file as a string, return its size or -1 when it doesn't exist */
+static long test_read_file(const char* path, char* buf, size_t size) {
+    FILE* fp = fopen(path, "r");
+    size_t len;
+
+    if (fp == NULL) return -1;
+    len      = fread(buf, 1, size - 1, fp);
+    buf[len] = '\0';
+    fclose(fp);
+
+    return len;
+}
+
+/* initialize the logger, the output is checked by the ring sinks instead of the console */
+static void test_init(void) {
+#ifndef __cplusplus
+    /* the C++ tests link log.c, it is initialized by the first call */
+    log_init();
+#endif
+    log_set_sink_filter(LOG_SINK_CONSOLE, LOG_LVL_ASSERT, "\x01", LOG_SINK_FMT_ALL);
+}
+
+/**
+ * print the result of the test program
+ *
+ * @param name test name
+ *
+ * @return exit code of the test program
+ */
+static int test_report(const char* name) {
+    printf("%s: %d of %d checks failed\n", name, test_failed, test_checked);
+
+    return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* __LOG_TEST_H__ */